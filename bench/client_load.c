@@ -0,0 +1,394 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <wayland-client.h>
+
+// Synthetic client load.
+// Opens N windows on a running ember and commits SHM buffers at a fixed
+// rate (or as fast as frame callbacks allow) with a configurable damage
+// pattern. Reports achieved commit rate and frame callback latency, which
+// covers the protocol path: commit handling, uploads and repaint scheduling.
+// The display to load is named explicitly (--display or
+// EMBER_BENCH_DISPLAY), never taken from $WAYLAND_DISPLAY: that is usually
+// the desktop's own compositor, which is not what is being measured.
+// Exits with 77 (skipped) when none is given or it is not reachable.
+
+#define BUFFERS_PER_WINDOW 2
+
+enum damage_pattern {
+    DAMAGE_FULL,
+    DAMAGE_PARTIAL,
+    DAMAGE_NONE,
+};
+
+struct load_options {
+    const char *display; // Socket of the ember instance under test
+    int windows;
+    int32_t width, height;
+    uint32_t format;
+    double rate;    // Commits per second per window, 0 = frame callback driven
+    double seconds;
+    enum damage_pattern damage;
+};
+
+struct load_buffer {
+    struct wl_buffer *buffer;
+    uint32_t *pixels;
+    int busy;
+};
+
+struct load_window {
+    struct load_state *state;
+    int index;
+    struct wl_surface *surface;
+    struct load_buffer buffers[BUFFERS_PER_WINDOW];
+    struct wl_callback *frame;
+    double commit_time;  // When the commit waiting for a callback was sent
+    double next_commit;
+    int frame_number;
+};
+
+struct load_state {
+    struct load_options options;
+    struct wl_display *display;
+    struct wl_compositor *compositor;
+    struct wl_shm *shm;
+    struct load_window *windows;
+
+    // Results
+    uint64_t commits;
+    uint64_t dropped;   // Commit due but no free buffer
+    uint64_t callbacks;
+    double latency_total_ms;
+    double latency_max_ms;
+};
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// --- Registry ---
+
+static void registry_global(void *data, struct wl_registry *registry, uint32_t name,
+                            const char *interface, uint32_t version) {
+    struct load_state *state = data;
+    if (strcmp(interface, wl_compositor_interface.name) == 0) {
+        state->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, version < 4 ? version : 4);
+    } else if (strcmp(interface, wl_shm_interface.name) == 0) {
+        state->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+    }
+}
+
+static void registry_global_remove(void *data, struct wl_registry *registry, uint32_t name) {
+    (void)data; (void)registry; (void)name;
+}
+
+static const struct wl_registry_listener registry_listener = {
+    .global = registry_global,
+    .global_remove = registry_global_remove,
+};
+
+// --- Buffers ---
+
+static void buffer_release(void *data, struct wl_buffer *wl_buffer) {
+    (void)wl_buffer;
+    struct load_buffer *buffer = data;
+    buffer->busy = 0;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+    .release = buffer_release,
+};
+
+static int create_buffers(struct load_state *state, struct load_window *window) {
+    int32_t stride = state->options.width * 4;
+    size_t buffer_size = (size_t)stride * state->options.height;
+    size_t pool_size = buffer_size * BUFFERS_PER_WINDOW;
+
+    int fd = memfd_create("ember-client-load", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, pool_size) < 0) {
+        perror("memfd");
+        return -1;
+    }
+    uint8_t *data = mmap(NULL, pool_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return -1;
+    }
+
+    struct wl_shm_pool *pool = wl_shm_create_pool(state->shm, fd, pool_size);
+    for (int i = 0; i < BUFFERS_PER_WINDOW; i++) {
+        struct load_buffer *buffer = &window->buffers[i];
+        buffer->pixels = (uint32_t *)(data + buffer_size * i);
+        buffer->buffer = wl_shm_pool_create_buffer(pool, buffer_size * i, state->options.width,
+                                                   state->options.height, stride, state->options.format);
+        wl_buffer_add_listener(buffer->buffer, &buffer_listener, buffer);
+        memset(buffer->pixels, 0x80, buffer_size);
+    }
+    wl_shm_pool_destroy(pool);
+    close(fd);
+    return 0;
+}
+
+// --- Commits ---
+
+static void commit_window(struct load_window *window);
+
+static void frame_done(void *data, struct wl_callback *callback, uint32_t time) {
+    (void)time;
+    struct load_window *window = data;
+    struct load_state *state = window->state;
+    wl_callback_destroy(callback);
+    window->frame = NULL;
+
+    double latency = now_ms() - window->commit_time;
+    state->callbacks++;
+    state->latency_total_ms += latency;
+    if (latency > state->latency_max_ms) {
+        state->latency_max_ms = latency;
+    }
+
+    if (state->options.rate <= 0) {
+        commit_window(window);
+    }
+}
+
+static const struct wl_callback_listener frame_listener = {
+    .done = frame_done,
+};
+
+static void commit_window(struct load_window *window) {
+    struct load_state *state = window->state;
+    const struct load_options *options = &state->options;
+
+    struct load_buffer *buffer = NULL;
+    for (int i = 0; i < BUFFERS_PER_WINDOW; i++) {
+        if (!window->buffers[i].busy) {
+            buffer = &window->buffers[i];
+            break;
+        }
+    }
+    if (!buffer) {
+        state->dropped++;
+        return;
+    }
+
+    int32_t x = 0, y = 0, width = options->width, height = options->height;
+    if (options->damage == DAMAGE_PARTIAL) {
+        width = width < 64 ? width : 64;
+        height = height < 64 ? height : 64;
+        x = (window->frame_number * 8 + window->index * 16) % (options->width - width + 1);
+        y = (window->frame_number * 4 + window->index * 16) % (options->height - height + 1);
+    } else if (options->damage == DAMAGE_NONE) {
+        width = height = 0;
+    }
+
+    uint32_t color = 0xff000000 | (uint32_t)(window->frame_number * 2654435761u) >> 8;
+    for (int32_t row = y; row < y + height; row++) {
+        uint32_t *line = buffer->pixels + (size_t)row * options->width;
+        for (int32_t col = x; col < x + width; col++) {
+            line[col] = color;
+        }
+    }
+
+    wl_surface_attach(window->surface, buffer->buffer, 0, 0);
+    if (width > 0 && height > 0) {
+        if (wl_surface_get_version(window->surface) >= 4) {
+            wl_surface_damage_buffer(window->surface, x, y, width, height);
+        } else {
+            wl_surface_damage(window->surface, x, y, width, height);
+        }
+    }
+    // Measure latency for one commit at a time
+    if (!window->frame) {
+        window->frame = wl_surface_frame(window->surface);
+        wl_callback_add_listener(window->frame, &frame_listener, window);
+        window->commit_time = now_ms();
+    }
+    wl_surface_commit(window->surface);
+
+    buffer->busy = 1;
+    window->frame_number++;
+    state->commits++;
+}
+
+// --- Main ---
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --display NAME     ember socket to load (default $EMBER_BENCH_DISPLAY)\n"
+            "  --windows N        number of windows (default 4)\n"
+            "  --size WxH         window size (default 512x512)\n"
+            "  --format F         argb8888 or xrgb8888 (default argb8888)\n"
+            "  --rate HZ          commits per second per window, 0 = on frame callbacks (default 0)\n"
+            "  --damage P         full, partial or none (default partial)\n"
+            "  --seconds S        run time (default 10)\n",
+            name);
+}
+
+static int parse_options(int argc, char *argv[], struct load_options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            return -1;
+        }
+        i++;
+        if (strcmp(arg, "--display") == 0) {
+            options->display = value;
+        } else if (strcmp(arg, "--windows") == 0) {
+            options->windows = atoi(value);
+        } else if (strcmp(arg, "--size") == 0) {
+            if (sscanf(value, "%dx%d", &options->width, &options->height) != 2) return -1;
+        } else if (strcmp(arg, "--format") == 0) {
+            if (strcmp(value, "argb8888") == 0) options->format = WL_SHM_FORMAT_ARGB8888;
+            else if (strcmp(value, "xrgb8888") == 0) options->format = WL_SHM_FORMAT_XRGB8888;
+            else return -1;
+        } else if (strcmp(arg, "--rate") == 0) {
+            options->rate = atof(value);
+        } else if (strcmp(arg, "--damage") == 0) {
+            if (strcmp(value, "full") == 0) options->damage = DAMAGE_FULL;
+            else if (strcmp(value, "partial") == 0) options->damage = DAMAGE_PARTIAL;
+            else if (strcmp(value, "none") == 0) options->damage = DAMAGE_NONE;
+            else return -1;
+        } else if (strcmp(arg, "--seconds") == 0) {
+            options->seconds = atof(value);
+        } else {
+            return -1;
+        }
+    }
+    return options->windows > 0 && options->width > 0 && options->height > 0 && options->seconds > 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[]) {
+    struct load_state state = {
+        .options = {
+            .display = getenv("EMBER_BENCH_DISPLAY"),
+            .windows = 4,
+            .width = 512,
+            .height = 512,
+            .format = WL_SHM_FORMAT_ARGB8888,
+            .rate = 0,
+            .seconds = 10,
+            .damage = DAMAGE_PARTIAL,
+        },
+    };
+    if (parse_options(argc, argv, &state.options) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    const struct load_options *options = &state.options;
+
+    if (!options->display || !options->display[0]) {
+        printf("No ember instance given (--display or EMBER_BENCH_DISPLAY), skipping\n");
+        return 77;
+    }
+    state.display = wl_display_connect(options->display);
+    if (!state.display) {
+        printf("Cannot connect to %s, skipping\n", options->display);
+        return 77;
+    }
+    struct wl_registry *registry = wl_display_get_registry(state.display);
+    wl_registry_add_listener(registry, &registry_listener, &state);
+    wl_display_roundtrip(state.display);
+    if (!state.compositor || !state.shm) {
+        fprintf(stderr, "Compositor lacks wl_compositor or wl_shm\n");
+        return 1;
+    }
+
+    state.windows = calloc(options->windows, sizeof(struct load_window));
+    if (!state.windows) {
+        return 1;
+    }
+    for (int i = 0; i < options->windows; i++) {
+        struct load_window *window = &state.windows[i];
+        window->state = &state;
+        window->index = i;
+        window->surface = wl_compositor_create_surface(state.compositor);
+        if (create_buffers(&state, window) < 0) {
+            return 1;
+        }
+    }
+
+    // Map everything with full contents first
+    enum damage_pattern damage = options->damage;
+    state.options.damage = DAMAGE_FULL;
+    for (int i = 0; i < options->windows; i++) {
+        commit_window(&state.windows[i]);
+    }
+    state.options.damage = damage;
+    wl_display_roundtrip(state.display);
+
+    state.commits = state.dropped = state.callbacks = 0;
+    state.latency_total_ms = state.latency_max_ms = 0;
+
+    double start = now_ms();
+    double end = start + options->seconds * 1000.0;
+    double interval = options->rate > 0 ? 1000.0 / options->rate : 0;
+    for (int i = 0; i < options->windows; i++) {
+        state.windows[i].next_commit = start;
+    }
+
+    int fd = wl_display_get_fd(state.display);
+    for (;;) {
+        double now = now_ms();
+        if (now >= end) {
+            break;
+        }
+
+        double wake = end;
+        if (interval > 0) {
+            for (int i = 0; i < options->windows; i++) {
+                struct load_window *window = &state.windows[i];
+                if (window->next_commit <= now) {
+                    commit_window(window);
+                    // Stay on the schedule, do not try to catch up
+                    while (window->next_commit <= now) {
+                        window->next_commit += interval;
+                    }
+                }
+                if (window->next_commit < wake) {
+                    wake = window->next_commit;
+                }
+            }
+        }
+
+        wl_display_flush(state.display);
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int timeout = (int)(wake - now_ms());
+        if (poll(&pfd, 1, timeout > 0 ? timeout : 0) > 0) {
+            if (wl_display_dispatch(state.display) < 0) {
+                fprintf(stderr, "Lost connection to the compositor\n");
+                return 1;
+            }
+        } else {
+            wl_display_dispatch_pending(state.display);
+        }
+    }
+    double elapsed_s = (now_ms() - start) / 1000.0;
+
+    static const char *damage_names[] = {"full", "partial", "none"};
+    printf("client load: %d windows %dx%d, damage %s, rate %s\n",
+           options->windows, options->width, options->height, damage_names[options->damage],
+           options->rate > 0 ? "fixed" : "frame callbacks");
+    printf("  commits:         %.1f/s (%llu dropped, no free buffer)\n",
+           state.commits / elapsed_s, (unsigned long long)state.dropped);
+    printf("  frame callbacks: %.1f/s\n", state.callbacks / elapsed_s);
+    printf("  commit to done:  %.2f ms avg, %.2f ms max\n",
+           state.callbacks ? state.latency_total_ms / state.callbacks : 0.0, state.latency_max_ms);
+    printf("RESULT commits_per_s=%.2f callbacks_per_s=%.2f latency_avg_ms=%.3f latency_max_ms=%.3f\n",
+           state.commits / elapsed_s, state.callbacks / elapsed_s,
+           state.callbacks ? state.latency_total_ms / state.callbacks : 0.0, state.latency_max_ms);
+
+    wl_display_disconnect(state.display);
+    return 0;
+}
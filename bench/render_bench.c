@@ -0,0 +1,352 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "renderer.h"
+#include "input.h"
+
+// Headless render_frame benchmark.
+// Runs the real composite path (uploads, damage, repaint) on a surfaceless
+// EGL context into an FBO, so it works on machines without a GPU or DRM
+// device (Mesa llvmpipe). Synthetic windows are updated every frame
+// according to a damage pattern.
+
+enum damage_pattern {
+    DAMAGE_FULL,    // Every window redraws everything
+    DAMAGE_PARTIAL, // Every window redraws a small moving box
+    DAMAGE_NONE,    // Windows are static, only the cursor moves
+};
+
+struct bench_options {
+    int frames;
+    int warmup;
+    int windows;
+    int32_t width, height;             // Window size
+    int32_t output_width, output_height;
+    uint32_t format;
+    enum damage_pattern damage;
+};
+
+struct bench_window {
+    struct ember_surface *surface;
+    uint32_t *pixels;
+    int32_t stride;
+};
+
+static double timespec_ms(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --frames N         frames to measure (default 600)\n"
+            "  --windows N        number of windows (default 8)\n"
+            "  --size WxH         window size (default 512x512)\n"
+            "  --output WxH       output size (default 1920x1080)\n"
+            "  --format F         argb8888 or xrgb8888 (default argb8888)\n"
+            "  --damage P         full, partial or none (default partial)\n",
+            name);
+}
+
+static int parse_size(const char *arg, int32_t *width, int32_t *height) {
+    return sscanf(arg, "%dx%d", width, height) == 2 && *width > 0 && *height > 0 ? 0 : -1;
+}
+
+static int parse_options(int argc, char *argv[], struct bench_options *options) {
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!value) {
+            return -1;
+        }
+        i++;
+        if (strcmp(arg, "--frames") == 0) {
+            options->frames = atoi(value);
+        } else if (strcmp(arg, "--windows") == 0) {
+            options->windows = atoi(value);
+        } else if (strcmp(arg, "--size") == 0) {
+            if (parse_size(value, &options->width, &options->height) < 0) return -1;
+        } else if (strcmp(arg, "--output") == 0) {
+            if (parse_size(value, &options->output_width, &options->output_height) < 0) return -1;
+        } else if (strcmp(arg, "--format") == 0) {
+            if (strcmp(value, "argb8888") == 0) options->format = WL_SHM_FORMAT_ARGB8888;
+            else if (strcmp(value, "xrgb8888") == 0) options->format = WL_SHM_FORMAT_XRGB8888;
+            else return -1;
+        } else if (strcmp(arg, "--damage") == 0) {
+            if (strcmp(value, "full") == 0) options->damage = DAMAGE_FULL;
+            else if (strcmp(value, "partial") == 0) options->damage = DAMAGE_PARTIAL;
+            else if (strcmp(value, "none") == 0) options->damage = DAMAGE_NONE;
+            else return -1;
+        } else {
+            return -1;
+        }
+    }
+    return options->frames > 0 && options->windows >= 0 ? 0 : -1;
+}
+
+// Surfaceless EGL context, no window system or DRM device needed
+static int init_headless_egl(struct ember_server *server) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    EGLDisplay display = EGL_NO_DISPLAY;
+    if (get_platform_display) {
+        display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        fprintf(stderr, "Failed to initialize EGL\n");
+        return -1;
+    }
+    eglBindAPI(EGL_OPENGL_ES_API);
+
+    EGLint config_attribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint n_configs = 0;
+    if (!eglChooseConfig(display, config_attribs, &config, 1, &n_configs) || n_configs < 1) {
+        fprintf(stderr, "No EGL config for GLES2\n");
+        return -1;
+    }
+
+    EGLint context_attribs[] = {
+        EGL_CONTEXT_CLIENT_VERSION, 2,
+        EGL_NONE
+    };
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attribs);
+    if (context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Failed to create EGL context\n");
+        return -1;
+    }
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        fprintf(stderr, "Surfaceless contexts not supported\n");
+        return -1;
+    }
+
+    server->egl_display = display;
+    server->egl_config = config;
+    server->egl_context = context;
+
+    // Staged SHM uploads track their transfers with fences (upload.c)
+    if (has_extension(eglQueryString(display, EGL_EXTENSIONS), "EGL_KHR_fence_sync")) {
+        server->egl_create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+        server->egl_destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+        server->egl_client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+    }
+    printf("GL renderer: %s\n", (const char *)glGetString(GL_RENDERER));
+    return 0;
+}
+
+// Offscreen render target standing in for the scanout buffer
+static int init_fbo(int32_t width, int32_t height) {
+    GLuint texture, fbo;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Framebuffer incomplete\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void fill_box(struct bench_window *window, int32_t x, int32_t y, int32_t width, int32_t height, uint32_t color) {
+    for (int32_t row = y; row < y + height; row++) {
+        uint32_t *line = window->pixels + (size_t)row * (window->stride / 4);
+        for (int32_t col = x; col < x + width; col++) {
+            line[col] = color;
+        }
+    }
+}
+
+// What a client commit costs us: redraw part of the buffer, upload the
+// damaged box and damage the output
+static void update_window(struct ember_server *server, struct bench_window *window,
+                          const struct bench_options *options, int frame, int index) {
+    struct ember_surface *surface = window->surface;
+    int32_t x = 0, y = 0, width = surface->width, height = surface->height;
+    if (options->damage == DAMAGE_PARTIAL) {
+        width = width < 64 ? width : 64;
+        height = height < 64 ? height : 64;
+        x = (frame * 8 + index * 16) % (surface->width - width + 1);
+        y = (frame * 4 + index * 16) % (surface->height - height + 1);
+    }
+
+    uint32_t color = 0xff000000 | (uint32_t)(frame * 2654435761u + index * 40503u) >> 8;
+    fill_box(window, x, y, width, height, color);
+
+    pixman_region32_t damage;
+    pixman_region32_init_rect(&damage, x, y, width, height);
+    renderer_upload_pixels(server, surface, window->pixels, window->stride,
+                           surface->width, surface->height, options->format, &damage);
+    pixman_region32_fini(&damage);
+
+    damage_box(server, surface->pos_x + x, surface->pos_y + y, width, height);
+}
+
+static int create_windows(struct ember_server *server, const struct bench_options *options,
+                          struct bench_window *windows) {
+    for (int i = 0; i < options->windows; i++) {
+        struct ember_surface *surface = calloc(1, sizeof(struct ember_surface));
+        uint32_t *pixels = calloc((size_t)options->width * options->height, sizeof(uint32_t));
+        if (!surface || !pixels) {
+            free(surface);
+            free(pixels);
+            return -1;
+        }
+        surface->server = server;
+        surface->width = surface->buffer_width = options->width;
+        surface->height = surface->buffer_height = options->height;
+        surface->current.scale = 1;
+        surface->current.transform = WL_OUTPUT_TRANSFORM_NORMAL;
+        wl_list_init(&surface->current.frame_callbacks);
+        pixman_region32_init(&surface->current.opaque);
+        pixman_region32_init(&surface->current.input);
+
+        // Cascade the windows so they overlap like a real desktop
+        int32_t span_x = options->output_width - options->width;
+        int32_t span_y = options->output_height - options->height;
+        scene_node_init(&surface->node, &server->scene, &server->scene.layers[EMBER_SCENE_LAYER_WINDOWS], surface);
+        scene_node_set_position(&surface->node, span_x > 0 ? (i * 97) % span_x : 0,
+                                span_y > 0 ? (i * 61) % span_y : 0);
+        wl_list_insert(&server->surfaces, &surface->link);
+
+        windows[i].surface = surface;
+        windows[i].pixels = pixels;
+        windows[i].stride = options->width * 4;
+
+        // Initial contents
+        pixman_region32_t damage;
+        pixman_region32_init_rect(&damage, 0, 0, options->width, options->height);
+        fill_box(&windows[i], 0, 0, options->width, options->height, 0xff808080);
+        renderer_upload_pixels(server, surface, pixels, windows[i].stride,
+                               options->width, options->height, options->format, &damage);
+        pixman_region32_fini(&damage);
+        scene_surface_update(surface);
+    }
+    return 0;
+}
+
+static void run_frame(struct ember_output *output, struct bench_window *windows,
+                      const struct bench_options *options, int frame) {
+    struct ember_server *server = output->server;
+    if (options->damage == DAMAGE_NONE) {
+        damage_cursor(server);
+        server->cursor.x = (frame * 7) % output->mode.hdisplay;
+        server->cursor.y = (frame * 3) % output->mode.vdisplay;
+        damage_cursor(server);
+    } else {
+        for (int i = 0; i < options->windows; i++) {
+            update_window(server, &windows[i], options, frame, i);
+        }
+    }
+    render_frame(output);
+    // Count the GPU (llvmpipe) work of this frame, not just its submission
+    glFinish();
+}
+
+int main(int argc, char *argv[]) {
+    struct bench_options options = {
+        .frames = 600,
+        .warmup = 30,
+        .windows = 8,
+        .width = 512,
+        .height = 512,
+        .output_width = 1920,
+        .output_height = 1080,
+        .format = WL_SHM_FORMAT_ARGB8888,
+        .damage = DAMAGE_PARTIAL,
+    };
+    if (parse_options(argc, argv, &options) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (options.width > options.output_width || options.height > options.output_height) {
+        fprintf(stderr, "Windows must fit the output\n");
+        return 1;
+    }
+
+    struct ember_server server = {0};
+    server.wl_display = wl_display_create();
+    server.wl_event_loop = wl_display_get_event_loop(server.wl_display);
+    wl_list_init(&server.surfaces);
+    wl_list_init(&server.outputs);
+    init_scene(&server);
+
+    // One output without a window surface: render_frame draws into the FBO
+    struct ember_output output = {0};
+    output.server = &server;
+    output.mode.hdisplay = options.output_width;
+    output.mode.vdisplay = options.output_height;
+    output.egl_surface = EGL_NO_SURFACE;
+    wl_list_insert(&server.outputs, &output.link);
+    server.layout_width = options.output_width;
+    server.layout_height = options.output_height;
+
+    if (init_headless_egl(&server) < 0) return 1;
+    if (init_fbo(options.output_width, options.output_height) < 0) return 1;
+    if (init_renderer(&server) < 0) return 1;
+    if (init_repaint(&output) < 0) return 1;
+    init_damage(&output);
+    init_cursor(&server);
+
+    struct bench_window *windows = calloc(options.windows ? options.windows : 1, sizeof(struct bench_window));
+    if (!windows || create_windows(&server, &options, windows) < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    for (int frame = 0; frame < options.warmup; frame++) {
+        run_frame(&output, windows, &options, frame);
+    }
+
+    server.stats.bytes_uploaded = 0;
+    server.stats.frames_rendered = 0;
+    server.stats.draw_calls = 0;
+    server.stats.surfaces_occluded = 0;
+    server.stats.surfaces_drawn = 0;
+    double wall_start = timespec_ms(CLOCK_MONOTONIC);
+    double cpu_start = timespec_ms(CLOCK_PROCESS_CPUTIME_ID);
+    for (int frame = 0; frame < options.frames; frame++) {
+        run_frame(&output, windows, &options, options.warmup + frame);
+    }
+    double wall_ms = timespec_ms(CLOCK_MONOTONIC) - wall_start;
+    double cpu_ms = timespec_ms(CLOCK_PROCESS_CPUTIME_ID) - cpu_start;
+
+    static const char *damage_names[] = {"full", "partial", "none"};
+    uint64_t frames = server.stats.frames_rendered;
+    printf("render_frame: %dx%d output, %d windows %dx%d, damage %s\n",
+           options.output_width, options.output_height, options.windows,
+           options.width, options.height, damage_names[options.damage]);
+    printf("  frames:          %llu in %.1f ms\n", (unsigned long long)frames, wall_ms);
+    printf("  fps:             %.1f\n", frames * 1000.0 / wall_ms);
+    printf("  cpu per frame:   %.3f ms\n", cpu_ms / frames);
+    printf("  draw calls:      %.1f per frame\n", (double)server.stats.draw_calls / frames);
+    printf("  drawn:           %.1f surfaces per frame\n", (double)server.stats.surfaces_drawn / frames);
+    printf("  occluded:        %.1f surfaces per frame\n", (double)server.stats.surfaces_occluded / frames);
+    printf("  uploaded:        %.1f MiB (%.1f KiB per frame)\n",
+           server.stats.bytes_uploaded / (1024.0 * 1024.0),
+           server.stats.bytes_uploaded / 1024.0 / frames);
+    // One line for scripts comparing runs
+    printf("RESULT fps=%.2f cpu_ms_per_frame=%.4f draw_calls_per_frame=%.1f bytes_uploaded_per_frame=%llu\n",
+           frames * 1000.0 / wall_ms, cpu_ms / frames, (double)server.stats.draw_calls / frames,
+           (unsigned long long)(server.stats.bytes_uploaded / frames));
+    return 0;
+}
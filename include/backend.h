@@ -7,11 +7,63 @@
 int init_drm(struct ember_server *server);
 void handle_drm_event(struct ember_server *server);
 uint32_t get_fb_for_bo(int fd, struct gbm_bo *bo);
+int drm_queue_vblank(struct ember_output *output);
 
 // egl.c
 int init_egl(struct ember_server *server);
+int has_extension(const char *extensions, const char *name);
+int egl_get_dmabuf_formats(struct ember_server *server, struct wl_array *formats);
+EGLImageKHR egl_import_dmabuf(struct ember_server *server, const struct ember_dmabuf_attributes *attributes);
+
+// damage.c
+void init_damage(struct ember_output *output);
+void damage_output_whole(struct ember_output *output);
+void damage_output_box(struct ember_output *output, int32_t x, int32_t y, int32_t width, int32_t height);
+void damage_box(struct ember_server *server, int32_t x, int32_t y, int32_t width, int32_t height);
+void damage_region(struct ember_server *server, pixman_region32_t *region);
+void damage_get_repaint_region(struct ember_output *output, pixman_region32_t *damage, int buffer_age,
+                               pixman_region32_t *repaint);
+void damage_frame_submitted(struct ember_output *output, pixman_region32_t *damage);
+
+// kms.c
+int init_kms(struct ember_output *output);
+int kms_assign_planes(struct ember_output *output);
+int kms_present(struct ember_output *output, int composited);
+void kms_frame_done(struct ember_output *output);
+int kms_buffer_busy(struct ember_dmabuf_buffer *buffer);
+void kms_buffer_destroyed(struct ember_dmabuf_buffer *buffer);
+void kms_surface_destroyed(struct ember_surface *surface);
+
+// swapchain.c
+void swapchain_init(struct ember_swapchain *swapchain, int drm_fd, struct gbm_surface *surface);
+struct ember_swapchain_buffer *swapchain_lock(struct ember_swapchain *swapchain);
+void swapchain_queue(struct ember_swapchain *swapchain);
+void swapchain_discard(struct ember_swapchain *swapchain);
+void swapchain_flip_done(struct ember_swapchain *swapchain);
+uint32_t swapchain_last_fb(struct ember_swapchain *swapchain);
+int swapchain_can_render_ahead(struct ember_swapchain *swapchain);
+
+// repaint.c
+int init_repaint(struct ember_output *output);
+void schedule_repaint(struct ember_output *output);
+void schedule_surface_repaint(struct ember_surface *surface);
+void repaint_frame_done(struct ember_output *output, uint64_t vblank_ns);
+void repaint_frame_rendered(struct ember_output *output, int ret);
+uint64_t repaint_next_vblank_ns(struct ember_output *output, uint64_t now);
+
+// scene.c
+void init_scene(struct ember_server *server);
+void scene_node_init(struct ember_scene_node *node, struct ember_scene *scene,
+                     struct ember_scene_node *parent, struct ember_surface *surface);
+void scene_node_destroy(struct ember_scene_node *node);
+void scene_node_set_position(struct ember_scene_node *node, int32_t x, int32_t y);
+void scene_node_set_enabled(struct ember_scene_node *node, int enabled);
+void scene_surface_update(struct ember_surface *surface);
+struct ember_render_list *scene_render_list(struct ember_server *server);
 
 // output.c
 int init_output(struct ember_server *server);
+int output_intersects_box(struct ember_output *output, int32_t x, int32_t y, int32_t width, int32_t height);
+struct ember_output *output_at(struct ember_server *server, double x, double y);
 
 #endif
@@ -1,6 +1,7 @@
 #ifndef EMBER_H
 #define EMBER_H
 
+#include <stdatomic.h>
 #include <wayland-server.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
@@ -8,36 +9,537 @@
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
 #include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
 #include <libinput.h>
 #include <libudev.h>
+#include <pixman.h>
+#include <xkbcommon/xkbcommon.h>
+
+// Primary plane plus overlays used for scanout of client buffers
+#define EMBER_MAX_PLANES 4
+
+// Number of previous frames whose damage we remember for EGL_EXT_buffer_age
+#define EMBER_DAMAGE_HISTORY 4
+
+// Texture atlas shared by small SHM surfaces, split into pages that are
+// each cut into square slots of one size
+#define EMBER_ATLAS_SIZE 2048
+#define EMBER_ATLAS_PAGE_SIZE 256 // Also the largest surface put in the atlas
+#define EMBER_ATLAS_MIN_SLOT 32
+#define EMBER_ATLAS_PAGES ((EMBER_ATLAS_SIZE / EMBER_ATLAS_PAGE_SIZE) * (EMBER_ATLAS_SIZE / EMBER_ATLAS_PAGE_SIZE))
+
+// Cells of the pointer hit-test grid are 1 << EMBER_HIT_CELL_SHIFT pixels wide
+#define EMBER_HIT_CELL_SHIFT 7
+
+// Frames shown in the rolling graphs of the performance HUD
+#define EMBER_HUD_HISTORY 120
+// GPU timer queries per output, results come back a few frames late
+#define EMBER_HUD_QUERIES 4
+
+// Latency histograms have buckets of EMBER_LATENCY_BUCKET_US, the last
+// one also counts everything slower
+#define EMBER_LATENCY_BUCKET_US 100
+#define EMBER_LATENCY_BUCKETS 1000
+
+// Staging buffers SHM uploads go through, used in turn
+#define EMBER_UPLOAD_STAGING 3
+
+// Fragment shader variants (renderer.c), one per combination of these bits
+#define EMBER_SHADER_EXTERNAL (1 << 0) // samplerExternalOES: dmabufs GL only imports that way
+#define EMBER_SHADER_SWIZZLE  (1 << 1) // BGRA pixels in an RGBA texture, red and blue swapped
+#define EMBER_SHADER_STRAIGHT (1 << 2) // Not premultiplied, multiplied in when blending
+#define EMBER_SHADER_VARIANTS 8
 
 // Forward declarations
 struct ember_server;
+struct ember_output;
+
+#define EMBER_DMABUF_MAX_PLANES 4
+
+// Description of a client buffer shared through zwp_linux_dmabuf_v1
+struct ember_dmabuf_attributes {
+    int32_t width, height;
+    uint32_t format;   // DRM fourcc
+    uint32_t flags;    // zwp_linux_buffer_params_v1 flags
+    uint64_t modifier; // DRM format modifier, shared by all planes
+    int n_planes;
+    int fd[EMBER_DMABUF_MAX_PLANES];
+    uint32_t offset[EMBER_DMABUF_MAX_PLANES];
+    uint32_t stride[EMBER_DMABUF_MAX_PLANES];
+};
+
+// wl_buffer created from dmabufs
+struct ember_dmabuf_buffer {
+    struct wl_resource *resource;
+    struct ember_server *server;
+    struct ember_dmabuf_attributes attributes;
+    EGLImageKHR image; // Imported once, bound to surface textures on commit
+    struct ember_scanout_fb *scanout_fb; // KMS framebuffer, imported on first scanout attempt
+    int scanout_failed;                  // Import failed, never try again
+    int release_deferred;                // Replaced while on a plane, release when it leaves the screen
+};
+
+// KMS framebuffer of a client buffer, shared by the buffer and the planes
+// showing it so it can outlive the wl_buffer while on screen
+struct ember_scanout_fb {
+    int refcount;
+    int drm_fd;
+    uint32_t fb_id;
+    struct gbm_bo *bo;
+    struct ember_dmabuf_buffer *buffer; // NULL once the wl_buffer is destroyed
+};
+
+struct ember_plane_props {
+    uint32_t fb_id, crtc_id;
+    uint32_t src_x, src_y, src_w, src_h;
+    uint32_t crtc_x, crtc_y, crtc_w, crtc_h;
+    uint32_t zpos; // 0 when the plane has no zpos or cannot change it
+};
+
+struct ember_plane {
+    struct ember_output *output; // Plane is bound to this output's CRTC
+    uint32_t id;
+    uint32_t type; // DRM_PLANE_TYPE_*
+    struct ember_plane_props props;
+    uint64_t zpos_min, zpos_max; // Stacking range, equal when fixed by the driver
+    uint64_t zpos;               // Position in the next commit, higher is on top
+    uint32_t *formats;
+    uint32_t n_formats;
+    struct ember_surface *surface;       // Client surface shown instead of being composited
+    struct ember_scanout_fb *next_fb;    // Chosen for the next commit
+    struct ember_scanout_fb *pending_fb; // Committed, waiting for the flip
+    struct ember_scanout_fb *current_fb; // On screen (NULL: composited frame or disabled)
+};
+
+// A format/modifier pair the renderer can import
+struct ember_dmabuf_format {
+    uint32_t format;
+    uint64_t modifier;
+    int external_only; // Sampled through GL_TEXTURE_EXTERNAL_OES
+};
 
 struct ember_cursor {
     double x, y;
     float size;
-    GLuint texture_id;
+    GLuint texture_id;     // GL fallback
     int visible;
+    struct gbm_bo *bo;     // Image for the DRM cursor planes, shared by all outputs
+};
+
+// Place of a surface in the atlas (size 0: not in the atlas)
+struct ember_atlas_slot {
+    int page, index;
+    int32_t x, y; // Top-left corner in the atlas texture
+    int32_t size;
+};
+
+struct ember_atlas_page {
+    int32_t slot_size; // 0 = page unused
+    uint64_t used;     // One bit per slot
+};
+
+struct ember_atlas {
+    GLuint texture; // Created with the first small surface
+    struct ember_atlas_page pages[EMBER_ATLAS_PAGES];
+};
+
+// Texture or atlas slot let go while a frame on the render thread may still
+// sample it. Freed once every frame up to and including `frame` is drawn.
+struct ember_retired {
+    GLuint texture;               // 0: the atlas slot is retired instead
+    struct ember_atlas_slot slot;
+    uint64_t frame;               // Last snapshot that may name it
+};
+
+// Program of one fragment shader variant, 0 when it could not be built
+struct ember_shader {
+    GLuint program;
+    GLint loc_transform; // Output pixels -> clip space, set when switching to it
+};
+
+// One draw call: consecutive quads sampling the same texture
+struct ember_render_batch {
+    GLuint texture;
+    int blend;  // Drawn with alpha blending, opaque quads are not
+    int shader; // EMBER_SHADER_* variant
+    int first_quad;
+    int n_quads;
+};
+
+// Parts of struct ember_surface_state set since the last commit
+enum ember_surface_state_field {
+    EMBER_SURFACE_STATE_BUFFER = 1 << 0,
+    EMBER_SURFACE_STATE_OPAQUE_REGION = 1 << 1,
+    EMBER_SURFACE_STATE_INPUT_REGION = 1 << 2,
+    EMBER_SURFACE_STATE_SCALE = 1 << 3,
+    EMBER_SURFACE_STATE_TRANSFORM = 1 << 4,
+};
+
+// Double-buffered wl_surface state, applied atomically on commit
+struct ember_surface_state {
+    uint32_t committed; // EMBER_SURFACE_STATE_* fields set (pending state only)
+
+    struct wl_resource *buffer;
+    struct wl_listener buffer_destroy;
+    int32_t dx, dy; // Attach offset
+
+    pixman_region32_t damage;        // Surface coordinates
+    pixman_region32_t buffer_damage; // Buffer coordinates
+    pixman_region32_t opaque;
+    pixman_region32_t input;
+
+    int32_t scale;
+    int32_t transform; // enum wl_output_transform
+
+    struct wl_list frame_callbacks; // wl_callback resources
+};
+
+// Layers of the scene, bottom to top
+enum ember_scene_layer {
+    EMBER_SCENE_LAYER_BACKGROUND,
+    EMBER_SCENE_LAYER_WINDOWS,
+    EMBER_SCENE_LAYER_OVERLAY,
+    EMBER_SCENE_LAYER_COUNT,
+};
+
+// Flags of a render list entry
+#define EMBER_RENDER_VISIBLE (1u << 0) // Mapped, with contents to draw
+#define EMBER_RENDER_OPAQUE  (1u << 1) // Buffer format without alpha
+
+struct ember_scene;
+
+// Node of the scene tree: a plain tree node (root, layers) or a surface
+struct ember_scene_node {
+    struct ember_scene *scene;
+    struct ember_scene_node *parent;
+    struct wl_list children;   // Bottom to top
+    struct wl_list link;       // In parent->children
+    int enabled;               // Disabled nodes hide their whole subtree
+    int32_t x, y;              // Relative to the parent
+    int32_t world_x, world_y;  // Layout position, updated with every move
+
+    // Surface nodes: cached by scene_surface_update for the render list
+    struct ember_surface *surface;
+    int32_t width, height;
+    GLuint texture;
+    float texcoords[8];        // TL, BL, BR, TR, mapped into the texture
+    int shader;                // EMBER_SHADER_* bits of the texture
+    uint32_t flags;            // EMBER_RENDER_*
+};
+
+// The scene compiled for drawing: visible surfaces topmost first, one
+// contiguous array per field
+struct ember_render_list {
+    int count, capacity;
+    struct ember_surface **surfaces;
+    pixman_box32_t *boxes;  // Layout coordinates
+    GLuint *textures;
+    float *texcoords;       // 8 per entry
+    int *shaders;
+    uint32_t *flags;
+};
+
+struct ember_scene {
+    struct ember_scene_node root;
+    struct ember_scene_node layers[EMBER_SCENE_LAYER_COUNT];
+    struct ember_render_list list;
+    int dirty; // The tree changed since list was compiled
 };
 
 struct ember_surface {
+    struct ember_server *server;
     struct wl_resource *resource;
     struct wl_list link; // Link to server->surfaces
     
+    // Surface State
+    struct ember_surface_state pending; // Built up by requests
+    struct ember_surface_state current; // Applied on commit
+
     // Rendering State
-    struct wl_resource *buffer; // The attached wl_buffer
-    int32_t pos_x, pos_y;       // Window position
+    struct ember_scene_node node;
+    int32_t pos_x, pos_y;                // Layout position, kept by node
+    int32_t width, height;               // Size in surface coordinates
+    int32_t buffer_width, buffer_height; // Size of the committed buffer
     
     // GL State
     GLuint texture_id;
-    EGLImageKHR egl_image;
+    int32_t texture_width, texture_height; // Size of the allocated texture storage
+    GLenum texture_target;    // GL_TEXTURE_2D, or GL_TEXTURE_EXTERNAL_OES for some dmabufs
+    GLenum texture_format;
+    int shader;               // EMBER_SHADER_* bits needed to sample the texture
+    int buffer_opaque;        // Buffer format has no alpha channel (XRGB and friends)
+    struct ember_atlas_slot atlas; // Contents live in the shared atlas instead of texture_id
+    uint64_t texture_frame;   // Last snapshot naming the texture or atlas slot
+    EGLImageKHR egl_image;    // Image of the bound dmabuf buffer, owned by the buffer
+    struct ember_plane *plane; // Shown on a KMS plane instead of being composited
+
+    // Input State
+    uint64_t stack_order;       // Higher is further up, matches the order of server->surfaces
+    int32_t grid_x0, grid_y0;   // Cells of the hit-test grid listing the surface,
+    int32_t grid_x1, grid_y1;   // x0 <= col < x1, y0 <= row < y1
+    struct wl_array latency;    // struct ember_latency_sample, committed but not on screen yet
     
     // Double Buffering State
     struct gbm_bo *previous_bo;
     uint32_t previous_fb_id;
 };
 
+enum ember_buffer_state {
+    EMBER_BUFFER_FREE,      // Owned by the gbm surface
+    EMBER_BUFFER_RENDERING, // Drawn by GL, not yet handed to KMS
+    EMBER_BUFFER_QUEUED,    // Committed, waiting for the flip
+    EMBER_BUFFER_SCANOUT,   // On screen
+};
+
+// Per gbm_bo data, lives as long as the bo (gbm_bo_set_user_data)
+struct ember_swapchain_buffer {
+    struct gbm_bo *bo;
+    int drm_fd;
+    uint32_t fb_id; // Created once, removed when gbm destroys the bo
+    enum ember_buffer_state state;
+};
+
+struct ember_swapchain {
+    struct gbm_surface *surface;
+    int drm_fd;
+    int triple_buffering; // Allow drawing a frame while another one waits for its flip
+    struct ember_swapchain_buffer *rendering;
+    struct ember_swapchain_buffer *queued;
+    struct ember_swapchain_buffer *scanout;
+};
+
+enum ember_repaint_state {
+    EMBER_REPAINT_IDLE,         // Nothing to draw, no flip outstanding
+    EMBER_REPAINT_SCHEDULED,    // Timer armed for the next frame
+    EMBER_REPAINT_FLIP_PENDING, // Frame being drawn or waiting for the vblank
+    EMBER_REPAINT_RENDERING,    // Frame handed to the render thread, not presented yet
+};
+
+// Seat objects of one client. Found from the wl_client through its destroy
+// listener, so input goes to the focused client without scanning everyone.
+struct ember_seat_client {
+    struct ember_server *server;
+    struct wl_client *client;
+    struct wl_listener destroy;
+    struct wl_list link;      // ember_server.seat_clients
+    struct wl_list seats;     // wl_seat resources
+    struct wl_list pointers;  // wl_pointer resources
+    struct wl_list keyboards; // wl_keyboard resources
+    struct wl_list touches;   // wl_touch resources
+    struct wl_array latency;  // struct ember_latency_sample, input sent, waiting for a commit
+};
+
+struct ember_latency_histogram {
+    uint64_t count;
+    uint64_t max_us;
+    uint32_t buckets[EMBER_LATENCY_BUCKETS];
+};
+
+// An input device as seen by the latency tracking. Kept until exit, so
+// the numbers of unplugged devices can still be dumped.
+struct ember_input_device {
+    struct wl_list link; // ember_server.input_devices
+    char *name;
+    struct ember_latency_histogram to_commit; // Event -> next commit of the client it went to
+    struct ember_latency_histogram to_photon; // Event -> page flip showing that commit
+};
+
+// An input event on its way to the screen (times are CLOCK_MONOTONIC)
+struct ember_latency_sample {
+    struct ember_input_device *device;
+    uint64_t input_us;  // libinput event time
+    uint64_t commit_us; // Answered by a commit at this time, 0 before
+};
+
+// A libinput event boiled down to what the main thread acts on, so it can
+// be made on the input thread (input_record_from_event)
+struct ember_input_record {
+    enum libinput_event_type type;      // DEVICE_ADDED, KEYBOARD_KEY or POINTER_*
+    struct ember_input_device *device;  // Source of the event (DEVICE_ADDED: the new device)
+    uint64_t time_us;                   // libinput event time, 0 for device changes
+    union {
+        struct { uint32_t key, state; } key;       // WL_KEYBOARD_KEY_STATE_*
+        struct { double x, y; } motion;            // Cursor position after the event, clamped
+        struct { uint32_t button, state; } button; // WL_POINTER_BUTTON_STATE_*
+        struct {
+            uint32_t source; // WL_POINTER_AXIS_SOURCE_*
+            int has_vertical, has_horizontal;
+            double vertical, horizontal;
+        } axis;
+    };
+};
+
+// Uniform grid over the layout, each cell lists the surfaces overlapping it
+struct ember_hit_grid {
+    int32_t cols, rows;
+    struct wl_array *cells; // struct ember_surface *, row-major
+};
+
+// Counters read by the benchmarks
+struct ember_stats {
+    uint64_t frames_rendered;
+    uint64_t draw_calls;
+    uint64_t bytes_uploaded; // Texture data copied from client buffers
+    uint64_t surfaces_occluded; // Skipped, hidden behind opaque surfaces above
+    uint64_t surfaces_drawn;    // Composited, at least partly visible
+};
+
+// Pixel buffer the damaged part of an SHM commit is copied into, the GPU
+// fetches it into the texture on its own time
+struct ember_upload_staging {
+    GLuint buffer;
+    GLsizeiptr size;
+    EGLSyncKHR fence; // Transfer out of it, EGL_NO_SYNC_KHR once done
+};
+
+// SHM upload pipeline (upload.c)
+struct ember_upload {
+    // GLES3 or GL_EXT_map_buffer_range with GL_NV_pixel_buffer_object, and
+    // EGL fences. NULL without them: uploads read client memory directly.
+    PFNGLMAPBUFFERRANGEEXTPROC map_buffer_range;
+    PFNGLUNMAPBUFFEROESPROC unmap_buffer;
+    struct ember_upload_staging staging[EMBER_UPLOAD_STAGING];
+    int next;
+};
+
+// Performance overlay (hud.c), shared by all outputs
+struct ember_hud {
+    int enabled;
+    int key_held; // F12 of Logo+F12 is down, its release is not sent to clients
+    GLuint texture; // Font and colours, created when first shown
+
+    // GL_EXT_disjoint_timer_query, NULL without it
+    PFNGLGENQUERIESEXTPROC gen_queries;
+    PFNGLBEGINQUERYEXTPROC begin_query;
+    PFNGLENDQUERYEXTPROC end_query;
+    PFNGLGETQUERYOBJECTIVEXTPROC get_query_objectiv;
+    PFNGLGETQUERYOBJECTUI64VEXTPROC get_query_objectui64v;
+};
+
+// What the HUD shows about one output
+struct ember_output_hud {
+    // Composited frames, ring ending before frame_head
+    uint64_t cpu_ns[EMBER_HUD_HISTORY]; // render_frame up to the swap
+    uint64_t gpu_ns[EMBER_HUD_HISTORY]; // 0 until the timer query result is in
+    int frame_head;
+
+    // Presented frames, ring ending before flip_head
+    uint64_t flip_ns[EMBER_HUD_HISTORY]; // Time since the previous flip
+    int flip_head;
+    uint64_t last_flip_ns;
+    uint64_t missed_vblanks;
+
+    uint64_t surfaces_drawn;  // Last frame
+    uint64_t bytes_uploaded;  // Since the frame before
+    uint64_t bytes_seen;      // stats.bytes_uploaded at the last frame
+
+    // Only used by the renderer (the render thread, when there is one)
+    GLuint queries[EMBER_HUD_QUERIES];
+    int query_frame[EMBER_HUD_QUERIES];   // Slot in gpu_ns measured by the query
+    int query_pending[EMBER_HUD_QUERIES]; // Ended, result not read yet
+    int query_active;                     // Query + 1 running for this frame, 0: none
+};
+
+// Quad drawn over the scene (HUD, GL cursor) in output pixels, st are the
+// texture coordinates of the corners in TL, BL, BR, TR order. Their
+// textures are RGBA or BGRA with straight alpha.
+struct ember_overlay_quad {
+    GLuint texture;
+    float x0, y0, x1, y1;
+    float st[8];
+};
+
+// What drawing a frame reports back to the protocol thread
+struct ember_frame_result {
+    int ret;         // render_frame's return value
+    uint64_t cpu_ns; // Drawing up to the swap
+    uint64_t draw_calls, surfaces_drawn, surfaces_occluded;
+    int n_gpu_times; // Timer queries of earlier frames that came back
+    int gpu_slot[EMBER_HUD_QUERIES];
+    uint64_t gpu_ns[EMBER_HUD_QUERIES];
+};
+
+// Everything one frame of an output is drawn from, copied out of the scene
+// on the protocol thread (snapshot.c). The renderer never looks at surfaces
+// or the scene, so a render thread can draw while they keep changing.
+struct ember_frame_snapshot {
+    uint64_t seq;              // Numbers snapshots across all outputs, from 1
+    int count, capacity;
+    pixman_box32_t *boxes;     // Output coordinates, topmost first
+    GLuint *textures;
+    float *texcoords;          // 8 per entry
+    int *shaders;              // EMBER_SHADER_* bits per entry
+    pixman_region32_t *opaque; // Output coordinates, drawn without blending
+    struct wl_array overlays;  // struct ember_overlay_quad, drawn on top in order
+    pixman_region32_t damage;  // Output damage since the previous frame
+    int hud_slot;              // Frame in the HUD history, -1 while the HUD is off
+    EGLSyncKHR fence;          // Uploads made before the snapshot (render thread only)
+    struct ember_frame_result result;
+};
+
+// One monitor: a connector driven by a CRTC, with its own buffers, damage
+// and repaint loop. Outputs sit side by side in the layout (global
+// coordinates, which is what surface and cursor positions use).
+struct ember_output {
+    struct ember_server *server;
+    struct wl_list link; // Link to server->outputs
+    int32_t x, y;        // Top-left corner in the layout
+
+    // Monitor
+    drmModeConnector *connector;
+    drmModeModeInfo mode;
+    drmModeCrtc *crtc;
+    int crtc_index; // Index of crtc in drmModeRes (needed for vblank requests)
+    struct gbm_surface *gbm_surface;
+    EGLSurface egl_surface;
+    struct ember_swapchain swapchain;
+    atomic_int hw_cursor; // Cursor is on this CRTC's cursor plane, not composited (read by the input thread)
+
+    // Atomic KMS (legacy SetCrtc/PageFlip when atomic is 0)
+    int atomic;
+    int kms_modeset_done;
+    int kms_commit_pending; // A commit has not reached the screen yet
+    uint32_t mode_blob_id;
+    uint32_t connector_prop_crtc_id;
+    uint32_t crtc_prop_mode_id, crtc_prop_active;
+    struct ember_plane planes[EMBER_MAX_PLANES]; // [0] = primary, then overlays
+    int n_planes;
+    int direct_scanout; // Primary plane shows a client buffer, nothing is composited
+
+    // Damage State (output coordinates)
+    pixman_region32_t damage; // Damage accumulated for the next frame
+    pixman_region32_t damage_history[EMBER_DAMAGE_HISTORY]; // [0] = previous frame
+
+    // Repaint Scheduling (times are CLOCK_MONOTONIC nanoseconds)
+    enum ember_repaint_state repaint_state;
+    int repaint_needed;                // Something changed since the last frame started
+    int repaint_ahead_scheduled;       // Timer armed to draw ahead of a pending flip
+    struct wl_event_source *repaint_timer;
+    uint64_t repaint_last_vblank_ns;   // Timestamp of the last presented frame
+    uint64_t repaint_target_ns;        // Vblank the frame in flight is aiming for
+    uint64_t repaint_refresh_ns;       // Duration of one refresh cycle
+    uint64_t repaint_render_ns;        // Estimated time to render a frame
+    struct wl_list frame_callbacks;        // wl_callback resources waiting for the next page flip
+    struct wl_list frame_callbacks_queued; // For a frame drawn ahead, not yet committed
+    struct wl_array latency;               // struct ember_latency_sample shown by the next page flip
+    struct wl_array latency_queued;        // Same for a frame drawn ahead
+    struct ember_output_hud hud;
+
+    // Filled in turn: the one being drawn is never the one being taken.
+    // With a render thread, frames go there through render_published and
+    // come back through render_done.
+    struct ember_frame_snapshot snapshots[2];
+    int snapshot_next;
+    _Atomic(struct ember_frame_snapshot *) render_published;
+    _Atomic(struct ember_frame_snapshot *) render_done;
+    uint64_t render_start_ns; // Frame handed to the render thread
+    uint64_t render_seq;      // Snapshot on the render thread, 0 when none
+
+    // Wayland Global
+    struct wl_global *global;
+    struct wl_list resources; // wl_output resources
+};
+
 struct ember_server {
     struct wl_display *wl_display;
     struct wl_event_loop *wl_event_loop;
@@ -45,16 +547,18 @@ struct ember_server {
     // Core Subsystems
     struct udev *udev;
     struct libinput *libinput;
+    struct ember_input_thread *input_thread; // EMBER_INPUT_THREAD: libinput is read there, not on the main loop
     
     // Wayland Globals
     struct wl_global *compositor;
     struct wl_list surfaces; // List of all surfaces
     struct wl_global *shm_global;
     struct wl_global *compositor_global; 
-    struct wl_global *output_global;
     struct wl_global *seat_global;
     struct wl_global *xdg_shell_global;
     struct wl_global *ddm_global;
+    struct wl_global *linux_dmabuf_global;
+    struct wl_array dmabuf_formats; // struct ember_dmabuf_format
 
     // DRM/GBM/EGL State
     int drm_fd;
@@ -62,31 +566,70 @@ struct ember_server {
     EGLDisplay egl_display;
     EGLContext egl_context;
     EGLConfig egl_config;
-    EGLSurface egl_surface;
 
-    // Output State (Monitor)
-    drmModeConnector *connector;
-    drmModeModeInfo mode;
-    drmModeCrtc *crtc;
-    struct gbm_surface *gbm_surface;
-    
+    // EGL extensions used for partial repaint
+    int egl_has_buffer_age;
+    PFNEGLSETDAMAGEREGIONKHRPROC egl_set_damage_region;
+    PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC egl_swap_buffers_with_damage;
+
+    // EGL/GL extensions used for zero-copy dmabuf import
+    int egl_has_dmabuf_import;
+    PFNEGLCREATEIMAGEKHRPROC egl_create_image;
+    PFNEGLDESTROYIMAGEKHRPROC egl_destroy_image;
+    PFNEGLQUERYDMABUFFORMATSEXTPROC egl_query_dmabuf_formats;
+    PFNEGLQUERYDMABUFMODIFIERSEXTPROC egl_query_dmabuf_modifiers;
+    PFNGLEGLIMAGETARGETTEXTURE2DOESPROC gl_image_target_texture_2d;
+
+    // EGL_KHR_fence_sync / EGL_KHR_wait_sync, NULL without them
+    PFNEGLCREATESYNCKHRPROC egl_create_sync;
+    PFNEGLDESTROYSYNCKHRPROC egl_destroy_sync;
+    PFNEGLCLIENTWAITSYNCKHRPROC egl_client_wait_sync;
+    PFNEGLWAITSYNCKHRPROC egl_wait_sync;
+    int egl_has_surfaceless_context;
+
+    // Outputs
+    struct wl_list outputs; // struct ember_output
+    int32_t layout_width, layout_height; // Bounding box of all outputs
+
     // Rendering State
-    struct gbm_bo *previous_bo;
-    uint32_t previous_fb_id;
-    GLuint shader_program; // Moved here from static in drm.c
-    GLint loc_pos;
-    GLint loc_texcoord;
-    GLint loc_tex;
+    struct ember_shader shaders[EMBER_SHADER_VARIANTS]; // Indexed by EMBER_SHADER_* bits
+    GLuint quad_vbo;      // Vertices of every quad in a frame, refilled once per frame
+    GLuint quad_ibo;      // Static indices, two triangles per quad
+    struct wl_array quad_vertices; // x, y, s, t floats per vertex, built on the CPU
+    struct wl_array batches;       // struct ember_render_batch
+    struct ember_atlas atlas;
+    struct ember_scene scene;
+    int gl_has_unpack_subimage; // GL_EXT_unpack_subimage (row strides for uploads)
+    int gl_has_bgra;            // GL_EXT_texture_format_BGRA8888, else BGRA is swizzled
+    int gl_has_image_external;  // GL_OES_EGL_image_external
+    struct ember_upload upload;
+    struct ember_stats stats;
+    struct ember_hud hud;
+    struct ember_render_thread *render_thread; // EMBER_RENDER_THREAD: frames are drawn there
+    uint64_t frame_seq;                        // Last snapshot taken
+    struct wl_array retired;                   // struct ember_retired, freed as frames come back
 
     // Input State
     struct ember_cursor cursor;
-    struct ember_surface *focused_surface; // Surface with keyboard/pointer focus
+    struct ember_surface *focused_surface; // Surface with keyboard focus
+    struct ember_surface *pointer_surface; // Surface under the pointer, has pointer focus
+    struct ember_hit_grid hit_grid;
+    uint64_t next_stack_order;
+    struct xkb_context *xkb_context;
+    struct xkb_keymap *xkb_keymap;  // Compiled once, see seat_set_keymap
+    struct xkb_state *xkb_state;    // Modifiers and layout, tracked here for all clients
+    int keymap_fd;                  // Sealed memfd with the keymap text, sent to every wl_keyboard
+    uint32_t keymap_size;
+    int pointer_frame_pending;   // Pointer events sent since the last wl_pointer.frame
+    int pointer_coalesce;        // EMBER_COALESCE_MOTION: motion sent once per refresh
+    int pointer_motion_pending;  // Coalesced motion waiting for pointer_motion_timer
+    struct wl_event_source *pointer_motion_timer;
+    struct wl_list input_devices;           // struct ember_input_device
+    struct ember_input_device *input_device; // Device of the libinput event being handled, else NULL
+    uint64_t input_time_us;                 // Its timestamp
 
     // Client Resources (for broadcasting events)
-    struct wl_list seat_resources;
-    struct wl_list output_resources;
-    struct wl_list keyboard_resources; // Active wl_keyboard resources
-    struct wl_list pointer_resources;  // Active wl_pointer resources
+    struct wl_list seat_clients; // struct ember_seat_client
 };
 
 #endif
@@ -6,18 +6,50 @@
 // input.c (libinput)
 int init_input(struct ember_server *server);
 int on_input_readable(int fd, uint32_t mask, void *data);
+int input_record_from_event(struct ember_server *server, struct libinput_event *event,
+                            double *cursor_x, double *cursor_y, struct ember_input_record *record);
+void input_handle_record(struct ember_server *server, const struct ember_input_record *record);
+
+// input_thread.c
+int init_input_thread(struct ember_server *server);
+void input_thread_finish(struct ember_server *server);
 
 // cursor.c
 void init_cursor(struct ember_server *server);
-void render_cursor(struct ember_server *server);
+int get_cursor_quad(struct ember_output *output, GLuint *texture, float *x, float *y, float *size);
+void damage_cursor(struct ember_server *server);
+int init_hw_cursor(struct ember_output *output);
+void move_cursor(struct ember_server *server);
+void move_hw_cursors(struct ember_server *server, double x, double y);
 
 // dispatch.c
 void dispatch_keyboard_key(struct ember_server *server, uint32_t key, uint32_t state);
-void dispatch_keyboard_modifiers(struct ember_server *server, uint32_t mods_depressed, 
-                                  uint32_t mods_latched, uint32_t mods_locked, uint32_t group);
+void dispatch_keyboard_modifiers(struct ember_server *server);
 void dispatch_pointer_motion(struct ember_server *server, double x, double y);
 void dispatch_pointer_button(struct ember_server *server, uint32_t button, uint32_t state);
+void dispatch_pointer_axis(struct ember_server *server, uint32_t source, uint32_t axis, double value);
+void dispatch_pointer_frame(struct ember_server *server);
+int init_pointer_dispatch(struct ember_server *server);
 void set_keyboard_focus(struct ember_server *server, struct ember_surface *surface);
 void update_focus(struct ember_server *server);
+int update_pointer_focus(struct ember_server *server);
+void input_surface_changed(struct ember_surface *surface);
+void input_surface_destroyed(struct ember_surface *surface);
+
+// latency.c
+void init_latency(struct ember_server *server);
+struct ember_input_device *latency_device_create(struct libinput_device *libinput_device);
+void latency_device_added(struct ember_server *server, struct ember_input_device *device);
+void latency_input_sent(struct ember_seat_client *seat_client);
+void latency_surface_committed(struct ember_surface *surface);
+void latency_collect(struct ember_surface *surface, struct wl_array *frame);
+void latency_frame_presented(struct wl_array *frame, uint64_t vblank_ns);
+void latency_dump(struct ember_server *server);
+
+// hit_grid.c
+int init_hit_grid(struct ember_server *server);
+void hit_grid_update_surface(struct ember_surface *surface);
+void hit_grid_remove_surface(struct ember_surface *surface);
+struct ember_surface *surface_at(struct ember_server *server, double x, double y, double *sx, double *sy);
 
 #endif
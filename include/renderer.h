@@ -4,6 +4,54 @@
 #include "ember.h"
 
 int init_renderer(struct ember_server *server);
-void render_frame(struct ember_server *server);
+// Composite the damaged parts of the output into the next buffer of its gbm
+// surface; kms_present puts it on screen. Returns -1 on error.
+int render_frame(struct ember_output *output);
+void renderer_draw_snapshot(struct ember_output *output, struct ember_frame_snapshot *frame, EGLContext context);
+void renderer_upload_surface(struct ember_server *server, struct ember_surface *surface,
+                             struct wl_shm_buffer *shm_buffer, pixman_region32_t *buffer_damage);
+void renderer_upload_pixels(struct ember_server *server, struct ember_surface *surface,
+                            const void *pixels, int32_t stride, int32_t width, int32_t height,
+                            uint32_t format, pixman_region32_t *buffer_damage);
+void renderer_attach_dmabuf(struct ember_server *server, struct ember_surface *surface,
+                            struct ember_dmabuf_buffer *buffer);
+void renderer_destroy_surface(struct ember_surface *surface);
+int renderer_surface_texcoords(struct ember_server *server, struct ember_surface *surface,
+                               GLuint *texture, float st[8]);
+void renderer_release_textures(struct ember_server *server);
+int renderer_get_shm_formats(struct ember_server *server, struct wl_array *formats);
+
+// atlas.c
+int atlas_alloc(struct ember_server *server, int32_t width, int32_t height, struct ember_atlas_slot *slot);
+void atlas_free(struct ember_server *server, struct ember_atlas_slot *slot);
+int atlas_slot_fits(const struct ember_atlas_slot *slot, int32_t width, int32_t height);
+
+// upload.c
+void init_upload(struct ember_server *server, const char *gl_extensions);
+int upload_staged(struct ember_server *server, const uint8_t *data, int32_t stride, GLenum gl_format,
+                  GLenum gl_type, int bpp, int32_t dst_x, int32_t dst_y, pixman_region32_t *damage);
+
+// hud.c
+void init_hud(struct ember_server *server, const char *gl_extensions);
+void hud_toggle(struct ember_server *server);
+void hud_frame_begin(struct ember_output *output, struct ember_frame_snapshot *frame);
+void hud_add_quads(struct ember_output *output, struct ember_frame_snapshot *frame);
+void hud_gpu_begin(struct ember_output *output, struct ember_frame_snapshot *frame);
+void hud_gpu_end(struct ember_output *output);
+void hud_frame_rendered(struct ember_output *output, struct ember_frame_snapshot *frame);
+void hud_frame_presented(struct ember_output *output, uint64_t vblank_ns, uint64_t missed);
+
+// snapshot.c
+void init_snapshots(struct ember_output *output);
+struct ember_frame_snapshot *snapshot_take(struct ember_output *output);
+void snapshot_add_quad(struct ember_frame_snapshot *frame, GLuint texture,
+                       float x0, float y0, float x1, float y1, const float st[8]);
+void snapshot_finish(struct ember_output *output, struct ember_frame_snapshot *frame);
+
+// render_thread.c
+int init_render_thread(struct ember_server *server);
+void render_thread_submit(struct ember_output *output);
+void render_thread_finish(struct ember_server *server);
+uint64_t render_thread_oldest_frame(struct ember_server *server);
 
 #endif
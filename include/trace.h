@@ -0,0 +1,49 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include "ember.h"
+
+// Event tracing (trace.c), written out as Chrome trace-event JSON.
+// Names and categories must be string literals (or otherwise outlive the
+// trace), only the pointers are recorded.
+
+#ifdef EMBER_TRACING
+
+extern int ember_trace_enabled;
+
+void trace_record(char phase, const char *category, const char *name, uint64_t id);
+
+// Nested spans on the calling thread
+static inline void trace_begin(const char *category, const char *name) {
+    if (ember_trace_enabled) trace_record('B', category, name, 0);
+}
+
+static inline void trace_end(const char *category, const char *name) {
+    if (ember_trace_enabled) trace_record('E', category, name, 0);
+}
+
+static inline void trace_instant(const char *category, const char *name) {
+    if (ember_trace_enabled) trace_record('i', category, name, 0);
+}
+
+int init_trace(struct ember_server *server, const char *path);
+void trace_finish(void);
+void trace_thread_name(const char *name);
+void trace_input_flow(void);
+void trace_frame_flows(void);
+
+#else
+
+static inline void trace_begin(const char *category, const char *name) { (void)category; (void)name; }
+static inline void trace_end(const char *category, const char *name) { (void)category; (void)name; }
+static inline void trace_instant(const char *category, const char *name) { (void)category; (void)name; }
+static inline int init_trace(struct ember_server *server, const char *path) { (void)server; (void)path; return 0; }
+static inline void trace_finish(void) {}
+static inline void trace_thread_name(const char *name) { (void)name; }
+static inline void trace_input_flow(void) {}
+static inline void trace_frame_flows(void) {}
+
+#endif
+
+#endif
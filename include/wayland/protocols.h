@@ -11,5 +11,13 @@ int init_shm(struct ember_server *server);
 int init_shell(struct ember_server *server);
 int init_seat(struct ember_server *server);
 int init_data_device_manager(struct ember_server *server);
+int init_linux_dmabuf(struct ember_server *server);
+
+// seat.c
+struct ember_seat_client *seat_client_from_client(struct wl_client *client);
+int seat_set_keymap(struct ember_server *server, const struct xkb_rule_names *names);
+
+// linux_dmabuf.c
+struct ember_dmabuf_buffer *dmabuf_buffer_from_resource(struct wl_resource *resource);
 
 #endif
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include "ember.h"
+#include "renderer.h"
+
+// Texture atlas for small surfaces.
+// Popups, tooltips and notifications are tiny but numerous. Giving each its
+// own texture means one draw call per surface; packing them into a shared
+// texture lets the renderer draw runs of them in one batch.
+//
+// The atlas is split into pages of EMBER_ATLAS_PAGE_SIZE. A page is handed to
+// one slot size (a power of two from EMBER_ATLAS_MIN_SLOT up to the page size)
+// and cut into a grid of square slots tracked by a bitmap. Freed slots are
+// reused, and a page with no slots left in use can take another size.
+
+#define ATLAS_PAGES_PER_ROW (EMBER_ATLAS_SIZE / EMBER_ATLAS_PAGE_SIZE)
+
+static int32_t slot_size_for(int32_t width, int32_t height) {
+    int32_t needed = width > height ? width : height;
+    int32_t size = EMBER_ATLAS_MIN_SLOT;
+    while (size < needed) {
+        size *= 2;
+    }
+    return size;
+}
+
+static int slots_per_page(int32_t slot_size) {
+    int per_row = EMBER_ATLAS_PAGE_SIZE / slot_size;
+    return per_row * per_row;
+}
+
+static int create_atlas_texture(struct ember_atlas *atlas) {
+    // Only report errors of the allocation below
+    while (glGetError() != GL_NO_ERROR);
+
+    glGenTextures(1, &atlas->texture);
+    glBindTexture(GL_TEXTURE_2D, atlas->texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_BGRA_EXT, EMBER_ATLAS_SIZE, EMBER_ATLAS_SIZE, 0,
+                 GL_BGRA_EXT, GL_UNSIGNED_BYTE, NULL);
+    if (glGetError() != GL_NO_ERROR) {
+        fprintf(stderr, "Failed to allocate %dx%d atlas, small surfaces get their own textures\n",
+                EMBER_ATLAS_SIZE, EMBER_ATLAS_SIZE);
+        glDeleteTextures(1, &atlas->texture);
+        atlas->texture = 0;
+        return -1;
+    }
+    printf("Created %dx%d surface atlas\n", EMBER_ATLAS_SIZE, EMBER_ATLAS_SIZE);
+    return 0;
+}
+
+static void take_slot(struct ember_atlas_page *page, int page_index, int index, struct ember_atlas_slot *slot) {
+    int per_row = EMBER_ATLAS_PAGE_SIZE / page->slot_size;
+    page->used |= 1ull << index;
+    slot->page = page_index;
+    slot->index = index;
+    slot->size = page->slot_size;
+    slot->x = (page_index % ATLAS_PAGES_PER_ROW) * EMBER_ATLAS_PAGE_SIZE + (index % per_row) * page->slot_size;
+    slot->y = (page_index / ATLAS_PAGES_PER_ROW) * EMBER_ATLAS_PAGE_SIZE + (index / per_row) * page->slot_size;
+}
+
+// Reserve room for a width x height image. Returns -1 when the surface is
+// too big or the atlas is full; the caller then uses a texture of its own.
+int atlas_alloc(struct ember_server *server, int32_t width, int32_t height, struct ember_atlas_slot *slot) {
+    struct ember_atlas *atlas = &server->atlas;
+    if (width <= 0 || height <= 0 || width > EMBER_ATLAS_PAGE_SIZE || height > EMBER_ATLAS_PAGE_SIZE) {
+        return -1;
+    }
+    if (!atlas->texture && create_atlas_texture(atlas) < 0) {
+        return -1;
+    }
+
+    int32_t size = slot_size_for(width, height);
+    int n_slots = slots_per_page(size);
+    uint64_t all = n_slots == 64 ? ~0ull : (1ull << n_slots) - 1;
+
+    // A free slot in a page of the right size
+    int empty_page = -1;
+    for (int p = 0; p < EMBER_ATLAS_PAGES; p++) {
+        struct ember_atlas_page *page = &atlas->pages[p];
+        if (page->slot_size == 0) {
+            if (empty_page < 0) empty_page = p;
+            continue;
+        }
+        if (page->slot_size != size || page->used == all) {
+            continue;
+        }
+        for (int i = 0; i < n_slots; i++) {
+            if (!(page->used & (1ull << i))) {
+                take_slot(page, p, i, slot);
+                return 0;
+            }
+        }
+    }
+
+    // Otherwise start a new page
+    if (empty_page < 0) {
+        return -1;
+    }
+    atlas->pages[empty_page].slot_size = size;
+    atlas->pages[empty_page].used = 0;
+    take_slot(&atlas->pages[empty_page], empty_page, 0, slot);
+    return 0;
+}
+
+void atlas_free(struct ember_server *server, struct ember_atlas_slot *slot) {
+    if (slot->size == 0) {
+        return;
+    }
+    struct ember_atlas_page *page = &server->atlas.pages[slot->page];
+    page->used &= ~(1ull << slot->index);
+    if (page->used == 0) {
+        page->slot_size = 0;
+    }
+    memset(slot, 0, sizeof(*slot));
+}
+
+// Whether an image of this size still fits the slot it has
+int atlas_slot_fits(const struct ember_atlas_slot *slot, int32_t width, int32_t height) {
+    return slot->size > 0 && width <= slot->size && height <= slot->size;
+}
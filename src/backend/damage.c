@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pixman.h>
+#include "ember.h"
+#include "backend.h"
+
+// Output damage is tracked per output, in output coordinates.
+// output->damage collects everything that changed since the last frame and
+// goes into the frame's snapshot when drawing starts. damage_history
+// remembers what changed in the frames before that so we know how stale a
+// reused back buffer (EGL_EXT_buffer_age) is; only the renderer touches it.
+// Callers pass layout coordinates; damage_box/damage_region split it across
+// the outputs it touches, so each output only repaints for its own changes.
+
+void init_damage(struct ember_output *output) {
+    pixman_region32_init(&output->damage);
+    for (int i = 0; i < EMBER_DAMAGE_HISTORY; i++) {
+        pixman_region32_init(&output->damage_history[i]);
+    }
+
+    // Nothing has been drawn yet
+    damage_output_whole(output);
+}
+
+void damage_output_whole(struct ember_output *output) {
+    damage_output_box(output, output->x, output->y, output->mode.hdisplay, output->mode.vdisplay);
+}
+
+// Box in layout coordinates, clipped to the output
+void damage_output_box(struct ember_output *output, int32_t x, int32_t y, int32_t width, int32_t height) {
+    if (width <= 0 || height <= 0 || !output_intersects_box(output, x, y, width, height)) {
+        return;
+    }
+    pixman_region32_union_rect(&output->damage, &output->damage, x - output->x, y - output->y, width, height);
+    pixman_region32_intersect_rect(&output->damage, &output->damage,
+                                   0, 0, output->mode.hdisplay, output->mode.vdisplay);
+    schedule_repaint(output);
+}
+
+void damage_box(struct ember_server *server, int32_t x, int32_t y, int32_t width, int32_t height) {
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        damage_output_box(output, x, y, width, height);
+    }
+}
+
+void damage_region(struct ember_server *server, pixman_region32_t *region) {
+    if (!pixman_region32_not_empty(region)) {
+        return;
+    }
+
+    pixman_region32_t clipped;
+    pixman_region32_init(&clipped);
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        pixman_region32_intersect_rect(&clipped, region, output->x, output->y,
+                                       output->mode.hdisplay, output->mode.vdisplay);
+        if (!pixman_region32_not_empty(&clipped)) {
+            continue;
+        }
+        pixman_region32_translate(&clipped, -output->x, -output->y);
+        pixman_region32_union(&output->damage, &output->damage, &clipped);
+        schedule_repaint(output);
+    }
+    pixman_region32_fini(&clipped);
+}
+
+// Compute the area that must be redrawn into a back buffer of the given age,
+// damage being what changed for this frame.
+// Age 0 means the buffer contents are undefined, age N means the buffer
+// holds the frame we submitted N frames ago.
+void damage_get_repaint_region(struct ember_output *output, pixman_region32_t *damage, int buffer_age,
+                               pixman_region32_t *repaint) {
+    if (buffer_age <= 0 || buffer_age > EMBER_DAMAGE_HISTORY + 1) {
+        pixman_region32_fini(repaint);
+        pixman_region32_init_rect(repaint, 0, 0, output->mode.hdisplay, output->mode.vdisplay);
+        return;
+    }
+
+    pixman_region32_copy(repaint, damage);
+    for (int i = 0; i < buffer_age - 1; i++) {
+        pixman_region32_union(repaint, repaint, &output->damage_history[i]);
+    }
+}
+
+// Called once a frame has been handed to the display: its damage becomes
+// history
+void damage_frame_submitted(struct ember_output *output, pixman_region32_t *damage) {
+    for (int i = EMBER_DAMAGE_HISTORY - 1; i > 0; i--) {
+        pixman_region32_copy(&output->damage_history[i], &output->damage_history[i - 1]);
+    }
+    pixman_region32_copy(&output->damage_history[0], damage);
+}
@@ -10,6 +10,7 @@
 #include <gbm.h>
 #include "backend.h"
 #include "renderer.h"
+#include "trace.h"
 
 // Helper: Open the first available DRM card
 static int open_drm_device(void) {
@@ -44,16 +45,32 @@ uint32_t get_fb_for_bo(int fd, struct gbm_bo *bo) {
 }
 
 // DRM Page Flip Handler (Called when VSync happens)
+// The user data of every flip and vblank request is the output it is for.
+// Event timestamps are CLOCK_MONOTONIC, same clock the repaint scheduler uses
 static void page_flip_handler(int fd, unsigned int frame,
                               unsigned int sec, unsigned int usec,
                               void *data) {
-    (void)fd; (void)frame; (void)sec; (void)usec;
-    struct ember_server *server = data;
-    render_frame(server);
+    (void)fd; (void)frame;
+    struct ember_output *output = data;
+    trace_begin("kms", "page_flip_handler");
+    repaint_frame_done(output, (uint64_t)sec * 1000000000ull + (uint64_t)usec * 1000ull);
+    trace_end("kms", "page_flip_handler");
+}
+
+// Vblank requested by drm_queue_vblank, a frame with nothing new to show
+static void vblank_handler(int fd, unsigned int frame,
+                           unsigned int sec, unsigned int usec,
+                           void *data) {
+    (void)fd; (void)frame;
+    struct ember_output *output = data;
+    trace_begin("kms", "vblank_handler");
+    repaint_frame_done(output, (uint64_t)sec * 1000000000ull + (uint64_t)usec * 1000ull);
+    trace_end("kms", "vblank_handler");
 }
 
 static drmEventContext drm_evctx = {
     .version = 2,
+    .vblank_handler = vblank_handler,
     .page_flip_handler = page_flip_handler,
 };
 
@@ -61,6 +78,25 @@ void handle_drm_event(struct ember_server *server) {
     drmHandleEvent(server->drm_fd, &drm_evctx);
 }
 
+// Ask for an event at the output's next vblank without flipping
+int drm_queue_vblank(struct ember_output *output) {
+    drmVBlank vbl = {0};
+    vbl.request.type = DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT;
+    if (output->crtc_index > 1) {
+        vbl.request.type |= (output->crtc_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK;
+    } else if (output->crtc_index == 1) {
+        vbl.request.type |= DRM_VBLANK_SECONDARY;
+    }
+    vbl.request.sequence = 1;
+    vbl.request.signal = (unsigned long)output;
+
+    if (drmWaitVBlank(output->server->drm_fd, &vbl)) {
+        fprintf(stderr, "drmWaitVBlank failed: %m\n");
+        return -1;
+    }
+    return 0;
+}
+
 int init_drm(struct ember_server *server) {
     server->drm_fd = open_drm_device();
     if (server->drm_fd < 0) {
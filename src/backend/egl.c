@@ -1,10 +1,27 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <gbm.h>
 #include <EGL/egl.h>
 #include <EGL/eglext.h>
+#include <drm_fourcc.h>
+#include <wayland-server.h>
 #include "backend.h"
 
+// Check for a whole word in a space separated extension string
+int has_extension(const char *extensions, const char *name) {
+    if (!extensions) return 0;
+    size_t len = strlen(name);
+    const char *p = extensions;
+    while ((p = strstr(p, name))) {
+        if ((p == extensions || p[-1] == ' ') && (p[len] == ' ' || p[len] == '\0')) {
+            return 1;
+        }
+        p += len;
+    }
+    return 0;
+}
+
 int init_egl(struct ember_server *server) {
     server->egl_display = eglGetPlatformDisplay(EGL_PLATFORM_GBM_MESA, server->gbm_device, NULL);
     if (server->egl_display == EGL_NO_DISPLAY) {
@@ -17,6 +34,46 @@ int init_egl(struct ember_server *server) {
         return -1;
     }
 
+    // Optional extensions for partial repaint
+    const char *extensions = eglQueryString(server->egl_display, EGL_EXTENSIONS);
+    server->egl_has_buffer_age = has_extension(extensions, "EGL_EXT_buffer_age");
+    if (has_extension(extensions, "EGL_KHR_partial_update")) {
+        server->egl_set_damage_region = (PFNEGLSETDAMAGEREGIONKHRPROC)eglGetProcAddress("eglSetDamageRegionKHR");
+    }
+    if (has_extension(extensions, "EGL_KHR_swap_buffers_with_damage")) {
+        server->egl_swap_buffers_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageKHR");
+    } else if (has_extension(extensions, "EGL_EXT_swap_buffers_with_damage")) {
+        server->egl_swap_buffers_with_damage = (PFNEGLSWAPBUFFERSWITHDAMAGEKHRPROC)eglGetProcAddress("eglSwapBuffersWithDamageEXT");
+    }
+    // Zero-copy import of client dmabufs
+    if (has_extension(extensions, "EGL_KHR_image_base")) {
+        server->egl_create_image = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+        server->egl_destroy_image = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+    }
+    if (has_extension(extensions, "EGL_EXT_image_dma_buf_import_modifiers")) {
+        server->egl_query_dmabuf_formats = (PFNEGLQUERYDMABUFFORMATSEXTPROC)eglGetProcAddress("eglQueryDmaBufFormatsEXT");
+        server->egl_query_dmabuf_modifiers = (PFNEGLQUERYDMABUFMODIFIERSEXTPROC)eglGetProcAddress("eglQueryDmaBufModifiersEXT");
+    }
+    server->gl_image_target_texture_2d = (PFNGLEGLIMAGETARGETTEXTURE2DOESPROC)eglGetProcAddress("glEGLImageTargetTexture2DOES");
+    server->egl_has_dmabuf_import = has_extension(extensions, "EGL_EXT_image_dma_buf_import") &&
+                                    server->egl_create_image && server->egl_destroy_image &&
+                                    server->gl_image_target_texture_2d;
+    // Ordering GL work across contexts (render thread) and staged uploads
+    if (has_extension(extensions, "EGL_KHR_fence_sync")) {
+        server->egl_create_sync = (PFNEGLCREATESYNCKHRPROC)eglGetProcAddress("eglCreateSyncKHR");
+        server->egl_destroy_sync = (PFNEGLDESTROYSYNCKHRPROC)eglGetProcAddress("eglDestroySyncKHR");
+        server->egl_client_wait_sync = (PFNEGLCLIENTWAITSYNCKHRPROC)eglGetProcAddress("eglClientWaitSyncKHR");
+    }
+    if (has_extension(extensions, "EGL_KHR_wait_sync")) {
+        server->egl_wait_sync = (PFNEGLWAITSYNCKHRPROC)eglGetProcAddress("eglWaitSyncKHR");
+    }
+    server->egl_has_surfaceless_context = has_extension(extensions, "EGL_KHR_surfaceless_context");
+
+    printf("EGL: buffer_age=%d partial_update=%d swap_with_damage=%d\n",
+           server->egl_has_buffer_age,
+           server->egl_set_damage_region != NULL,
+           server->egl_swap_buffers_with_damage != NULL);
+
     // Choose EGL Config
     EGLint attributes[] = {
         EGL_SURFACE_TYPE, EGL_WINDOW_BIT,
@@ -47,3 +104,143 @@ int init_egl(struct ember_server *server) {
 
     return 0;
 }
+
+static void add_dmabuf_format(struct wl_array *formats, uint32_t format, uint64_t modifier, int external_only) {
+    struct ember_dmabuf_format *entry = wl_array_add(formats, sizeof(*entry));
+    if (entry) {
+        entry->format = format;
+        entry->modifier = modifier;
+        entry->external_only = external_only;
+    }
+}
+
+// Collect the format/modifier pairs we can import and sample, as
+// GL_TEXTURE_2D or, with GL_OES_EGL_image_external, as an external texture
+// (external_only). Returns the number of pairs added.
+int egl_get_dmabuf_formats(struct ember_server *server, struct wl_array *formats) {
+    if (!server->egl_has_dmabuf_import) {
+        return 0;
+    }
+
+    // Without the modifiers extension only implicit modifiers are possible
+    if (!server->egl_query_dmabuf_formats || !server->egl_query_dmabuf_modifiers) {
+        add_dmabuf_format(formats, DRM_FORMAT_ARGB8888, DRM_FORMAT_MOD_INVALID, 0);
+        add_dmabuf_format(formats, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_INVALID, 0);
+        return 2;
+    }
+
+    EGLint num_formats = 0;
+    if (!server->egl_query_dmabuf_formats(server->egl_display, 0, NULL, &num_formats) || num_formats <= 0) {
+        return 0;
+    }
+    EGLint *fourccs = calloc(num_formats, sizeof(EGLint));
+    if (!fourccs) return 0;
+    server->egl_query_dmabuf_formats(server->egl_display, num_formats, fourccs, &num_formats);
+
+    int count = 0;
+    for (EGLint i = 0; i < num_formats; i++) {
+        EGLint num_modifiers = 0;
+        server->egl_query_dmabuf_modifiers(server->egl_display, fourccs[i], 0, NULL, NULL, &num_modifiers);
+
+        if (num_modifiers <= 0) {
+            // Implicit modifier is always allowed
+            add_dmabuf_format(formats, fourccs[i], DRM_FORMAT_MOD_INVALID, 0);
+            count++;
+            continue;
+        }
+
+        EGLuint64KHR *modifiers = calloc(num_modifiers, sizeof(EGLuint64KHR));
+        EGLBoolean *external_only = calloc(num_modifiers, sizeof(EGLBoolean));
+        if (modifiers && external_only) {
+            server->egl_query_dmabuf_modifiers(server->egl_display, fourccs[i], num_modifiers,
+                                               modifiers, external_only, &num_modifiers);
+            // The implicit modifier needs an external texture when every
+            // explicit one does (YUV formats)
+            int all_external = num_modifiers > 0;
+            for (EGLint j = 0; j < num_modifiers; j++) {
+                all_external &= external_only[j] != 0;
+            }
+            if (!all_external || server->gl_has_image_external) {
+                add_dmabuf_format(formats, fourccs[i], DRM_FORMAT_MOD_INVALID, all_external);
+                count++;
+            }
+            for (EGLint j = 0; j < num_modifiers; j++) {
+                // Sampled through GL_OES_EGL_image_external only
+                if (external_only[j] && !server->gl_has_image_external) continue;
+                add_dmabuf_format(formats, fourccs[i], modifiers[j], external_only[j] != 0);
+                count++;
+            }
+        } else {
+            add_dmabuf_format(formats, fourccs[i], DRM_FORMAT_MOD_INVALID, 0);
+            count++;
+        }
+        free(modifiers);
+        free(external_only);
+    }
+
+    free(fourccs);
+    return count;
+}
+
+// Wrap a client dmabuf in an EGLImage. No pixel data is copied.
+EGLImageKHR egl_import_dmabuf(struct ember_server *server, const struct ember_dmabuf_attributes *attributes) {
+    static const EGLint plane_fd[EMBER_DMABUF_MAX_PLANES] = {
+        EGL_DMA_BUF_PLANE0_FD_EXT, EGL_DMA_BUF_PLANE1_FD_EXT,
+        EGL_DMA_BUF_PLANE2_FD_EXT, EGL_DMA_BUF_PLANE3_FD_EXT,
+    };
+    static const EGLint plane_offset[EMBER_DMABUF_MAX_PLANES] = {
+        EGL_DMA_BUF_PLANE0_OFFSET_EXT, EGL_DMA_BUF_PLANE1_OFFSET_EXT,
+        EGL_DMA_BUF_PLANE2_OFFSET_EXT, EGL_DMA_BUF_PLANE3_OFFSET_EXT,
+    };
+    static const EGLint plane_pitch[EMBER_DMABUF_MAX_PLANES] = {
+        EGL_DMA_BUF_PLANE0_PITCH_EXT, EGL_DMA_BUF_PLANE1_PITCH_EXT,
+        EGL_DMA_BUF_PLANE2_PITCH_EXT, EGL_DMA_BUF_PLANE3_PITCH_EXT,
+    };
+    static const EGLint plane_modifier_lo[EMBER_DMABUF_MAX_PLANES] = {
+        EGL_DMA_BUF_PLANE0_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_LO_EXT,
+        EGL_DMA_BUF_PLANE2_MODIFIER_LO_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_LO_EXT,
+    };
+    static const EGLint plane_modifier_hi[EMBER_DMABUF_MAX_PLANES] = {
+        EGL_DMA_BUF_PLANE0_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE1_MODIFIER_HI_EXT,
+        EGL_DMA_BUF_PLANE2_MODIFIER_HI_EXT, EGL_DMA_BUF_PLANE3_MODIFIER_HI_EXT,
+    };
+
+    if (!server->egl_has_dmabuf_import) {
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    int has_modifier = attributes->modifier != DRM_FORMAT_MOD_INVALID;
+    if (has_modifier && !server->egl_query_dmabuf_modifiers) {
+        return EGL_NO_IMAGE_KHR;
+    }
+
+    EGLint attribs[7 + EMBER_DMABUF_MAX_PLANES * 10 + 3];
+    int n = 0;
+    attribs[n++] = EGL_WIDTH;
+    attribs[n++] = attributes->width;
+    attribs[n++] = EGL_HEIGHT;
+    attribs[n++] = attributes->height;
+    attribs[n++] = EGL_LINUX_DRM_FOURCC_EXT;
+    attribs[n++] = attributes->format;
+
+    for (int i = 0; i < attributes->n_planes; i++) {
+        attribs[n++] = plane_fd[i];
+        attribs[n++] = attributes->fd[i];
+        attribs[n++] = plane_offset[i];
+        attribs[n++] = attributes->offset[i];
+        attribs[n++] = plane_pitch[i];
+        attribs[n++] = attributes->stride[i];
+        if (has_modifier) {
+            attribs[n++] = plane_modifier_lo[i];
+            attribs[n++] = (EGLint)(attributes->modifier & 0xFFFFFFFF);
+            attribs[n++] = plane_modifier_hi[i];
+            attribs[n++] = (EGLint)(attributes->modifier >> 32);
+        }
+    }
+
+    attribs[n++] = EGL_IMAGE_PRESERVED_KHR;
+    attribs[n++] = EGL_TRUE;
+    attribs[n++] = EGL_NONE;
+
+    return server->egl_create_image(server->egl_display, EGL_NO_CONTEXT, EGL_LINUX_DMA_BUF_EXT, NULL, attribs);
+}
@@ -0,0 +1,390 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "renderer.h"
+
+// Performance HUD.
+// An overlay in the top-left corner of every output, toggled with Logo+F12,
+// showing how long the last frame took on the CPU (render_frame up to the
+// swap) and on the GPU (GL_EXT_disjoint_timer_query), the interval between
+// page flips, missed vblanks, surfaces drawn and texture bytes uploaded.
+// CPU, GPU and flip times also get a rolling graph of the last
+// EMBER_HUD_HISTORY frames, with the refresh period marked at half height.
+//
+// Everything is drawn as quads of one small texture (a 3x5 pixel font and
+// a few solid colours) through the regular batches, on top of the scene
+// and below the GL cursor. The HUD is only updated by frames that are drawn
+// anyway: it adds its box to the damage of each frame, but never schedules
+// one itself, so an idle desktop stays idle.
+
+#define HUD_FONT_W 3
+#define HUD_FONT_H 5
+#define HUD_SCALE 2 // Font pixels per texel
+#define HUD_ADVANCE ((HUD_FONT_W + 1) * HUD_SCALE)
+#define HUD_LINE ((HUD_FONT_H + 2) * HUD_SCALE)
+#define HUD_MARGIN 8 // From the output corner
+#define HUD_PAD 6
+#define HUD_LINES 6
+#define HUD_BAR_W 2
+#define HUD_GRAPHS 3
+#define HUD_GRAPH_W (EMBER_HUD_HISTORY * HUD_BAR_W)
+#define HUD_GRAPH_H 40
+#define HUD_WIDTH (HUD_GRAPH_W + 2 * HUD_PAD)
+#define HUD_HEIGHT (HUD_PAD + HUD_LINES * HUD_LINE + HUD_GRAPHS * (HUD_GRAPH_H + HUD_PAD))
+
+// Texture layout: glyphs side by side in the first rows, colours in the last
+#define HUD_TEXTURE_W 128
+#define HUD_TEXTURE_H 8
+#define HUD_COLOR_ROW (HUD_TEXTURE_H - 1)
+
+static const char hud_glyphs[] = "0123456789.-BCFGIKLMPRSU";
+
+// One row per byte, bit 2 is the left column
+static const uint8_t hud_font[][HUD_FONT_H] = {
+    {7, 5, 5, 5, 7}, {2, 6, 2, 2, 7}, {7, 1, 7, 4, 7}, {7, 1, 7, 1, 7}, // 0-3
+    {5, 5, 7, 1, 1}, {7, 4, 7, 1, 7}, {7, 4, 7, 5, 7}, {7, 1, 1, 1, 1}, // 4-7
+    {7, 5, 7, 5, 7}, {7, 5, 7, 1, 7}, {0, 0, 0, 0, 2}, {0, 0, 7, 0, 0}, // 8, 9, '.', '-'
+    {6, 5, 6, 5, 6}, {7, 4, 4, 4, 7}, {7, 4, 6, 4, 4}, {7, 4, 5, 5, 7}, // B, C, F, G
+    {7, 2, 2, 2, 7}, {5, 5, 6, 5, 5}, {4, 4, 4, 4, 7}, {5, 7, 7, 5, 5}, // I, K, L, M
+    {6, 5, 6, 4, 4}, {6, 5, 6, 5, 5}, {7, 4, 7, 1, 7}, {5, 5, 5, 5, 7}, // P, R, S, U
+};
+
+enum hud_color {
+    HUD_COLOR_BACKGROUND,
+    HUD_COLOR_GRAPH,
+    HUD_COLOR_BUDGET,
+    HUD_COLOR_CPU,
+    HUD_COLOR_GPU,
+    HUD_COLOR_FLIP,
+    HUD_COLOR_COUNT,
+};
+
+// RGBA, not premultiplied (drawn with the straight alpha shader)
+static const uint8_t hud_colors[HUD_COLOR_COUNT][4] = {
+    [HUD_COLOR_BACKGROUND] = {0, 0, 0, 176},
+    [HUD_COLOR_GRAPH] = {255, 255, 255, 32},
+    [HUD_COLOR_BUDGET] = {255, 64, 64, 255},
+    [HUD_COLOR_CPU] = {96, 224, 96, 255},
+    [HUD_COLOR_GPU] = {255, 168, 48, 255},
+    [HUD_COLOR_FLIP] = {64, 176, 255, 255},
+};
+
+static int create_hud_texture(struct ember_hud *hud) {
+    // RGBA like the GL cursor, sampled without a swizzle everywhere
+    uint8_t pixels[HUD_TEXTURE_H][HUD_TEXTURE_W][4];
+    memset(pixels, 0, sizeof(pixels));
+    for (size_t g = 0; g < sizeof(hud_font) / sizeof(hud_font[0]); g++) {
+        for (int y = 0; y < HUD_FONT_H; y++) {
+            for (int x = 0; x < HUD_FONT_W; x++) {
+                if (hud_font[g][y] & (4 >> x)) {
+                    memset(pixels[y][g * (HUD_FONT_W + 1) + x], 255, 4);
+                }
+            }
+        }
+    }
+    for (int c = 0; c < HUD_COLOR_COUNT; c++) {
+        memcpy(pixels[HUD_COLOR_ROW][c], hud_colors[c], 4);
+    }
+
+    glGenTextures(1, &hud->texture);
+    glBindTexture(GL_TEXTURE_2D, hud->texture);
+    // Scaled by whole factors and sampled at texel centres: no filtering
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, HUD_TEXTURE_W, HUD_TEXTURE_H, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    return hud->texture ? 0 : -1;
+}
+
+void init_hud(struct ember_server *server, const char *gl_extensions) {
+    struct ember_hud *hud = &server->hud;
+    if (has_extension(gl_extensions, "GL_EXT_disjoint_timer_query")) {
+        hud->gen_queries = (PFNGLGENQUERIESEXTPROC)eglGetProcAddress("glGenQueriesEXT");
+        hud->begin_query = (PFNGLBEGINQUERYEXTPROC)eglGetProcAddress("glBeginQueryEXT");
+        hud->end_query = (PFNGLENDQUERYEXTPROC)eglGetProcAddress("glEndQueryEXT");
+        hud->get_query_objectiv = (PFNGLGETQUERYOBJECTIVEXTPROC)eglGetProcAddress("glGetQueryObjectivEXT");
+        hud->get_query_objectui64v =
+            (PFNGLGETQUERYOBJECTUI64VEXTPROC)eglGetProcAddress("glGetQueryObjectui64vEXT");
+    }
+    if (!hud->gen_queries || !hud->begin_query || !hud->end_query ||
+        !hud->get_query_objectiv || !hud->get_query_objectui64v) {
+        hud->gen_queries = NULL;
+    }
+    printf("Performance HUD: Logo+F12, GPU timing %s\n", hud->gen_queries ? "available" : "unavailable");
+}
+
+static void damage_hud(struct ember_output *output) {
+    damage_output_box(output, output->x + HUD_MARGIN, output->y + HUD_MARGIN, HUD_WIDTH, HUD_HEIGHT);
+}
+
+void hud_toggle(struct ember_server *server) {
+    server->hud.enabled = !server->hud.enabled;
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        // Numbers start with the next frame, not from whenever it was last shown
+        output->hud.bytes_seen = server->stats.bytes_uploaded;
+        output->hud.last_flip_ns = 0;
+        damage_hud(output);
+    }
+}
+
+// Start a frame: called when its snapshot is taken, so the HUD box and
+// quads go into it
+void hud_frame_begin(struct ember_output *output, struct ember_frame_snapshot *frame) {
+    struct ember_server *server = output->server;
+    struct ember_output_hud *out = &output->hud;
+    frame->hud_slot = -1;
+    if (!server->hud.enabled) {
+        return;
+    }
+    if (!server->hud.texture && create_hud_texture(&server->hud) < 0) {
+        server->hud.enabled = 0;
+        return;
+    }
+    frame->hud_slot = out->frame_head;
+    out->cpu_ns[out->frame_head] = 0;
+    out->gpu_ns[out->frame_head] = 0;
+
+    // The numbers change with every frame. Damage the HUD directly: this
+    // frame is drawn anyway, going through damage_output_box would schedule
+    // another one and keep the output repainting.
+    pixman_region32_union_rect(&output->damage, &output->damage, HUD_MARGIN, HUD_MARGIN, HUD_WIDTH, HUD_HEIGHT);
+    pixman_region32_intersect_rect(&output->damage, &output->damage,
+                                   0, 0, output->mode.hdisplay, output->mode.vdisplay);
+}
+
+// Read back the GPU times of earlier frames that are done by now, into the
+// frame's result
+static void collect_gpu_times(struct ember_output *output, struct ember_frame_result *result) {
+    struct ember_hud *hud = &output->server->hud;
+    struct ember_output_hud *out = &output->hud;
+    uint64_t elapsed[EMBER_HUD_QUERIES] = {0};
+    int collected = 0;
+    for (int i = 0; i < EMBER_HUD_QUERIES; i++) {
+        if (!out->query_pending[i]) {
+            continue;
+        }
+        GLint available = 0;
+        hud->get_query_objectiv(out->queries[i], GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available) {
+            continue;
+        }
+        GLuint64 value = 0;
+        hud->get_query_objectui64v(out->queries[i], GL_QUERY_RESULT_EXT, &value);
+        elapsed[i] = value;
+        out->query_pending[i] = 0;
+        collected = 1;
+    }
+    if (!collected) {
+        return;
+    }
+
+    // A disjoint event (GPU clock change, reset) makes the results meaningless
+    GLint disjoint = 0;
+    glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+    if (disjoint) {
+        return;
+    }
+    for (int i = 0; i < EMBER_HUD_QUERIES; i++) {
+        if (elapsed[i]) {
+            result->gpu_slot[result->n_gpu_times] = out->query_frame[i];
+            result->gpu_ns[result->n_gpu_times] = elapsed[i];
+            result->n_gpu_times++;
+        }
+    }
+}
+
+// Start timing the frame on the GPU: called by the renderer with the
+// context current, before anything is drawn
+void hud_gpu_begin(struct ember_output *output, struct ember_frame_snapshot *frame) {
+    struct ember_server *server = output->server;
+    struct ember_output_hud *out = &output->hud;
+    out->query_active = 0;
+    if (frame->hud_slot < 0 || !server->hud.gen_queries) {
+        return;
+    }
+    if (!out->queries[0]) {
+        server->hud.gen_queries(EMBER_HUD_QUERIES, out->queries);
+    }
+    collect_gpu_times(output, &frame->result);
+    for (int i = 0; i < EMBER_HUD_QUERIES; i++) {
+        if (!out->query_pending[i]) {
+            // Only one GL_TIME_ELAPSED_EXT query runs at a time; outputs
+            // render one after the other, so that always holds
+            server->hud.begin_query(GL_TIME_ELAPSED_EXT, out->queries[i]);
+            out->query_frame[i] = frame->hud_slot;
+            out->query_active = i + 1;
+            break;
+        }
+    }
+    // All busy: the GPU is that far behind, this frame goes unmeasured
+}
+
+// The frame is submitted, called by the renderer before the swap
+void hud_gpu_end(struct ember_output *output) {
+    struct ember_output_hud *out = &output->hud;
+    if (out->query_active) {
+        output->server->hud.end_query(GL_TIME_ELAPSED_EXT);
+        out->query_pending[out->query_active - 1] = 1;
+        out->query_active = 0;
+    }
+}
+
+// The frame is drawn, record what the renderer measured
+void hud_frame_rendered(struct ember_output *output, struct ember_frame_snapshot *frame) {
+    struct ember_server *server = output->server;
+    struct ember_output_hud *out = &output->hud;
+    struct ember_frame_result *result = &frame->result;
+    for (int i = 0; i < result->n_gpu_times; i++) {
+        out->gpu_ns[result->gpu_slot[i]] = result->gpu_ns[i];
+    }
+    if (frame->hud_slot < 0 || !server->hud.enabled) {
+        return;
+    }
+    out->cpu_ns[frame->hud_slot] = result->cpu_ns;
+    out->frame_head = (frame->hud_slot + 1) % EMBER_HUD_HISTORY;
+
+    out->surfaces_drawn = result->surfaces_drawn;
+    out->bytes_uploaded = server->stats.bytes_uploaded - out->bytes_seen;
+    out->bytes_seen = server->stats.bytes_uploaded;
+}
+
+// A frame reached the screen at vblank_ns, missed vblanks after the one it
+// was aiming for
+void hud_frame_presented(struct ember_output *output, uint64_t vblank_ns, uint64_t missed) {
+    struct ember_output_hud *out = &output->hud;
+    if (!output->server->hud.enabled) {
+        return;
+    }
+    if (out->last_flip_ns && vblank_ns > out->last_flip_ns) {
+        out->flip_ns[out->flip_head] = vblank_ns - out->last_flip_ns;
+        out->flip_head = (out->flip_head + 1) % EMBER_HUD_HISTORY;
+    }
+    out->last_flip_ns = vblank_ns;
+    out->missed_vblanks += missed;
+}
+
+// --- Drawing ---
+
+static void color_texcoords(enum hud_color color, float st[8]) {
+    float s = (color + 0.5f) / HUD_TEXTURE_W;
+    float t = (HUD_COLOR_ROW + 0.5f) / HUD_TEXTURE_H;
+    for (int i = 0; i < 4; i++) {
+        st[i * 2] = s;
+        st[i * 2 + 1] = t;
+    }
+}
+
+static void add_rect(struct ember_server *server, struct ember_frame_snapshot *frame, enum hud_color color,
+                     float x, float y, float width, float height) {
+    if (width <= 0 || height <= 0) {
+        return;
+    }
+    float st[8];
+    color_texcoords(color, st);
+    snapshot_add_quad(frame, server->hud.texture, x, y, x + width, y + height, st);
+}
+
+static void add_text(struct ember_server *server, struct ember_frame_snapshot *frame, float x, float y,
+                     const char *text) {
+    for (; *text; text++, x += HUD_ADVANCE) {
+        const char *glyph = strchr(hud_glyphs, *text);
+        if (!glyph) {
+            continue; // Spaces, and anything the font lacks
+        }
+        int g = glyph - hud_glyphs;
+        float s0 = (float)(g * (HUD_FONT_W + 1)) / HUD_TEXTURE_W;
+        float s1 = (float)(g * (HUD_FONT_W + 1) + HUD_FONT_W) / HUD_TEXTURE_W;
+        float t1 = (float)HUD_FONT_H / HUD_TEXTURE_H;
+        const float st[8] = { s0, 0.0f, s0, t1, s1, t1, s1, 0.0f };
+        snapshot_add_quad(frame, server->hud.texture, x, y,
+                          x + HUD_FONT_W * HUD_SCALE, y + HUD_FONT_H * HUD_SCALE, st);
+    }
+}
+
+// One bar per sample, oldest on the left. Full height is two refresh
+// periods, so the budget line sits in the middle.
+static void add_graph(struct ember_output *output, struct ember_frame_snapshot *frame, float x, float y,
+                      const uint64_t *samples, int head, enum hud_color color) {
+    struct ember_server *server = output->server;
+    uint64_t range = output->repaint_refresh_ns * 2;
+    add_rect(server, frame, HUD_COLOR_GRAPH, x, y, HUD_GRAPH_W, HUD_GRAPH_H);
+    for (int i = 0; i < EMBER_HUD_HISTORY; i++) {
+        uint64_t value = samples[(head + i) % EMBER_HUD_HISTORY];
+        if (value > range) {
+            value = range;
+        }
+        float height = (float)value * HUD_GRAPH_H / range;
+        add_rect(server, frame, color, x + i * HUD_BAR_W, y + HUD_GRAPH_H - height, HUD_BAR_W, height);
+    }
+    add_rect(server, frame, HUD_COLOR_BUDGET, x, y + HUD_GRAPH_H / 2, HUD_GRAPH_W, 1);
+}
+
+static uint64_t last_sample(const uint64_t *samples, int head) {
+    return samples[(head + EMBER_HUD_HISTORY - 1) % EMBER_HUD_HISTORY];
+}
+
+// Newest GPU time that came back, they trail the frames by a few
+static uint64_t last_gpu_time(struct ember_output_hud *out) {
+    for (int i = 1; i <= EMBER_HUD_QUERIES + 1; i++) {
+        uint64_t value = out->gpu_ns[(out->frame_head + EMBER_HUD_HISTORY - i) % EMBER_HUD_HISTORY];
+        if (value) {
+            return value;
+        }
+    }
+    return 0;
+}
+
+// Add the quads of the HUD to the frame (output coordinates)
+void hud_add_quads(struct ember_output *output, struct ember_frame_snapshot *frame) {
+    struct ember_server *server = output->server;
+    struct ember_output_hud *out = &output->hud;
+    if (frame->hud_slot < 0) {
+        return;
+    }
+    float x = HUD_MARGIN, y = HUD_MARGIN;
+    add_rect(server, frame, HUD_COLOR_BACKGROUND, x, y, HUD_WIDTH, HUD_HEIGHT);
+    x += HUD_PAD;
+    y += HUD_PAD;
+
+    char lines[HUD_LINES][32];
+    uint64_t gpu = last_gpu_time(out);
+    snprintf(lines[0], sizeof(lines[0]), "CPU  %6.2f MS", last_sample(out->cpu_ns, out->frame_head) / 1e6);
+    if (gpu) {
+        snprintf(lines[1], sizeof(lines[1]), "GPU  %6.2f MS", gpu / 1e6);
+    } else {
+        snprintf(lines[1], sizeof(lines[1]), "GPU       - MS");
+    }
+    snprintf(lines[2], sizeof(lines[2]), "FLIP %6.2f MS", last_sample(out->flip_ns, out->flip_head) / 1e6);
+    snprintf(lines[3], sizeof(lines[3]), "MISS %6llu", (unsigned long long)out->missed_vblanks);
+    snprintf(lines[4], sizeof(lines[4]), "SURF %6llu", (unsigned long long)out->surfaces_drawn);
+    if (out->bytes_uploaded >= 1024 * 1024) {
+        snprintf(lines[5], sizeof(lines[5]), "UPL  %6.1f MB", out->bytes_uploaded / (1024.0 * 1024.0));
+    } else {
+        snprintf(lines[5], sizeof(lines[5]), "UPL  %6.1f KB", out->bytes_uploaded / 1024.0);
+    }
+
+    // The first three lines carry the colour of their graph
+    static const enum hud_color legend[HUD_GRAPHS] = { HUD_COLOR_CPU, HUD_COLOR_GPU, HUD_COLOR_FLIP };
+    for (int i = 0; i < HUD_LINES; i++) {
+        if (i < HUD_GRAPHS) {
+            add_rect(server, frame, legend[i], x, y, HUD_FONT_H * HUD_SCALE, HUD_FONT_H * HUD_SCALE);
+        }
+        add_text(server, frame, x + 2 * HUD_ADVANCE, y, lines[i]);
+        y += HUD_LINE;
+    }
+
+    add_graph(output, frame, x, y, out->cpu_ns, out->frame_head, HUD_COLOR_CPU);
+    y += HUD_GRAPH_H + HUD_PAD;
+    add_graph(output, frame, x, y, out->gpu_ns, out->frame_head, HUD_COLOR_GPU);
+    y += HUD_GRAPH_H + HUD_PAD;
+    add_graph(output, frame, x, y, out->flip_ns, out->flip_head, HUD_COLOR_FLIP);
+}
@@ -0,0 +1,660 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <drm_fourcc.h>
+#include <gbm.h>
+#include <pixman.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "input.h"
+#include "trace.h"
+#include "wayland/protocols.h"
+
+// KMS presentation.
+// Each output drives its own CRTC. With atomic modesetting every frame is one
+// commit describing all planes of that CRTC. Before compositing, client dmabufs are assigned to planes: a
+// fullscreen opaque surface goes straight onto the primary plane (no GL at
+// all), surfaces at the top of the stack go onto overlay planes. Every
+// candidate is checked with a TEST_ONLY commit, so the driver decides what
+// it can scan out. Drivers without atomic support use SetCrtc/PageFlip.
+//
+// Overlays are stacked by their zpos, never by plane order: each one gets a
+// zpos below the overlay of the surface above it, set explicitly where the
+// driver allows it. Planes without a zpos property are taken to stack in the
+// order the kernel lists them, the usual default.
+
+// --- Property lookup ---
+
+static uint32_t get_prop_id(int fd, drmModeObjectProperties *props, const char *name) {
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+        if (!prop) continue;
+        int match = strcmp(prop->name, name) == 0;
+        drmModeFreeProperty(prop);
+        if (match) {
+            return props->props[i];
+        }
+    }
+    return 0;
+}
+
+static uint64_t get_prop_value(int fd, drmModeObjectProperties *props, const char *name) {
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+        if (!prop) continue;
+        int match = strcmp(prop->name, name) == 0;
+        drmModeFreeProperty(prop);
+        if (match) {
+            return props->prop_values[i];
+        }
+    }
+    return 0;
+}
+
+// Read the zpos range of a plane, planes without the property get fallback
+static void get_zpos(int fd, drmModeObjectProperties *props, struct ember_plane *plane, uint64_t fallback) {
+    plane->zpos_min = plane->zpos_max = fallback;
+    for (uint32_t i = 0; i < props->count_props; i++) {
+        drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+        if (!prop) continue;
+        if (strcmp(prop->name, "zpos") == 0) {
+            if ((prop->flags & DRM_MODE_PROP_IMMUTABLE) || !(prop->flags & DRM_MODE_PROP_RANGE) ||
+                prop->count_values < 2) {
+                plane->zpos_min = plane->zpos_max = props->prop_values[i];
+            } else {
+                plane->props.zpos = props->props[i];
+                plane->zpos_min = prop->values[0];
+                plane->zpos_max = prop->values[1];
+            }
+        }
+        drmModeFreeProperty(prop);
+    }
+    plane->zpos = plane->zpos_min;
+}
+
+static int init_plane(struct ember_output *output, struct ember_plane *plane,
+                      drmModePlane *drm_plane, drmModeObjectProperties *props, uint32_t type,
+                      uint64_t index) {
+    int fd = output->server->drm_fd;
+    memset(plane, 0, sizeof(*plane));
+    plane->output = output;
+    plane->id = drm_plane->plane_id;
+    plane->type = type;
+    plane->props.fb_id = get_prop_id(fd, props, "FB_ID");
+    plane->props.crtc_id = get_prop_id(fd, props, "CRTC_ID");
+    plane->props.src_x = get_prop_id(fd, props, "SRC_X");
+    plane->props.src_y = get_prop_id(fd, props, "SRC_Y");
+    plane->props.src_w = get_prop_id(fd, props, "SRC_W");
+    plane->props.src_h = get_prop_id(fd, props, "SRC_H");
+    plane->props.crtc_x = get_prop_id(fd, props, "CRTC_X");
+    plane->props.crtc_y = get_prop_id(fd, props, "CRTC_Y");
+    plane->props.crtc_w = get_prop_id(fd, props, "CRTC_W");
+    plane->props.crtc_h = get_prop_id(fd, props, "CRTC_H");
+    if (!plane->props.fb_id || !plane->props.crtc_id || !plane->props.src_x || !plane->props.src_y ||
+        !plane->props.src_w || !plane->props.src_h || !plane->props.crtc_x || !plane->props.crtc_y ||
+        !plane->props.crtc_w || !plane->props.crtc_h) {
+        return -1;
+    }
+
+    plane->formats = malloc(drm_plane->count_formats * sizeof(uint32_t));
+    if (!plane->formats && drm_plane->count_formats) {
+        return -1;
+    }
+    memcpy(plane->formats, drm_plane->formats, drm_plane->count_formats * sizeof(uint32_t));
+    plane->n_formats = drm_plane->count_formats;
+    // Primaries are at the bottom
+    get_zpos(fd, props, plane, type == DRM_PLANE_TYPE_PRIMARY ? 0 : index + 1);
+    return 0;
+}
+
+// Whether another output already drives this plane
+static int plane_taken(struct ember_output *output, uint32_t plane_id) {
+    struct ember_output *other;
+    wl_list_for_each(other, &output->server->outputs, link) {
+        if (other == output) continue;
+        for (int i = 0; i < other->n_planes; i++) {
+            if (other->planes[i].id == plane_id) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+static int compare_zpos(const void *a, const void *b) {
+    const struct ember_plane *pa = a, *pb = b;
+    return pa->zpos_max < pb->zpos_max ? 1 : pa->zpos_max > pb->zpos_max ? -1 : 0;
+}
+
+// Primary plane goes to planes[0], overlays follow. Cursor planes are left
+// to the legacy cursor ioctls. Overlays that fit several CRTCs go to the
+// first output that asks for them.
+static void init_planes(struct ember_output *output) {
+    int fd = output->server->drm_fd;
+    drmModePlaneRes *res = drmModeGetPlaneResources(fd);
+    if (!res) {
+        return;
+    }
+
+    int have_primary = 0;
+    output->n_planes = 1;
+    for (uint32_t i = 0; i < res->count_planes; i++) {
+        drmModePlane *drm_plane = drmModeGetPlane(fd, res->planes[i]);
+        if (!drm_plane) continue;
+        if (!(drm_plane->possible_crtcs & (1u << output->crtc_index)) || plane_taken(output, drm_plane->plane_id)) {
+            drmModeFreePlane(drm_plane);
+            continue;
+        }
+
+        drmModeObjectProperties *props = drmModeObjectGetProperties(fd, drm_plane->plane_id, DRM_MODE_OBJECT_PLANE);
+        if (!props) {
+            drmModeFreePlane(drm_plane);
+            continue;
+        }
+        uint32_t type = get_prop_value(fd, props, "type");
+
+        if (type == DRM_PLANE_TYPE_PRIMARY) {
+            // Several primaries may fit, prefer the one already on our CRTC
+            if (!have_primary || drm_plane->crtc_id == output->crtc->crtc_id) {
+                struct ember_plane plane;
+                if (init_plane(output, &plane, drm_plane, props, type, i) == 0) {
+                    free(output->planes[0].formats);
+                    output->planes[0] = plane;
+                    have_primary = 1;
+                }
+            }
+        } else if (type == DRM_PLANE_TYPE_OVERLAY && output->n_planes < EMBER_MAX_PLANES) {
+            if (init_plane(output, &output->planes[output->n_planes], drm_plane, props, type, i) == 0) {
+                output->n_planes++;
+            }
+        }
+
+        drmModeFreeObjectProperties(props);
+        drmModeFreePlane(drm_plane);
+    }
+    drmModeFreePlaneResources(res);
+
+    if (!have_primary) {
+        for (int i = 1; i < output->n_planes; i++) {
+            free(output->planes[i].formats);
+        }
+        output->n_planes = 0;
+        return;
+    }
+    // Topmost overlays first, the order kms_assign_planes fills them in
+    qsort(&output->planes[1], output->n_planes - 1, sizeof(struct ember_plane), compare_zpos);
+}
+
+int init_kms(struct ember_output *output) {
+    int fd = output->server->drm_fd;
+    output->atomic = 0;
+    output->n_planes = 0;
+
+    if (getenv("EMBER_NO_ATOMIC")) {
+        printf("Atomic KMS disabled, using legacy modesetting\n");
+        return 0;
+    }
+    if (drmSetClientCap(fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) ||
+        drmSetClientCap(fd, DRM_CLIENT_CAP_ATOMIC, 1)) {
+        printf("Atomic KMS not supported, using legacy modesetting\n");
+        return 0;
+    }
+
+    drmModeObjectProperties *props = drmModeObjectGetProperties(fd, output->connector->connector_id, DRM_MODE_OBJECT_CONNECTOR);
+    if (props) {
+        output->connector_prop_crtc_id = get_prop_id(fd, props, "CRTC_ID");
+        drmModeFreeObjectProperties(props);
+    }
+    props = drmModeObjectGetProperties(fd, output->crtc->crtc_id, DRM_MODE_OBJECT_CRTC);
+    if (props) {
+        output->crtc_prop_mode_id = get_prop_id(fd, props, "MODE_ID");
+        output->crtc_prop_active = get_prop_id(fd, props, "ACTIVE");
+        drmModeFreeObjectProperties(props);
+    }
+    if (!output->connector_prop_crtc_id || !output->crtc_prop_mode_id || !output->crtc_prop_active) {
+        printf("Missing atomic KMS properties, using legacy modesetting\n");
+        return 0;
+    }
+
+    if (drmModeCreatePropertyBlob(fd, &output->mode, sizeof(output->mode), &output->mode_blob_id)) {
+        fprintf(stderr, "Failed to create mode blob: %m, using legacy modesetting\n");
+        return 0;
+    }
+
+    init_planes(output);
+    if (output->n_planes == 0) {
+        printf("No usable primary plane, using legacy modesetting\n");
+        return 0;
+    }
+
+    output->atomic = 1;
+    printf("Using atomic KMS on CRTC %u (%d overlay planes)\n", output->crtc->crtc_id, output->n_planes - 1);
+    return 0;
+}
+
+// --- Scanout framebuffers for client buffers ---
+
+static void fb_unref(struct ember_scanout_fb *fb) {
+    if (!fb) return;
+    if (--fb->refcount == 0) {
+        drmModeRmFB(fb->drm_fd, fb->fb_id);
+        gbm_bo_destroy(fb->bo);
+        free(fb);
+        return;
+    }
+    // Only the buffer itself still holds it: off screen, send the release we held back
+    if (fb->refcount == 1 && fb->buffer && fb->buffer->release_deferred) {
+        fb->buffer->release_deferred = 0;
+        wl_buffer_send_release(fb->buffer->resource);
+    }
+}
+
+// Import a client dmabuf as a KMS framebuffer, once per buffer
+static struct ember_scanout_fb *buffer_get_scanout_fb(struct ember_server *server, struct ember_dmabuf_buffer *buffer) {
+    if (buffer->scanout_fb || buffer->scanout_failed) {
+        return buffer->scanout_fb;
+    }
+    buffer->scanout_failed = 1;
+
+    const struct ember_dmabuf_attributes *attributes = &buffer->attributes;
+    struct gbm_import_fd_modifier_data data = {
+        .width = attributes->width,
+        .height = attributes->height,
+        .format = attributes->format,
+        .num_fds = attributes->n_planes,
+        .modifier = attributes->modifier,
+    };
+    for (int i = 0; i < attributes->n_planes; i++) {
+        data.fds[i] = attributes->fd[i];
+        data.strides[i] = attributes->stride[i];
+        data.offsets[i] = attributes->offset[i];
+    }
+    struct gbm_bo *bo = gbm_bo_import(server->gbm_device, GBM_BO_IMPORT_FD_MODIFIER, &data, GBM_BO_USE_SCANOUT);
+    if (!bo) {
+        return NULL;
+    }
+
+    uint32_t handles[4] = {0}, pitches[4] = {0}, offsets[4] = {0};
+    uint64_t modifiers[4] = {0};
+    for (int i = 0; i < attributes->n_planes; i++) {
+        handles[i] = gbm_bo_get_handle_for_plane(bo, i).u32;
+        pitches[i] = attributes->stride[i];
+        offsets[i] = attributes->offset[i];
+        modifiers[i] = attributes->modifier;
+    }
+
+    uint32_t fb_id = 0;
+    int ret;
+    if (attributes->modifier != DRM_FORMAT_MOD_INVALID) {
+        ret = drmModeAddFB2WithModifiers(server->drm_fd, attributes->width, attributes->height, attributes->format,
+                                         handles, pitches, offsets, modifiers, &fb_id, DRM_MODE_FB_MODIFIERS);
+    } else {
+        ret = drmModeAddFB2(server->drm_fd, attributes->width, attributes->height, attributes->format,
+                            handles, pitches, offsets, &fb_id, 0);
+    }
+    if (ret) {
+        gbm_bo_destroy(bo);
+        return NULL;
+    }
+
+    struct ember_scanout_fb *fb = calloc(1, sizeof(struct ember_scanout_fb));
+    if (!fb) {
+        drmModeRmFB(server->drm_fd, fb_id);
+        gbm_bo_destroy(bo);
+        return NULL;
+    }
+    fb->refcount = 1; // Owned by the buffer
+    fb->drm_fd = server->drm_fd;
+    fb->fb_id = fb_id;
+    fb->bo = bo;
+    fb->buffer = buffer;
+
+    buffer->scanout_fb = fb;
+    buffer->scanout_failed = 0;
+    return fb;
+}
+
+int kms_buffer_busy(struct ember_dmabuf_buffer *buffer) {
+    // One reference is the buffer's own, the rest are planes
+    return buffer->scanout_fb && buffer->scanout_fb->refcount > 1;
+}
+
+void kms_buffer_destroyed(struct ember_dmabuf_buffer *buffer) {
+    if (buffer->scanout_fb) {
+        // The framebuffer outlives the wl_buffer while it is on screen
+        buffer->scanout_fb->buffer = NULL;
+        fb_unref(buffer->scanout_fb);
+        buffer->scanout_fb = NULL;
+    }
+}
+
+void kms_surface_destroyed(struct ember_surface *surface) {
+    if (surface->plane) {
+        // Its framebuffer stays up until the next commit replaces it
+        surface->plane->surface = NULL;
+        surface->plane = NULL;
+    }
+}
+
+// --- Atomic commits ---
+
+static void plane_add_props(drmModeAtomicReq *req, struct ember_plane *plane, uint32_t crtc_id, uint32_t fb_id,
+                            uint32_t src_w, uint32_t src_h, int32_t x, int32_t y, uint32_t w, uint32_t h) {
+    drmModeAtomicAddProperty(req, plane->id, plane->props.fb_id, fb_id);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_id, crtc_id);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.src_x, 0);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.src_y, 0);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.src_w, (uint64_t)src_w << 16);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.src_h, (uint64_t)src_h << 16);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_x, (uint64_t)(int64_t)x);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_y, (uint64_t)(int64_t)y);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_w, w);
+    drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_h, h);
+    if (plane->props.zpos) {
+        drmModeAtomicAddProperty(req, plane->id, plane->props.zpos, plane->zpos);
+    }
+}
+
+// Commit the next_fb state of every plane, composite_fb fills the primary
+// plane when it is not scanning out a client buffer
+static int atomic_commit(struct ember_output *output, uint32_t composite_fb, uint32_t flags) {
+    drmModeAtomicReq *req = drmModeAtomicAlloc();
+    if (!req) {
+        return -1;
+    }
+
+    uint32_t crtc_id = output->crtc->crtc_id;
+    if (flags & DRM_MODE_ATOMIC_ALLOW_MODESET) {
+        drmModeAtomicAddProperty(req, output->connector->connector_id, output->connector_prop_crtc_id, crtc_id);
+        drmModeAtomicAddProperty(req, crtc_id, output->crtc_prop_mode_id, output->mode_blob_id);
+        drmModeAtomicAddProperty(req, crtc_id, output->crtc_prop_active, 1);
+    }
+
+    for (int i = 0; i < output->n_planes; i++) {
+        struct ember_plane *plane = &output->planes[i];
+        struct ember_surface *surface = plane->surface;
+        if (plane->next_fb && surface) {
+            plane_add_props(req, plane, crtc_id, plane->next_fb->fb_id,
+                            surface->buffer_width, surface->buffer_height,
+                            surface->pos_x - output->x, surface->pos_y - output->y,
+                            surface->width, surface->height);
+        } else if (plane->type == DRM_PLANE_TYPE_PRIMARY) {
+            plane_add_props(req, plane, crtc_id, composite_fb,
+                            output->mode.hdisplay, output->mode.vdisplay,
+                            0, 0, output->mode.hdisplay, output->mode.vdisplay);
+        } else {
+            drmModeAtomicAddProperty(req, plane->id, plane->props.fb_id, 0);
+            drmModeAtomicAddProperty(req, plane->id, plane->props.crtc_id, 0);
+        }
+    }
+
+    int ret = drmModeAtomicCommit(output->server->drm_fd, req, flags, output);
+    drmModeAtomicFree(req);
+    return ret;
+}
+
+// --- Plane assignment ---
+
+static int plane_supports_format(struct ember_plane *plane, uint32_t format) {
+    for (uint32_t i = 0; i < plane->n_formats; i++) {
+        if (plane->formats[i] == format) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int surface_is_opaque(struct ember_surface *surface) {
+    if (surface->buffer_opaque) {
+        return 1;
+    }
+    pixman_box32_t box = {0, 0, surface->width, surface->height};
+    return pixman_region32_contains_rectangle(&surface->current.opaque, &box) == PIXMAN_REGION_IN;
+}
+
+// Framebuffer for a surface that could be put on a plane as is
+static struct ember_scanout_fb *surface_scanout_fb(struct ember_output *output, struct ember_surface *surface) {
+    struct ember_dmabuf_buffer *buffer = dmabuf_buffer_from_resource(surface->current.buffer);
+    if (!buffer || surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+        return NULL;
+    }
+    // Planes are not clipped against the output
+    if (surface->pos_x < output->x || surface->pos_y < output->y ||
+        surface->pos_x + surface->width > output->x + output->mode.hdisplay ||
+        surface->pos_y + surface->height > output->y + output->mode.vdisplay) {
+        return NULL;
+    }
+    return buffer_get_scanout_fb(output->server, buffer);
+}
+
+// Pick the zpos of an overlay: below the overlay of the surface above
+// (below), above the primary plane. Returns 0 when its range has no room.
+static int overlay_zpos(struct ember_output *output, struct ember_plane *plane, uint64_t below) {
+    if (below == 0) {
+        return 0;
+    }
+    uint64_t zpos = plane->zpos_max < below ? plane->zpos_max : below - 1;
+    if (zpos < plane->zpos_min || zpos <= output->planes[0].zpos) {
+        return 0;
+    }
+    plane->zpos = zpos;
+    return 1;
+}
+
+static int plane_try_surface(struct ember_output *output, struct ember_plane *plane,
+                             struct ember_surface *surface, struct ember_scanout_fb *fb) {
+    if (!plane_supports_format(plane, fb->buffer->attributes.format)) {
+        return 0;
+    }
+    plane->surface = surface;
+    plane->next_fb = fb;
+    if (atomic_commit(output, swapchain_last_fb(&output->swapchain), DRM_MODE_ATOMIC_TEST_ONLY)) {
+        plane->surface = NULL;
+        plane->next_fb = NULL;
+        return 0;
+    }
+    fb->refcount++;
+    surface->plane = plane;
+    return 1;
+}
+
+static void damage_surface(struct ember_output *output, struct ember_surface *surface) {
+    damage_output_box(output, surface->pos_x, surface->pos_y, surface->width, surface->height);
+}
+
+static int surface_on_output_plane(struct ember_output *output, struct ember_surface *surface) {
+    return surface->plane && surface->plane->output == output;
+}
+
+// Decide which surfaces bypass composition for the next frame. Surfaces
+// moving between GL and a plane damage the output. Returns 1 when the planes
+// must be committed even if nothing needs compositing.
+int kms_assign_planes(struct ember_output *output) {
+    if (!output->atomic || !output->kms_modeset_done) {
+        return 0;
+    }
+
+    struct ember_surface *old_surfaces[EMBER_MAX_PLANES] = {0};
+    for (int i = 0; i < output->n_planes; i++) {
+        struct ember_plane *plane = &output->planes[i];
+        old_surfaces[i] = plane->surface;
+        // The surface may have moved onto another output's plane meanwhile
+        if (plane->surface && plane->surface->plane == plane) {
+            plane->surface->plane = NULL;
+        }
+        plane->surface = NULL;
+        fb_unref(plane->next_fb);
+        plane->next_fb = NULL;
+    }
+    int was_direct = output->direct_scanout;
+
+    // The GL cursor and the HUD have to be on top of everything, so nothing
+    // bypasses them
+    if ((!output->server->cursor.visible || output->hw_cursor) && !output->server->hud.enabled) {
+        int overlay = 1;
+        int top = 1;
+        uint64_t below = UINT64_MAX; // zpos of the overlay placed last
+        struct ember_render_list *list = scene_render_list(output->server);
+        for (int i = 0; i < list->count; i++) {
+            struct ember_surface *surface = list->surfaces[i];
+            if (!output_intersects_box(output, surface->pos_x, surface->pos_y, surface->width, surface->height)) continue;
+            // Scanned out by another output
+            if (surface->plane) break;
+            struct ember_scanout_fb *fb = surface_scanout_fb(output, surface);
+            if (!fb) break;
+
+            // Fullscreen and opaque: scan it out directly, skip GL entirely
+            if (top && surface->pos_x == output->x && surface->pos_y == output->y &&
+                surface->width == output->mode.hdisplay && surface->height == output->mode.vdisplay &&
+                surface->buffer_width == surface->width && surface->buffer_height == surface->height &&
+                surface_is_opaque(surface) &&
+                plane_try_surface(output, &output->planes[0], surface, fb)) {
+                break;
+            }
+            top = 0;
+
+            // Overlays sit above the composited primary plane, so a surface
+            // can only go there if everything above it did too
+            int placed = 0;
+            while (!placed && overlay < output->n_planes) {
+                struct ember_plane *plane = &output->planes[overlay++];
+                placed = overlay_zpos(output, plane, below) && plane_try_surface(output, plane, surface, fb);
+                if (placed) {
+                    below = plane->zpos;
+                }
+            }
+            if (!placed) break;
+        }
+    }
+    output->direct_scanout = output->planes[0].surface != NULL;
+
+    int changed = 0;
+    for (int i = 0; i < output->n_planes; i++) {
+        struct ember_plane *plane = &output->planes[i];
+        if (plane->next_fb != plane->current_fb) {
+            changed = 1;
+        }
+        // Left its plane: GL has to draw it again
+        if (old_surfaces[i] && !surface_on_output_plane(output, old_surfaces[i])) {
+            damage_surface(output, old_surfaces[i]);
+        }
+        // Newly on a plane: GL has to stop drawing it
+        if (plane->surface) {
+            int was_on_plane = 0;
+            for (int j = 0; j < output->n_planes; j++) {
+                was_on_plane |= old_surfaces[j] == plane->surface;
+            }
+            if (!was_on_plane) {
+                damage_surface(output, plane->surface);
+            }
+        }
+    }
+
+    // The last composited frame is stale after direct scanout
+    if (was_direct && !output->direct_scanout) {
+        damage_output_whole(output);
+    }
+    return changed;
+}
+
+// --- Presentation ---
+
+static int legacy_present(struct ember_output *output, uint32_t fb_id) {
+    if (!output->kms_modeset_done) {
+        printf("Performing first mode set (CRTC: %p, Conn: %p)\n", output->crtc, output->connector);
+        if (drmModeSetCrtc(output->server->drm_fd, output->crtc->crtc_id, fb_id, 0, 0,
+                           &output->connector->connector_id, 1, &output->mode) < 0) {
+            fprintf(stderr, "drmModeSetCrtc failed: %m\n");
+            return -1;
+        }
+        return 1;
+    }
+
+    if (drmModePageFlip(output->server->drm_fd, output->crtc->crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, output) < 0) {
+        fprintf(stderr, "drmModePageFlip failed: %m\n");
+        return -1;
+    }
+    return 0;
+}
+
+static int atomic_present(struct ember_output *output, uint32_t fb_id) {
+    int ret;
+    if (!output->kms_modeset_done) {
+        printf("Performing first atomic mode set (CRTC: %u, Conn: %u)\n",
+               output->crtc->crtc_id, output->connector->connector_id);
+        if (atomic_commit(output, fb_id, DRM_MODE_ATOMIC_ALLOW_MODESET)) {
+            fprintf(stderr, "Atomic modeset failed: %m, falling back to legacy modesetting\n");
+            output->atomic = 0;
+            return legacy_present(output, fb_id);
+        }
+        ret = 1;
+    } else {
+        if (atomic_commit(output, fb_id, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT)) {
+            fprintf(stderr, "Atomic commit failed: %m\n");
+            return -1;
+        }
+        ret = 0;
+    }
+
+    // The references move from the assignment to the commit
+    for (int i = 0; i < output->n_planes; i++) {
+        output->planes[i].pending_fb = output->planes[i].next_fb;
+        output->planes[i].next_fb = NULL;
+    }
+    return ret;
+}
+
+// Put the next frame on screen. composited says whether GL drew a new frame
+// into the gbm surface; otherwise the primary plane keeps the last one (or
+// shows a client buffer). Returns 0 when a flip event will follow, 1 when
+// the frame was presented synchronously (initial modeset), -1 on error.
+int kms_present(struct ember_output *output, int composited) {
+    struct ember_swapchain *swapchain = &output->swapchain;
+    uint32_t fb_id = swapchain_last_fb(swapchain);
+    if (composited) {
+        // A frame drawn ahead is locked already
+        if (!swapchain->rendering && !swapchain_lock(swapchain)) {
+            return -1;
+        }
+        fb_id = swapchain->rendering->fb_id;
+    }
+
+    trace_begin("kms", "flip_submit");
+    int ret = output->atomic ? atomic_present(output, fb_id) : legacy_present(output, fb_id);
+    trace_end("kms", "flip_submit");
+    if (ret < 0) {
+        if (composited) {
+            swapchain_discard(swapchain);
+        }
+        return -1;
+    }
+    if (composited) {
+        swapchain_queue(swapchain);
+    }
+    output->kms_commit_pending = 1;
+
+    if (!output->kms_modeset_done) {
+        output->kms_modeset_done = 1;
+        // The CRTC is live now, move the cursor onto its own plane
+        init_hw_cursor(output);
+    }
+    return ret;
+}
+
+// The last commit reached the screen
+void kms_frame_done(struct ember_output *output) {
+    if (!output->kms_commit_pending) {
+        return;
+    }
+    output->kms_commit_pending = 0;
+    swapchain_flip_done(&output->swapchain);
+    for (int i = 0; i < output->n_planes; i++) {
+        struct ember_plane *plane = &output->planes[i];
+        fb_unref(plane->current_fb);
+        plane->current_fb = plane->pending_fb;
+        plane->pending_fb = NULL;
+    }
+}
@@ -10,19 +10,42 @@
 #include "backend.h"
 #include "renderer.h"
 
+// Outputs.
+// Every connected connector gets its own struct ember_output with a CRTC,
+// gbm/EGL surface, swapchain, repaint loop and wl_output global. Outputs are
+// laid out left to right in connector order, top edges aligned.
+
 // --- wl_output implementation ---
 
+static void output_release(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_output_interface output_interface = {
+    .release = output_release,
+};
+
+static void output_resource_destroy(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
+
 static void output_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
-    struct ember_server *server = data;
+    struct ember_output *output = data;
     struct wl_resource *resource = wl_resource_create(client, &wl_output_interface, version, id);
-    wl_list_insert(&server->output_resources, wl_resource_get_link(resource));
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &output_interface, output, output_resource_destroy);
+    wl_list_insert(&output->resources, wl_resource_get_link(resource));
 
     // Send geometry
-    wl_output_send_geometry(resource, 0, 0, 
-                            server->connector->mmWidth, 
-                            server->connector->mmHeight, 
-                            WL_OUTPUT_SUBPIXEL_UNKNOWN, 
-                            "Generic", "Monitor", 
+    wl_output_send_geometry(resource, output->x, output->y,
+                            output->connector->mmWidth,
+                            output->connector->mmHeight,
+                            WL_OUTPUT_SUBPIXEL_UNKNOWN,
+                            "Generic", "Monitor",
                             WL_OUTPUT_TRANSFORM_NORMAL);
 
     // Send scale
@@ -31,104 +54,233 @@ static void output_bind(struct wl_client *client, void *data, uint32_t version,
     }
 
     // Send mode (current | preferred)
-    wl_output_send_mode(resource, 
+    wl_output_send_mode(resource,
                         WL_OUTPUT_MODE_CURRENT | WL_OUTPUT_MODE_PREFERRED,
-                        server->mode.hdisplay, 
-                        server->mode.vdisplay, 
-                        server->mode.vrefresh * 1000);
+                        output->mode.hdisplay,
+                        output->mode.vdisplay,
+                        output->mode.vrefresh * 1000);
 
     // Done
     if (version >= 2) {
         wl_output_send_done(resource);
     }
-    
-    printf("Client bound to wl_output\n");
+
+    printf("Client bound to wl_output (CRTC %u)\n", output->crtc->crtc_id);
 }
 
-int init_output(struct ember_server *server) {
-    // 1. Get connector
-    drmModeRes *res = drmModeGetResources(server->drm_fd);
-    if (!res) {
-        fprintf(stderr, "Failed to get DRM resources\n");
-        return -1;
+// Whether a box in layout coordinates shows up on the output
+int output_intersects_box(struct ember_output *output, int32_t x, int32_t y, int32_t width, int32_t height) {
+    return width > 0 && height > 0 &&
+           x < output->x + output->mode.hdisplay && x + width > output->x &&
+           y < output->y + output->mode.vdisplay && y + height > output->y;
+}
+
+// Output showing a point in layout coordinates, NULL between outputs
+struct ember_output *output_at(struct ember_server *server, double x, double y) {
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (x >= output->x && x < output->x + output->mode.hdisplay &&
+            y >= output->y && y < output->y + output->mode.vdisplay) {
+            return output;
+        }
     }
+    return NULL;
+}
 
-    for (int i = 0; i < res->count_connectors; i++) {
-        drmModeConnector *conn = drmModeGetConnector(server->drm_fd, res->connectors[i]);
-        if (conn->connection == DRM_MODE_CONNECTED && conn->count_modes > 0) {
-            server->connector = conn;
-            server->mode = conn->modes[0]; // Pick first mode
-            break;
+// --- Setup ---
+
+static int crtc_in_use(struct ember_server *server, uint32_t crtc_id) {
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (output->crtc->crtc_id == crtc_id) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Find a free CRTC for the connector, returns its index in res or -1
+static int pick_crtc(struct ember_server *server, drmModeRes *res, drmModeConnector *conn) {
+    // Keep the CRTC that already drives the connector
+    drmModeEncoder *enc = conn->encoder_id ? drmModeGetEncoder(server->drm_fd, conn->encoder_id) : NULL;
+    if (enc) {
+        uint32_t crtc_id = enc->crtc_id;
+        drmModeFreeEncoder(enc);
+        for (int i = 0; crtc_id && i < res->count_crtcs; i++) {
+            if (res->crtcs[i] == crtc_id && !crtc_in_use(server, crtc_id)) {
+                return i;
+            }
         }
+    }
+
+    // Otherwise any free CRTC one of its encoders can drive
+    for (int e = 0; e < conn->count_encoders; e++) {
+        enc = drmModeGetEncoder(server->drm_fd, conn->encoders[e]);
+        if (!enc) continue;
+        uint32_t possible = enc->possible_crtcs;
+        drmModeFreeEncoder(enc);
+        for (int i = 0; i < res->count_crtcs; i++) {
+            if ((possible & (1u << i)) && !crtc_in_use(server, res->crtcs[i])) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+// The mode the monitor asks for, or the first one listed
+static drmModeModeInfo pick_mode(drmModeConnector *conn) {
+    for (int i = 0; i < conn->count_modes; i++) {
+        if (conn->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+            return conn->modes[i];
+        }
+    }
+    return conn->modes[0];
+}
+
+static void destroy_output(struct ember_output *output) {
+    struct ember_server *server = output->server;
+    if (output->egl_surface != EGL_NO_SURFACE) {
+        eglMakeCurrent(server->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroySurface(server->egl_display, output->egl_surface);
+    }
+    if (output->gbm_surface) {
+        gbm_surface_destroy(output->gbm_surface);
+    }
+    if (output->repaint_timer) {
+        wl_event_source_remove(output->repaint_timer);
+    }
+    if (output->crtc) {
+        drmModeFreeCrtc(output->crtc);
+    }
+    drmModeFreeConnector(output->connector);
+    free(output);
+}
+
+// Set up an output for a connected connector, takes ownership of conn
+static int create_output(struct ember_server *server, drmModeRes *res, drmModeConnector *conn) {
+    int crtc_index = pick_crtc(server, res, conn);
+    if (crtc_index < 0) {
+        fprintf(stderr, "No free CRTC for connector %u, ignoring it\n", conn->connector_id);
         drmModeFreeConnector(conn);
+        return -1;
     }
-    
-    if (!server->connector) {
-        fprintf(stderr, "No connected monitor found\n");
+
+    struct ember_output *output = calloc(1, sizeof(struct ember_output));
+    if (!output) {
+        drmModeFreeConnector(conn);
         return -1;
     }
+    output->server = server;
+    output->connector = conn;
+    output->mode = pick_mode(conn);
+    output->egl_surface = EGL_NO_SURFACE;
+    output->crtc_index = crtc_index;
+    output->crtc = drmModeGetCrtc(server->drm_fd, res->crtcs[crtc_index]);
+    if (!output->crtc) {
+        fprintf(stderr, "Failed to get CRTC %u\n", res->crtcs[crtc_index]);
+        destroy_output(output);
+        return -1;
+    }
+    output->x = server->layout_width;
+    output->y = 0;
 
-    printf("Selected Mode: %dx%d @ %dHz\n", server->mode.hdisplay, server->mode.vdisplay, server->mode.vrefresh);
+    printf("Output on connector %u: %dx%d @ %dHz, CRTC %u, at %d,%d\n",
+           conn->connector_id, output->mode.hdisplay, output->mode.vdisplay, output->mode.vrefresh,
+           output->crtc->crtc_id, output->x, output->y);
+    if (init_repaint(output) < 0) {
+        destroy_output(output);
+        return -1;
+    }
 
-    // 2. Create GBM Surface (the backbuffer)
-    server->gbm_surface = gbm_surface_create(server->gbm_device, 
-                                             server->mode.hdisplay, 
-                                             server->mode.vdisplay, 
-                                             GBM_FORMAT_XRGB8888, 
+    // 1. Create GBM Surface (the backbuffer)
+    output->gbm_surface = gbm_surface_create(server->gbm_device,
+                                             output->mode.hdisplay,
+                                             output->mode.vdisplay,
+                                             GBM_FORMAT_XRGB8888,
                                              GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING);
-    if (!server->gbm_surface) {
+    if (!output->gbm_surface) {
         fprintf(stderr, "Failed to create GBM surface\n");
+        destroy_output(output);
         return -1;
     }
+    swapchain_init(&output->swapchain, server->drm_fd, output->gbm_surface);
 
-    // 3. Create EGL Surface
-    server->egl_surface = eglCreateWindowSurface(server->egl_display, server->egl_config, (EGLNativeWindowType)server->gbm_surface, NULL);
-    if (server->egl_surface == EGL_NO_SURFACE) {
+    // 2. Create EGL Surface
+    output->egl_surface = eglCreateWindowSurface(server->egl_display, server->egl_config, (EGLNativeWindowType)output->gbm_surface, NULL);
+    if (output->egl_surface == EGL_NO_SURFACE) {
         fprintf(stderr, "Failed to create EGL surface\n");
+        destroy_output(output);
         return -1;
     }
 
-    // 4. Make EGL Context Current (REQUIRED before any GL calls)
-    if (!eglMakeCurrent(server->egl_display, server->egl_surface, server->egl_surface, server->egl_context)) {
+    // 3. Make EGL Context Current (REQUIRED before any GL calls)
+    if (!eglMakeCurrent(server->egl_display, output->egl_surface, output->egl_surface, server->egl_context)) {
         fprintf(stderr, "Failed to make EGL context current\n");
+        destroy_output(output);
         return -1;
     }
-    printf("EGL context made current\n");
 
-    // 5. Initialize Renderer (Shaders)
-    if (init_renderer(server) < 0) {
+    // 4. Initialize Renderer (Shaders), shared by all outputs
+    if (wl_list_empty(&server->outputs) && init_renderer(server) < 0) {
+        destroy_output(output);
         return -1;
     }
 
-    // 5. Find CRTC
-    drmModeEncoder *enc = drmModeGetEncoder(server->drm_fd, server->connector->encoder_id);
-    if (enc) {
-        server->crtc = drmModeGetCrtc(server->drm_fd, enc->crtc_id);
-        drmModeFreeEncoder(enc);
+    if (init_kms(output) < 0) {
+        destroy_output(output);
+        return -1;
+    }
+
+    // 5. Setup Wayland Global
+    wl_list_init(&output->resources);
+    output->global = wl_global_create(server->wl_display, &wl_output_interface, 3, output, output_bind);
+    if (!output->global) {
+        fprintf(stderr, "Failed to create wl_output global\n");
+        destroy_output(output);
+        return -1;
     }
-    
-    // Fallback if no encoder/crtc attached
-    if (!server->crtc) {
-        // Just pick the first one
-        // Note: Real compositor needs better logic
-         server->crtc = drmModeGetCrtc(server->drm_fd, res->crtcs[0]);
+
+    wl_list_insert(server->outputs.prev, &output->link);
+    server->layout_width += output->mode.hdisplay;
+    if (output->mode.vdisplay > server->layout_height) {
+        server->layout_height = output->mode.vdisplay;
     }
 
-    if (!server->crtc) {
-        fprintf(stderr, "Failed to find any CRTC!\n");
+    // Nothing has been drawn yet, this also schedules the first frame
+    init_damage(output);
+    return 0;
+}
+
+int init_output(struct ember_server *server) {
+    wl_list_init(&server->outputs);
+    server->layout_width = 0;
+    server->layout_height = 0;
+
+    drmModeRes *res = drmModeGetResources(server->drm_fd);
+    if (!res) {
+        fprintf(stderr, "Failed to get DRM resources\n");
         return -1;
     }
 
-    printf("Initialized Output (CRTC ID: %d)\n", server->crtc->crtc_id);
-    
-    // 6. Setup Wayland Global
-    wl_list_init(&server->output_resources);
-    server->output_global = wl_global_create(server->wl_display, &wl_output_interface, 3, server, output_bind);
-    if (!server->output_global) {
-        fprintf(stderr, "Failed to create wl_output global\n");
+    for (int i = 0; i < res->count_connectors; i++) {
+        drmModeConnector *conn = drmModeGetConnector(server->drm_fd, res->connectors[i]);
+        if (!conn) continue;
+        if (conn->connection != DRM_MODE_CONNECTED || conn->count_modes == 0) {
+            drmModeFreeConnector(conn);
+            continue;
+        }
+        // A monitor we cannot drive does not stop the others
+        create_output(server, res, conn);
+    }
+    drmModeFreeResources(res);
+
+    if (wl_list_empty(&server->outputs)) {
+        fprintf(stderr, "No connected monitor found\n");
         return -1;
     }
-    
-    printf("Initialized Wayland Globals (Output)\n");
+
+    printf("Initialized %d output(s), layout %dx%d\n",
+           wl_list_length(&server->outputs), server->layout_width, server->layout_height);
     return 0;
 }
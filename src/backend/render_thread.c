@@ -0,0 +1,247 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <GLES2/gl2.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "renderer.h"
+#include "trace.h"
+
+// Render thread (EMBER_RENDER_THREAD).
+// Frames are drawn on a thread of their own, so client requests keep being
+// handled while the GPU driver is busy in draw calls and eglSwapBuffers.
+// The protocol thread takes a snapshot of what the frame shows
+// (snapshot_take) and publishes it to the thread through an atomic
+// pointer; the thread draws it with its own context, shared with the main
+// one, and hands it back the same way. Each output has two snapshots and
+// at most one frame on the thread, so the one being filled is never the
+// one being drawn.
+//
+// Textures are still uploaded on the protocol thread. A fence after the
+// uploads goes along with the snapshot, the thread waits for it before
+// drawing. A commit never changes a texture or atlas slot that a frame on
+// the thread still names: the renderer writes the new contents to fresh
+// storage and retires the old one until that frame comes back.
+//
+// KMS (plane assignment, commits, page flips) stays on the protocol thread
+// too: it looks at client buffers and surfaces, and only the finished
+// buffer has to cross over (repaint_frame_rendered).
+
+struct ember_render_thread {
+    struct ember_server *server;
+    pthread_t thread;
+    EGLContext context;
+    int work_fd; // eventfd: a snapshot was published, read by the thread
+    int done_fd; // eventfd: a frame is drawn, read by the main loop
+    int quit_fd; // eventfd: stop the thread
+    struct wl_event_source *done_source;
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void signal_fd(int fd, const char *what) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to wake the %s: %m\n", what);
+    }
+}
+
+static void clear_fd(int fd) {
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to read render thread wakeup: %m\n");
+    }
+}
+
+// Draw every published snapshot
+static void draw_published(struct ember_render_thread *t) {
+    struct ember_output *output;
+    wl_list_for_each(output, &t->server->outputs, link) {
+        struct ember_frame_snapshot *frame = atomic_exchange(&output->render_published, NULL);
+        if (!frame) {
+            continue;
+        }
+        renderer_draw_snapshot(output, frame, t->context);
+        atomic_store(&output->render_done, frame);
+        signal_fd(t->done_fd, "main loop");
+    }
+}
+
+static void *render_thread_main(void *data) {
+    struct ember_render_thread *t = data;
+    trace_thread_name("render");
+
+    struct pollfd fds[2] = {
+        { .fd = t->work_fd, .events = POLLIN },
+        { .fd = t->quit_fd, .events = POLLIN },
+    };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Render thread poll failed: %m\n");
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        // Clear the wakeup before drawing, a publish after this wakes us again
+        clear_fd(t->work_fd);
+        draw_published(t);
+    }
+    eglMakeCurrent(t->server->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    return NULL;
+}
+
+// Called by the Wayland event loop when the thread handed frames back
+static int on_frames_rendered(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    struct ember_server *server = data;
+    clear_fd(fd);
+
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        struct ember_frame_snapshot *frame = atomic_exchange(&output->render_done, NULL);
+        if (!frame) {
+            continue;
+        }
+        output->render_seq = 0;
+        snapshot_finish(output, frame);
+        repaint_frame_rendered(output, frame->result.ret);
+    }
+    // Whatever only these frames still named can go
+    renderer_release_textures(server);
+    return 1;
+}
+
+// Hand the output's next frame to the render thread. Its repaint state is
+// EMBER_REPAINT_RENDERING until repaint_frame_rendered.
+void render_thread_submit(struct ember_output *output) {
+    struct ember_server *server = output->server;
+    struct ember_render_thread *t = server->render_thread;
+    struct ember_frame_snapshot *frame = snapshot_take(output);
+
+    // Uploads so far have to land before the thread samples the textures
+    frame->fence = server->egl_create_sync(server->egl_display, EGL_SYNC_FENCE_KHR, NULL);
+    glFlush();
+
+    output->render_start_ns = monotonic_ns();
+    output->render_seq = frame->seq;
+    atomic_store(&output->render_published, frame);
+    signal_fd(t->work_fd, "render thread");
+}
+
+static void destroy_render_thread(struct ember_render_thread *t) {
+    if (t->done_source) wl_event_source_remove(t->done_source);
+    if (t->work_fd >= 0) close(t->work_fd);
+    if (t->done_fd >= 0) close(t->done_fd);
+    if (t->quit_fd >= 0) close(t->quit_fd);
+    if (t->context != EGL_NO_CONTEXT) eglDestroyContext(t->server->egl_display, t->context);
+    free(t);
+}
+
+// Start drawing frames on the render thread when EMBER_RENDER_THREAD is
+// set. Needs the outputs and the renderer set up. Without the EGL
+// extensions it takes, frames are drawn on the main thread as before.
+int init_render_thread(struct ember_server *server) {
+    if (!getenv("EMBER_RENDER_THREAD")) {
+        return 0;
+    }
+    if (!server->egl_create_sync || !server->egl_has_surfaceless_context) {
+        fprintf(stderr, "Render thread needs EGL_KHR_fence_sync and EGL_KHR_surfaceless_context, "
+                        "rendering on the main thread\n");
+        return 0;
+    }
+
+    struct ember_render_thread *t = calloc(1, sizeof(struct ember_render_thread));
+    if (!t) {
+        return -1;
+    }
+    t->server = server;
+    t->work_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    t->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    t->quit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (t->work_fd < 0 || t->done_fd < 0 || t->quit_fd < 0) {
+        fprintf(stderr, "Failed to create render thread eventfds: %m\n");
+        destroy_render_thread(t);
+        return -1;
+    }
+    t->done_source = wl_event_loop_add_fd(server->wl_event_loop, t->done_fd, WL_EVENT_READABLE,
+                                          on_frames_rendered, server);
+    if (!t->done_source) {
+        destroy_render_thread(t);
+        return -1;
+    }
+
+    // Shares textures, buffers and the shader program with the main context
+    static const EGLint context_attribs[] = { EGL_CONTEXT_CLIENT_VERSION, 2, EGL_NONE };
+    t->context = eglCreateContext(server->egl_display, server->egl_config, server->egl_context, context_attribs);
+    if (t->context == EGL_NO_CONTEXT) {
+        fprintf(stderr, "Failed to create the render thread context\n");
+        destroy_render_thread(t);
+        return -1;
+    }
+    // Uploads need a context but no surface; the output surfaces are the thread's now
+    if (!eglMakeCurrent(server->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, server->egl_context)) {
+        fprintf(stderr, "Failed to make the EGL context current without a surface\n");
+        destroy_render_thread(t);
+        return -1;
+    }
+
+    // Set before the thread runs: textures are no longer deleted right away
+    server->render_thread = t;
+    int ret = pthread_create(&t->thread, NULL, render_thread_main, t);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to start the render thread: %d\n", ret);
+        server->render_thread = NULL;
+        destroy_render_thread(t);
+        return -1;
+    }
+
+    printf("Rendering on its own thread\n");
+    return 0;
+}
+
+// Oldest snapshot the render thread may still sample from (main thread),
+// UINT64_MAX when it has none. Each output has at most one frame there.
+uint64_t render_thread_oldest_frame(struct ember_server *server) {
+    uint64_t oldest = UINT64_MAX;
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (output->render_seq && output->render_seq < oldest) {
+            oldest = output->render_seq;
+        }
+    }
+    return oldest;
+}
+
+// Stop the render thread, if any. A frame it was drawing is finished first.
+void render_thread_finish(struct ember_server *server) {
+    struct ember_render_thread *t = server->render_thread;
+    if (!t) {
+        return;
+    }
+    signal_fd(t->quit_fd, "render thread");
+    pthread_join(t->thread, NULL);
+    server->render_thread = NULL;
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        output->render_seq = 0;
+    }
+    renderer_release_textures(server);
+    destroy_render_thread(t);
+}
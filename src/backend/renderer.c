@@ -1,34 +1,115 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include <gbm.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
+#include <drm_fourcc.h>
 #include <wayland-server.h>
 #include "ember.h"
 #include "renderer.h"
 #include "backend.h"
 #include "input.h"
+#include "trace.h"
 
-// Simple Shaders
+// Quads are batched: every frame the vertices of all visible surfaces, the
+// HUD and the GL cursor (from the frame's snapshot, snapshot.c) are written
+// to one VBO, then each run of quads sharing a texture is drawn with one
+// call. Small SHM surfaces share an atlas texture (atlas.c), so a desktop
+// full of popups needs a handful of draws.
+//
+// Quads are clipped to what is actually visible: anything under the opaque
+// region of a surface above is left out, and opaque parts are drawn with
+// blending off. Clipping to the repaint region as well means each frame is
+// one pass over the batches, without scissoring.
+//
+// The fragment shader comes in variants, one per buffer format and blend
+// need (EMBER_SHADER_*), all compiled at init: a batch only switches program
+// when its variant differs from the one before.
+
+// Quads per glDrawElements, limited by 16-bit indices
+#define EMBER_RENDER_MAX_QUADS 16384
+// Beyond this many damage rectangles, redraw their bounding box instead
+// (each rectangle cuts every quad crossing it into pieces)
+#define EMBER_RENDER_MAX_BOXES 8
+
+// Vertex positions are in output pixels, transform maps them to clip space
 static const char *vert_shader_text =
-    "attribute vec3 position;\n"
+    "uniform vec4 transform;\n"
+    "attribute vec2 position;\n"
     "attribute vec2 texcoord;\n"
     "varying vec2 v_texcoord;\n"
     "void main() {\n"
-    "    gl_Position = vec4(position, 1.0);\n"
+    "    gl_Position = vec4(position * transform.xy + transform.zw, 0.0, 1.0);\n"
     "    v_texcoord = texcoord;\n"
     "}\n";
 
-static const char *frag_shader_text =
+// Fragment shaders are put together per variant (EMBER_SHADER_* bits):
+// only what the texture needs, so opaque XRGB is a plain texture fetch
+static const char *frag_external_text =
+    "#extension GL_OES_EGL_image_external : require\n";
+static const char *frag_head_text =
     "precision mediump float;\n"
-    "varying vec2 v_texcoord;\n"
-    "uniform sampler2D tex;\n"
+    "varying vec2 v_texcoord;\n";
+static const char *frag_main_text =
     "void main() {\n"
-    "    gl_FragColor = texture2D(tex, v_texcoord);\n"
+    "    gl_FragColor = texture2D(tex, v_texcoord)%s;\n"
+    "%s"
     "}\n";
 
+// SHM formats the variants can sample, with how they are uploaded. Byte
+// order in memory is little endian, ARGB8888 is B, G, R, A.
+struct shm_format {
+    uint32_t format;
+    GLenum gl_format, gl_type;
+    int bpp;
+    int opaque;
+};
+
+static const struct shm_format shm_formats[] = {
+    { WL_SHM_FORMAT_ARGB8888, GL_BGRA_EXT, GL_UNSIGNED_BYTE, 4, 0 },
+    { WL_SHM_FORMAT_XRGB8888, GL_BGRA_EXT, GL_UNSIGNED_BYTE, 4, 1 },
+    { WL_SHM_FORMAT_ABGR8888, GL_RGBA, GL_UNSIGNED_BYTE, 4, 0 },
+    { WL_SHM_FORMAT_XBGR8888, GL_RGBA, GL_UNSIGNED_BYTE, 4, 1 },
+    { WL_SHM_FORMAT_RGB565, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, 2, 1 },
+};
+
+static const struct shm_format *get_shm_format(uint32_t format) {
+    for (size_t i = 0; i < sizeof(shm_formats) / sizeof(shm_formats[0]); i++) {
+        if (shm_formats[i].format == format) {
+            return &shm_formats[i];
+        }
+    }
+    return NULL;
+}
+
+// Collect the wl_shm formats the renderer can sample, for init_shm.
+// Returns the number of formats added.
+int renderer_get_shm_formats(struct ember_server *server, struct wl_array *formats) {
+    (void)server;
+    int count = 0;
+    for (size_t i = 0; i < sizeof(shm_formats) / sizeof(shm_formats[0]); i++) {
+        uint32_t *format = wl_array_add(formats, sizeof(*format));
+        if (format) {
+            *format = shm_formats[i].format;
+            count++;
+        }
+    }
+    return count;
+}
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
 static GLuint create_shader(struct ember_server *server, const char *source, GLenum type) {
     (void)server;
     GLuint shader = glCreateShader(type);
@@ -41,171 +122,810 @@ static GLuint create_shader(struct ember_server *server, const char *source, GLe
         char log[1024];
         glGetShaderInfoLog(shader, sizeof(log), NULL, log);
         fprintf(stderr, "Shader compilation failed: %s\n", log);
+        glDeleteShader(shader);
         return 0;
     }
     return shader;
 }
 
-int init_renderer(struct ember_server *server) {
-    GLuint vert = create_shader(server, vert_shader_text, GL_VERTEX_SHADER);
-    GLuint frag = create_shader(server, frag_shader_text, GL_FRAGMENT_SHADER);
-    
-    server->shader_program = glCreateProgram();
-    glAttachShader(server->shader_program, vert);
-    glAttachShader(server->shader_program, frag);
-    
-    // Explicitly bind attributes to safe locations BEFORE linking
-    glBindAttribLocation(server->shader_program, 0, "position");
-    glBindAttribLocation(server->shader_program, 1, "texcoord");
-    
-    glLinkProgram(server->shader_program);
-    
+// Link the program of one variant, resolving its uniforms once
+static int create_variant(struct ember_server *server, GLuint vert, int variant) {
+    char source[512];
+    char main_text[256];
+    snprintf(main_text, sizeof(main_text), frag_main_text,
+             (variant & EMBER_SHADER_SWIZZLE) ? ".bgra" : "",
+             (variant & EMBER_SHADER_STRAIGHT) ? "    gl_FragColor.rgb *= gl_FragColor.a;\n" : "");
+    snprintf(source, sizeof(source), "%s%suniform %s tex;\n%s",
+             (variant & EMBER_SHADER_EXTERNAL) ? frag_external_text : "", frag_head_text,
+             (variant & EMBER_SHADER_EXTERNAL) ? "samplerExternalOES" : "sampler2D", main_text);
+    GLuint frag = create_shader(server, source, GL_FRAGMENT_SHADER);
+    if (!frag) {
+        return -1;
+    }
+
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vert);
+    glAttachShader(program, frag);
+    // Same attribute locations in every variant, the vertex layout is shared
+    glBindAttribLocation(program, 0, "position");
+    glBindAttribLocation(program, 1, "texcoord");
+    glLinkProgram(program);
+    glDeleteShader(frag);
+
     GLint status;
-    glGetProgramiv(server->shader_program, GL_LINK_STATUS, &status);
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
     if (!status) {
         char log[1024];
-        glGetProgramInfoLog(server->shader_program, sizeof(log), NULL, log);
+        glGetProgramInfoLog(program, sizeof(log), NULL, log);
         fprintf(stderr, "Program link failed: %s\n", log);
+        glDeleteProgram(program);
         return -1;
     }
-    
-    glUseProgram(server->shader_program);
-    
-    server->loc_pos = glGetAttribLocation(server->shader_program, "position");
-    server->loc_texcoord = glGetAttribLocation(server->shader_program, "texcoord");
-    server->loc_tex = glGetUniformLocation(server->shader_program, "tex");
 
-    printf("Renderer initialized: loc_pos=%d, loc_texcoord=%d\n", server->loc_pos, server->loc_texcoord);
-    
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "tex"), 0);
+    server->shaders[variant].program = program;
+    server->shaders[variant].loc_transform = glGetUniformLocation(program, "transform");
     return 0;
 }
 
-void render_frame(struct ember_server *server) {
-    // 1. Make Context Current
-    eglMakeCurrent(server->egl_display, server->egl_surface, server->egl_surface, server->egl_context);
-    
-    // Clear Background (Deep Blue)
-    glClearColor(0.2f, 0.2f, 0.4f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT);
-    
-    // Explicitly set viewport
-    glViewport(0, 0, server->mode.hdisplay, server->mode.vdisplay);
-    
-    glUseProgram(server->shader_program);
-    glUniform1i(server->loc_tex, 0);
-
-    // Alpha Blending
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    // 2. Render Surfaces
-    struct ember_surface *surface;
-    wl_list_for_each_reverse(surface, &server->surfaces, link) {
-        if (!surface->buffer) {
+int init_renderer(struct ember_server *server) {
+    const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+    server->gl_has_unpack_subimage = has_extension(extensions, "GL_EXT_unpack_subimage");
+    server->gl_has_bgra = has_extension(extensions, "GL_EXT_texture_format_BGRA8888");
+    server->gl_has_image_external = has_extension(extensions, "GL_OES_EGL_image_external");
+
+    GLuint vert = create_shader(server, vert_shader_text, GL_VERTEX_SHADER);
+    if (!vert) {
+        return -1;
+    }
+    for (int variant = 0; variant < EMBER_SHADER_VARIANTS; variant++) {
+        if ((variant & EMBER_SHADER_EXTERNAL) && !server->gl_has_image_external) {
             continue;
         }
-        
-        struct wl_shm_buffer *shm_buffer = wl_shm_buffer_get(surface->buffer);
-        if (!shm_buffer) {
-             continue;
-        }
-
-        int32_t width = wl_shm_buffer_get_width(shm_buffer);
-        int32_t height = wl_shm_buffer_get_height(shm_buffer);
-        void *data = wl_shm_buffer_get_data(shm_buffer);
-
-        if (!surface->texture_id) {
-            glGenTextures(1, &surface->texture_id);
-        }
-        
-        glBindTexture(GL_TEXTURE_2D, surface->texture_id);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-        uint32_t format = wl_shm_buffer_get_format(shm_buffer);
-        GLenum gl_format = GL_BGRA_EXT;
-        if (format == WL_SHM_FORMAT_XRGB8888 || format == WL_SHM_FORMAT_ARGB8888) {
-             gl_format = GL_BGRA_EXT;
-        }
-        
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, gl_format, GL_UNSIGNED_BYTE, data);
-        
-        float screen_w = (float)server->mode.hdisplay;
-        float screen_h = (float)server->mode.vdisplay;
-        
-        float x = 100.0f; 
-        float y = 100.0f;
-        
-        float x0 = (x / screen_w) * 2.0f - 1.0f;
-        float y0 = 1.0f - (y / screen_h) * 2.0f;
-        float x1 = ((x + width) / screen_w) * 2.0f - 1.0f;
-        float y1 = 1.0f - ((y + height) / screen_h) * 2.0f;
-
-        GLfloat vVertices[] = {
-             x0, y0, 0.0f,
-             x0, y1, 0.0f,
-             x1, y1, 0.0f,
-             x1, y0, 0.0f 
-        };
-        
-        GLfloat vTexCoords[] = {
-            0.0f, 0.0f,
-            0.0f, 1.0f,
-            1.0f, 1.0f,
-            1.0f, 0.0f
-        };
-        
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, vVertices);
-        glEnableVertexAttribArray(0);
-
-        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, vTexCoords);
-        glEnableVertexAttribArray(1);
-        
-        glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
-    }
-    
-    // 3. Render Cursor
-    render_cursor(server);
-
-    // 4. Swap Buffers (EGL -> GBM)
-    eglSwapBuffers(server->egl_display, server->egl_surface);
-
-    // 5. Get the underlying buffer object (GBM BO)
-    struct gbm_bo *bo = gbm_surface_lock_front_buffer(server->gbm_surface);
-    if (!bo) {
-        fprintf(stderr, "Failed to lock front buffer\n");
+        if (create_variant(server, vert, variant) < 0) {
+            glDeleteShader(vert);
+            return -1;
+        }
+    }
+    glDeleteShader(vert);
+
+    // Index buffer shared by all frames: quad i uses vertices 4i..4i+3
+    GLushort *indices = malloc(EMBER_RENDER_MAX_QUADS * 6 * sizeof(GLushort));
+    if (!indices) {
+        return -1;
+    }
+    for (int i = 0; i < EMBER_RENDER_MAX_QUADS; i++) {
+        GLushort v = i * 4;
+        GLushort *quad = &indices[i * 6];
+        quad[0] = v; quad[1] = v + 1; quad[2] = v + 2;
+        quad[3] = v; quad[4] = v + 2; quad[5] = v + 3;
+    }
+    glGenBuffers(1, &server->quad_ibo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, server->quad_ibo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, EMBER_RENDER_MAX_QUADS * 6 * sizeof(GLushort), indices, GL_STATIC_DRAW);
+    free(indices);
+
+    glGenBuffers(1, &server->quad_vbo);
+    wl_array_init(&server->quad_vertices);
+    wl_array_init(&server->batches);
+    wl_array_init(&server->retired);
+
+    // Rows of RGB565 buffers need not be 4-byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    init_upload(server, extensions);
+    init_hud(server, extensions);
+
+    printf("Renderer initialized: unpack_subimage=%d bgra=%d image_external=%d\n",
+           server->gl_has_unpack_subimage, server->gl_has_bgra, server->gl_has_image_external);
+
+    return 0;
+}
+
+// Upload one box of an SHM buffer into the (already allocated) texture,
+// dst_x/dst_y place the buffer inside it (non-zero in the atlas)
+static void upload_box(struct ember_server *server, const uint8_t *data, int32_t stride,
+                       int32_t buffer_width, GLenum gl_format, GLenum gl_type, int bpp,
+                       int32_t dst_x, int32_t dst_y, int32_t x, int32_t y, int32_t width, int32_t height) {
+    if (server->gl_has_unpack_subimage) {
+        // Let GL walk the client stride directly
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, stride / bpp);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, x);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, y);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x + x, dst_y + y, width, height, gl_format, gl_type, data);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH_EXT, 0);
+        glPixelStorei(GL_UNPACK_SKIP_PIXELS_EXT, 0);
+        glPixelStorei(GL_UNPACK_SKIP_ROWS_EXT, 0);
+        server->stats.bytes_uploaded += (uint64_t)width * height * bpp;
+    } else if (stride == buffer_width * bpp) {
+        // Tightly packed: upload the full rows covering the box in one go
+        glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x, dst_y + y, buffer_width, height, gl_format, gl_type,
+                        data + (size_t)y * stride);
+        server->stats.bytes_uploaded += (uint64_t)buffer_width * height * bpp;
+    } else {
+        // Padded rows and no row length support: one row at a time
+        for (int32_t row = y; row < y + height; row++) {
+            glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x + x, dst_y + row, width, 1, gl_format, gl_type,
+                            data + (size_t)row * stride + (size_t)x * bpp);
+        }
+        server->stats.bytes_uploaded += (uint64_t)width * height * bpp;
+    }
+}
+
+// Called on wl_surface.commit: copy the damaged part of an SHM buffer into
+// the surface texture. The texture storage is kept while the size and
+// format of the committed buffers stay the same.
+void renderer_upload_surface(struct ember_server *server, struct ember_surface *surface,
+                             struct wl_shm_buffer *shm_buffer, pixman_region32_t *buffer_damage) {
+    trace_begin("render", "upload");
+    wl_shm_buffer_begin_access(shm_buffer);
+    renderer_upload_pixels(server, surface, wl_shm_buffer_get_data(shm_buffer),
+                           wl_shm_buffer_get_stride(shm_buffer),
+                           wl_shm_buffer_get_width(shm_buffer),
+                           wl_shm_buffer_get_height(shm_buffer),
+                           wl_shm_buffer_get_format(shm_buffer), buffer_damage);
+    wl_shm_buffer_end_access(shm_buffer);
+    trace_end("render", "upload");
+}
+
+// Whether a frame on the render thread may sample something the snapshot
+// numbered `frame`, or an earlier one, named
+static int frame_in_flight(struct ember_server *server, uint64_t frame) {
+    return server->render_thread && render_thread_oldest_frame(server) <= frame;
+}
+
+// Keep a texture or atlas slot until the frames that may name it are
+// drawn (renderer_release_textures)
+static int retire(struct ember_server *server, GLuint texture, const struct ember_atlas_slot *slot,
+                  uint64_t frame) {
+    if (!frame_in_flight(server, frame)) {
+        return 0;
+    }
+    struct ember_retired *retired = wl_array_add(&server->retired, sizeof(*retired));
+    if (!retired) {
+        return 0;
+    }
+    retired->texture = texture;
+    retired->slot = *slot;
+    retired->frame = frame;
+    return 1;
+}
+
+static void release_texture(struct ember_server *server, GLuint texture, uint64_t frame) {
+    static const struct ember_atlas_slot no_slot;
+    if (!retire(server, texture, &no_slot, frame)) {
+        glDeleteTextures(1, &texture);
+    }
+}
+
+// The slot may not be handed out again while a frame still samples it
+static void release_atlas_slot(struct ember_server *server, struct ember_atlas_slot *slot, uint64_t frame) {
+    if (slot->size && retire(server, 0, slot, frame)) {
+        memset(slot, 0, sizeof(*slot));
+        return;
+    }
+    atlas_free(server, slot);
+}
+
+// Free what the frames back from the render thread were the last to name
+void renderer_release_textures(struct ember_server *server) {
+    uint64_t oldest = server->render_thread ? render_thread_oldest_frame(server) : UINT64_MAX;
+    struct ember_retired *retired = server->retired.data;
+    size_t count = server->retired.size / sizeof(*retired), kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (retired[i].frame >= oldest) {
+            retired[kept++] = retired[i];
+        } else if (retired[i].texture) {
+            glDeleteTextures(1, &retired[i].texture);
+        } else {
+            atlas_free(server, &retired[i].slot);
+        }
+    }
+    server->retired.size = kept * sizeof(*retired);
+}
+
+static void delete_surface_texture(struct ember_surface *surface) {
+    if (surface->texture_id) {
+        release_texture(surface->server, surface->texture_id, surface->texture_frame);
+        surface->texture_id = 0;
+    }
+}
+
+// Bind the surface texture to target, creating it on first use. A texture
+// keeps the target it was first bound to: switching makes a new one.
+static void bind_surface_texture(struct ember_surface *surface, GLenum target) {
+    if (surface->texture_id && surface->texture_target != target) {
+        delete_surface_texture(surface);
+        surface->texture_width = 0;
+    }
+    if (!surface->texture_id) {
+        glGenTextures(1, &surface->texture_id);
+        surface->texture_target = target;
+        glBindTexture(target, surface->texture_id);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    } else {
+        glBindTexture(target, surface->texture_id);
+    }
+}
+
+// Small unscaled surfaces go into the atlas. Scaled ones stay out: linear
+// filtering would pull in the neighbouring slots at their edges. The atlas
+// holds BGRA, other formats have their own texture.
+static int surface_use_atlas(struct ember_server *server, struct ember_surface *surface,
+                             int32_t width, int32_t height, GLenum gl_format) {
+    if (surface->current.scale != 1 || gl_format != GL_BGRA_EXT) {
+        release_atlas_slot(server, &surface->atlas, surface->texture_frame);
+        return 0;
+    }
+    if (atlas_slot_fits(&surface->atlas, width, height)) {
+        return 1;
+    }
+    release_atlas_slot(server, &surface->atlas, surface->texture_frame);
+    return atlas_alloc(server, width, height, &surface->atlas) == 0;
+}
+
+// Same as renderer_upload_surface for pixels already in our address space
+void renderer_upload_pixels(struct ember_server *server, struct ember_surface *surface,
+                            const void *pixels, int32_t stride, int32_t width, int32_t height,
+                            uint32_t format, pixman_region32_t *buffer_damage) {
+    // wl_shm only takes the formats init_shm advertised
+    const struct shm_format *shm_format = get_shm_format(format);
+    if (!shm_format) {
         return;
     }
-    uint32_t fb_id = get_fb_for_bo(server->drm_fd, bo);
+    GLenum gl_format = shm_format->gl_format;
+    surface->shader = 0;
+    if (gl_format == GL_BGRA_EXT && !server->gl_has_bgra) {
+        // Uploaded as is, red and blue are swapped back when sampling
+        gl_format = GL_RGBA;
+        surface->shader = EMBER_SHADER_SWIZZLE;
+    }
+
+    surface->egl_image = EGL_NO_IMAGE_KHR;
+    surface->buffer_opaque = shm_format->opaque;
+
+    if (frame_in_flight(server, surface->texture_frame)) {
+        // A frame on the render thread samples the current contents. Write
+        // the new ones to a fresh texture or slot instead: the buffer holds
+        // all of them, and the old storage goes when that frame is drawn.
+        release_atlas_slot(server, &surface->atlas, surface->texture_frame);
+        delete_surface_texture(surface);
+        surface->texture_width = 0;
+    }
 
-    // 6. Set CRTC (Modeset / Pageflip)
-    static int first_frame = 1;
-    if (first_frame) {
-        printf("Performing first mode set (CRTC: %p, Conn: %p)\n", server->crtc, server->connector);
-        if (!server->crtc || !server->connector) {
-            fprintf(stderr, "CRTC or Connector missing!\n");
-            return;
+    int32_t dst_x = 0, dst_y = 0;
+    int in_atlas = surface->atlas.size > 0;
+    if (surface_use_atlas(server, surface, width, height, gl_format)) {
+        if (!in_atlas) {
+            // Moved out of its own texture, everything has to be copied
+            delete_surface_texture(surface);
+            surface->texture_width = 0;
         }
+        glBindTexture(GL_TEXTURE_2D, server->atlas.texture);
+        dst_x = surface->atlas.x;
+        dst_y = surface->atlas.y;
+    } else {
+        if (in_atlas) {
+            surface->texture_width = 0;
+        }
+        bind_surface_texture(surface, GL_TEXTURE_2D);
+    }
 
-        int ret = drmModeSetCrtc(server->drm_fd, server->crtc->crtc_id, fb_id, 0, 0, &server->connector->connector_id, 1, &server->mode);
-        if (ret < 0) {
-             fprintf(stderr, "drmModeSetCrtc failed: %m\n");
-             return;
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+
+    if (surface->texture_width != width || surface->texture_height != height ||
+        surface->texture_format != gl_format) {
+        // (Re)allocate storage, the whole buffer has to be uploaded. An atlas
+        // slot is allocated already, only its contents are stale.
+        if (!surface->atlas.size) {
+            glTexImage2D(GL_TEXTURE_2D, 0, gl_format, width, height, 0, gl_format, shm_format->gl_type, NULL);
         }
-        first_frame = 0;
+        surface->texture_width = width;
+        surface->texture_height = height;
+        surface->texture_format = gl_format;
+        pixman_region32_init_rect(&damage, 0, 0, width, height);
     } else {
-        int ret = drmModePageFlip(server->drm_fd, server->crtc->crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, server);
-        if (ret < 0) {
-            fprintf(stderr, "drmModePageFlip failed: %m\n");
-            return;
+        pixman_region32_intersect_rect(&damage, buffer_damage, 0, 0, width, height);
+    }
+
+    const uint8_t *data = pixels;
+    if (!upload_staged(server, data, stride, gl_format, shm_format->gl_type, shm_format->bpp,
+                       dst_x, dst_y, &damage)) {
+        int n_boxes;
+        pixman_box32_t *boxes = pixman_region32_rectangles(&damage, &n_boxes);
+        for (int i = 0; i < n_boxes; i++) {
+            upload_box(server, data, stride, width, gl_format, shm_format->gl_type, shm_format->bpp, dst_x, dst_y,
+                       boxes[i].x1, boxes[i].y1, boxes[i].x2 - boxes[i].x1, boxes[i].y2 - boxes[i].y1);
+        }
+    }
+
+    pixman_region32_fini(&damage);
+}
+
+static int dmabuf_format_is_opaque(uint32_t format) {
+    switch (format) {
+    case DRM_FORMAT_XRGB8888:
+    case DRM_FORMAT_XBGR8888:
+    case DRM_FORMAT_XRGB2101010:
+    case DRM_FORMAT_XBGR2101010:
+    case DRM_FORMAT_RGB565:
+    case DRM_FORMAT_NV12:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+// Whether GL can only sample this format/modifier pair as an external
+// texture (YUV and some tiled layouts), see egl_get_dmabuf_formats
+static int dmabuf_is_external(struct ember_server *server, const struct ember_dmabuf_attributes *attributes) {
+    struct ember_dmabuf_format *entry;
+    wl_array_for_each(entry, &server->dmabuf_formats) {
+        if (entry->format == attributes->format && entry->modifier == attributes->modifier) {
+            return entry->external_only;
+        }
+    }
+    return 0;
+}
+
+// Called on wl_surface.commit with a dmabuf buffer: point the surface
+// texture at the client's EGLImage. The GPU samples the client memory
+// directly, nothing is copied.
+void renderer_attach_dmabuf(struct ember_server *server, struct ember_surface *surface,
+                            struct ember_dmabuf_buffer *buffer) {
+    release_atlas_slot(server, &surface->atlas, surface->texture_frame);
+    if (frame_in_flight(server, surface->texture_frame)) {
+        // Retargeting the texture would change what a frame on the render
+        // thread samples, bind the new image to a fresh one
+        delete_surface_texture(surface);
+    }
+    GLenum target = GL_TEXTURE_2D;
+    surface->shader = 0;
+    if (dmabuf_is_external(server, &buffer->attributes)) {
+        target = GL_TEXTURE_EXTERNAL_OES;
+        surface->shader = EMBER_SHADER_EXTERNAL;
+    }
+    bind_surface_texture(surface, target);
+
+    // Rebinding on every commit also picks up the new contents
+    trace_begin("render", "attach_dmabuf");
+    server->gl_image_target_texture_2d(target, buffer->image);
+    trace_end("render", "attach_dmabuf");
+    surface->egl_image = buffer->image;
+    surface->buffer_opaque = dmabuf_format_is_opaque(buffer->attributes.format);
+
+    // The storage now belongs to the image, force the next SHM upload to reallocate
+    surface->texture_width = 0;
+    surface->texture_height = 0;
+    surface->texture_format = 0;
+}
+
+void renderer_destroy_surface(struct ember_surface *surface) {
+    release_atlas_slot(surface->server, &surface->atlas, surface->texture_frame);
+    delete_surface_texture(surface);
+}
+
+// Map a normalized surface coordinate to a normalized buffer coordinate,
+// undoing the transform the client applied to its buffer
+static void surface_to_buffer_coord(int32_t transform, float u, float v, float *s, float *t) {
+    switch (transform) {
+    case WL_OUTPUT_TRANSFORM_90:          *s = v;        *t = 1.0f - u; break;
+    case WL_OUTPUT_TRANSFORM_180:         *s = 1.0f - u; *t = 1.0f - v; break;
+    case WL_OUTPUT_TRANSFORM_270:         *s = 1.0f - v; *t = u;        break;
+    case WL_OUTPUT_TRANSFORM_FLIPPED:     *s = 1.0f - u; *t = v;        break;
+    case WL_OUTPUT_TRANSFORM_FLIPPED_90:  *s = v;        *t = u;        break;
+    case WL_OUTPUT_TRANSFORM_FLIPPED_180: *s = u;        *t = 1.0f - v; break;
+    case WL_OUTPUT_TRANSFORM_FLIPPED_270: *s = 1.0f - v; *t = 1.0f - u; break;
+    default:                              *s = u;        *t = v;        break;
+    }
+}
+
+// Append a quad to the frame's vertex data, extending the last batch when
+// it samples the same texture with the same shader and blending. x, y are
+// output pixels, st the texture coordinates of the corners in TL, BL, BR,
+// TR order.
+static void batch_add_quad(struct ember_server *server, GLuint texture, int shader, int blend,
+                           float x0, float y0, float x1, float y1, const float st[8]) {
+    // Alpha is ignored without blending, no need to premultiply
+    if (!blend) {
+        shader &= ~EMBER_SHADER_STRAIGHT;
+    }
+    GLfloat *v = wl_array_add(&server->quad_vertices, 16 * sizeof(GLfloat));
+    if (!v) {
+        return;
+    }
+    const float corners[4][2] = { {x0, y0}, {x0, y1}, {x1, y1}, {x1, y0} };
+    for (int i = 0; i < 4; i++) {
+        v[i * 4 + 0] = corners[i][0];
+        v[i * 4 + 1] = corners[i][1];
+        v[i * 4 + 2] = st[i * 2];
+        v[i * 4 + 3] = st[i * 2 + 1];
+    }
+
+    int quad = server->quad_vertices.size / (16 * sizeof(GLfloat)) - 1;
+    struct ember_render_batch *last = NULL;
+    if (server->batches.size > 0) {
+        last = (struct ember_render_batch *)((char *)server->batches.data + server->batches.size) - 1;
+    }
+    if (last && last->texture == texture && last->shader == shader && last->blend == blend) {
+        last->n_quads++;
+        return;
+    }
+    struct ember_render_batch *batch = wl_array_add(&server->batches, sizeof(*batch));
+    if (!batch) {
+        server->quad_vertices.size -= 16 * sizeof(GLfloat);
+        return;
+    }
+    batch->texture = texture;
+    batch->shader = shader;
+    batch->blend = blend;
+    batch->first_quad = quad;
+    batch->n_quads = 1;
+}
+
+// Append the parts of a textured rectangle that lie inside region, one quad
+// per rectangle of the intersection. The texture coordinates of the pieces
+// are interpolated from those of the corners, so the contents stay put.
+static void batch_add_clipped(struct ember_server *server, GLuint texture, int shader, int blend,
+                              float x0, float y0, float x1, float y1, const float st[8],
+                              pixman_region32_t *region) {
+    pixman_region32_t clip;
+    int32_t bx = (int32_t)floorf(x0), by = (int32_t)floorf(y0);
+    pixman_region32_init_rect(&clip, bx, by, (int32_t)ceilf(x1) - bx, (int32_t)ceilf(y1) - by);
+    pixman_region32_intersect(&clip, &clip, region);
+
+    int n_boxes;
+    pixman_box32_t *boxes = pixman_region32_rectangles(&clip, &n_boxes);
+    for (int i = 0; i < n_boxes; i++) {
+        float px0 = fmaxf(boxes[i].x1, x0), px1 = fminf(boxes[i].x2, x1);
+        float py0 = fmaxf(boxes[i].y1, y0), py1 = fminf(boxes[i].y2, y1);
+        float u0 = (px0 - x0) / (x1 - x0), u1 = (px1 - x0) / (x1 - x0);
+        float v0 = (py0 - y0) / (y1 - y0), v1 = (py1 - y0) / (y1 - y0);
+        const float uv[4][2] = { {u0, v0}, {u0, v1}, {u1, v1}, {u1, v0} };
+
+        // Texture coordinates are affine in u, v: walk from TL along the
+        // top (towards TR) and left (towards BL) edges
+        float piece[8];
+        for (int c = 0; c < 4; c++) {
+            float u = uv[c][0], v = uv[c][1];
+            piece[c * 2] = st[0] + (st[6] - st[0]) * u + (st[2] - st[0]) * v;
+            piece[c * 2 + 1] = st[1] + (st[7] - st[1]) * u + (st[3] - st[1]) * v;
         }
+        batch_add_quad(server, texture, shader, blend, px0, py0, px1, py1, piece);
     }
+    pixman_region32_fini(&clip);
+}
 
-    // Cleanup previous buffer
-    if (server->previous_bo) {
-        drmModeRmFB(server->drm_fd, server->previous_fb_id);
-        gbm_surface_release_buffer(server->gbm_surface, server->previous_bo);
+// Texture a surface is drawn from and the texture coordinates of its
+// corners (TL, BL, BR, TR). Returns 0 while it has no contents.
+int renderer_surface_texcoords(struct ember_server *server, struct ember_surface *surface,
+                               GLuint *texture, float st[8]) {
+    if (!surface->texture_id && !surface->atlas.size) {
+        return 0;
+    }
+
+    // Corners in surface space, mapped into the buffer
+    static const float corners[4][2] = { {0.0f, 0.0f}, {0.0f, 1.0f}, {1.0f, 1.0f}, {1.0f, 0.0f} };
+    for (int i = 0; i < 4; i++) {
+        surface_to_buffer_coord(surface->current.transform, corners[i][0], corners[i][1],
+                                &st[i * 2], &st[i * 2 + 1]);
+    }
+
+    *texture = surface->texture_id;
+    if (surface->atlas.size) {
+        // Buffer coordinates -> the surface's slot in the atlas
+        float scale_s = (float)surface->texture_width / EMBER_ATLAS_SIZE;
+        float scale_t = (float)surface->texture_height / EMBER_ATLAS_SIZE;
+        for (int i = 0; i < 4; i++) {
+            st[i * 2] = (float)surface->atlas.x / EMBER_ATLAS_SIZE + st[i * 2] * scale_s;
+            st[i * 2 + 1] = (float)surface->atlas.y / EMBER_ATLAS_SIZE + st[i * 2 + 1] * scale_t;
+        }
+        *texture = server->atlas.texture;
+    }
+    return 1;
+}
+
+// Add the part of snapshot entry i inside region (output coordinates)
+static void batch_add_entry(struct ember_server *server, struct ember_frame_snapshot *frame, int i,
+                            pixman_region32_t *region, int blend) {
+    const pixman_box32_t *box = &frame->boxes[i];
+    batch_add_clipped(server, frame->textures[i], frame->shaders[i], blend, (float)box->x1, (float)box->y1,
+                      (float)box->x2, (float)box->y2, &frame->texcoords[i * 8], region);
+}
+
+// Translucent part of a snapshot entry, found front to back and drawn back
+// to front
+struct blended_entry {
+    int index;
+    pixman_region32_t region;
+};
+
+// Collect the quads of everything visible in the repaint region, then the
+// overlays (HUD, GL cursor) on top.
+// The snapshot is walked top to bottom, cutting away what the opaque surfaces
+// above them cover. Opaque parts never overlap, they are added right away
+// with blending off; the rest waits for a bottom to top pass with blending
+// on. clear is set to what no opaque surface covers.
+static void build_batches(struct ember_server *server, struct ember_frame_snapshot *frame,
+                          pixman_region32_t *repaint, pixman_region32_t *clear) {
+    struct ember_frame_result *result = &frame->result;
+    server->quad_vertices.size = 0;
+    server->batches.size = 0;
+
+    struct wl_array blended;
+    wl_array_init(&blended);
+    pixman_region32_t occluded, visible, opaque;
+    pixman_region32_init(&occluded);
+    pixman_region32_init(&visible);
+    pixman_region32_init(&opaque);
+
+    for (int i = 0; i < frame->count; i++) {
+        const pixman_box32_t *box = &frame->boxes[i];
+        pixman_region32_intersect_rect(&visible, repaint, box->x1, box->y1,
+                                       box->x2 - box->x1, box->y2 - box->y1);
+        if (!pixman_region32_not_empty(&visible)) {
+            continue;
+        }
+        pixman_region32_subtract(&visible, &visible, &occluded);
+        if (!pixman_region32_not_empty(&visible)) {
+            result->surfaces_occluded++;
+            continue;
+        }
+        result->surfaces_drawn++;
+
+        pixman_region32_union(&occluded, &occluded, &frame->opaque[i]);
+        pixman_region32_intersect(&opaque, &frame->opaque[i], &visible);
+        if (pixman_region32_not_empty(&opaque)) {
+            batch_add_entry(server, frame, i, &opaque, 0);
+            pixman_region32_subtract(&visible, &visible, &opaque);
+        }
+        if (pixman_region32_not_empty(&visible)) {
+            struct blended_entry *entry = wl_array_add(&blended, sizeof(*entry));
+            if (entry) {
+                entry->index = i;
+                pixman_region32_init(&entry->region);
+                pixman_region32_copy(&entry->region, &visible);
+            }
+        }
+    }
+
+    struct blended_entry *entries = blended.data;
+    for (int i = (int)(blended.size / sizeof(*entries)) - 1; i >= 0; i--) {
+        batch_add_entry(server, frame, entries[i].index, &entries[i].region, 1);
+        pixman_region32_fini(&entries[i].region);
     }
-    server->previous_bo = bo;
-    server->previous_fb_id = fb_id;
+    wl_array_release(&blended);
+
+    struct ember_overlay_quad *quad;
+    wl_array_for_each(quad, &frame->overlays) {
+        batch_add_clipped(server, quad->texture, EMBER_SHADER_STRAIGHT, 1,
+                          quad->x0, quad->y0, quad->x1, quad->y1, quad->st, repaint);
+    }
+
+    pixman_region32_subtract(clear, repaint, &occluded);
+    pixman_region32_fini(&occluded);
+    pixman_region32_fini(&visible);
+    pixman_region32_fini(&opaque);
+}
+
+// transform maps output pixels (top-left origin) to clip space
+static void draw_batches(struct ember_server *server, const GLfloat transform[4],
+                         struct ember_frame_result *result) {
+    const GLsizei stride = 4 * sizeof(GLfloat);
+    int blending = -1;
+    int shader = -1;
+    struct ember_render_batch *batch;
+    wl_array_for_each(batch, &server->batches) {
+        struct ember_shader *variant = &server->shaders[batch->shader];
+        if (!variant->program) {
+            continue;
+        }
+        if (batch->shader != shader) {
+            // Uniforms belong to the program, set the transform on every switch
+            glUseProgram(variant->program);
+            glUniform4fv(variant->loc_transform, 1, transform);
+            shader = batch->shader;
+        }
+        if (batch->blend != blending) {
+            if (batch->blend) {
+                glEnable(GL_BLEND);
+            } else {
+                glDisable(GL_BLEND);
+            }
+            blending = batch->blend;
+        }
+        glBindTexture((batch->shader & EMBER_SHADER_EXTERNAL) ? GL_TEXTURE_EXTERNAL_OES : GL_TEXTURE_2D,
+                      batch->texture);
+        int first = batch->first_quad;
+        int remaining = batch->n_quads;
+        while (remaining > 0) {
+            int count = remaining < EMBER_RENDER_MAX_QUADS ? remaining : EMBER_RENDER_MAX_QUADS;
+            // No base vertex in GLES2: point the attributes at the first quad
+            uintptr_t offset = (uintptr_t)first * 4 * stride;
+            glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, (const void *)offset);
+            glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (const void *)(offset + 2 * sizeof(GLfloat)));
+            glDrawElements(GL_TRIANGLES, count * 6, GL_UNSIGNED_SHORT, NULL);
+            result->draw_calls++;
+            first += count;
+            remaining -= count;
+        }
+    }
+}
+
+// Convert output-space boxes (top-left origin) into EGL rects (bottom-left origin)
+static EGLint *boxes_to_egl_rects(pixman_box32_t *boxes, int n_boxes, int screen_h) {
+    EGLint *rects = calloc(n_boxes * 4, sizeof(EGLint));
+    if (!rects) return NULL;
+    for (int i = 0; i < n_boxes; i++) {
+        rects[i * 4 + 0] = boxes[i].x1;
+        rects[i * 4 + 1] = screen_h - boxes[i].y2;
+        rects[i * 4 + 2] = boxes[i].x2 - boxes[i].x1;
+        rects[i * 4 + 3] = boxes[i].y2 - boxes[i].y1;
+    }
+    return rects;
+}
+
+// Draw a snapshot into the output's next buffer with the given context,
+// which has to be current on no other thread. Does not touch surfaces or
+// the scene; on the render thread this runs while the protocol thread
+// takes the next snapshot.
+static int draw_snapshot(struct ember_output *output, struct ember_frame_snapshot *frame, EGLContext context) {
+    struct ember_server *server = output->server;
+    struct ember_frame_result *result = &frame->result;
+
+    // 1. Make Context Current (all contexts share the surface textures)
+    eglMakeCurrent(server->egl_display, output->egl_surface, output->egl_surface, context);
+
+    // Texture uploads made before the snapshot was taken (other context)
+    if (frame->fence != EGL_NO_SYNC_KHR) {
+        if (server->egl_wait_sync) {
+            server->egl_wait_sync(server->egl_display, frame->fence, 0);
+        } else {
+            server->egl_client_wait_sync(server->egl_display, frame->fence,
+                                         EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, EGL_FOREVER_KHR);
+        }
+        server->egl_destroy_sync(server->egl_display, frame->fence);
+        frame->fence = EGL_NO_SYNC_KHR;
+    }
+    hud_gpu_begin(output, frame);
+
+    // Without a window surface (headless benchmarks) we draw into the
+    // caller's FBO, which keeps its contents like a single buffer
+    int headless = output->egl_surface == EGL_NO_SURFACE;
+
+    int screen_w = output->mode.hdisplay;
+    int screen_h = output->mode.vdisplay;
+
+    // Work out how much of this back buffer is stale
+    EGLint buffer_age = headless ? 1 : 0;
+    if (!headless && server->egl_has_buffer_age) {
+        eglQuerySurface(server->egl_display, output->egl_surface, EGL_BUFFER_AGE_EXT, &buffer_age);
+    }
+
+    pixman_region32_t repaint;
+    pixman_region32_init(&repaint);
+    damage_get_repaint_region(output, &frame->damage, buffer_age, &repaint);
+
+    // Every rectangle repeats all draw calls, past a few it is cheaper to
+    // redraw their bounding box
+    if (pixman_region32_n_rects(&repaint) > EMBER_RENDER_MAX_BOXES) {
+        pixman_box32_t extents = *pixman_region32_extents(&repaint);
+        pixman_region32_fini(&repaint);
+        pixman_region32_init_rect(&repaint, extents.x1, extents.y1,
+                                  extents.x2 - extents.x1, extents.y2 - extents.y1);
+    }
+
+    int n_boxes;
+    pixman_box32_t *boxes = pixman_region32_rectangles(&repaint, &n_boxes);
+
+    // Tell the driver which parts of the buffer we are about to touch
+    if (!headless && server->egl_set_damage_region && n_boxes > 0) {
+        EGLint *rects = boxes_to_egl_rects(boxes, n_boxes, screen_h);
+        if (rects) {
+            server->egl_set_damage_region(server->egl_display, output->egl_surface, rects, n_boxes);
+            free(rects);
+        }
+    }
+
+    // Explicitly set viewport
+    glViewport(0, 0, screen_w, screen_h);
+
+    // Output pixels (top-left origin) -> clip space
+    const GLfloat transform[4] = { 2.0f / screen_w, -2.0f / screen_h, -1.0f, 1.0f };
+
+    // Alpha Blending, switched on and off per batch. Client buffers are
+    // premultiplied, the straight alpha variant premultiplies in the shader.
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+
+    // 2. Upload the quads of this frame once (textures were uploaded on commit)
+    pixman_region32_t clear;
+    pixman_region32_init(&clear);
+    trace_begin("render", "build_batches");
+    build_batches(server, frame, &repaint, &clear);
+    trace_end("render", "build_batches");
+    trace_begin("render", "draw");
+    glBindBuffer(GL_ARRAY_BUFFER, server->quad_vbo);
+    glBufferData(GL_ARRAY_BUFFER, server->quad_vertices.size, server->quad_vertices.data, GL_STREAM_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, server->quad_ibo);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
+
+    // 3. Clear Background (Deep Blue) where no opaque surface covers it.
+    // Everything in repaint is drawn over afterwards, so when that takes
+    // many rectangles clearing all of repaint is fine too.
+    int n_clear;
+    pixman_box32_t *clear_boxes = pixman_region32_rectangles(&clear, &n_clear);
+    if (n_clear > EMBER_RENDER_MAX_BOXES) {
+        clear_boxes = boxes;
+        n_clear = n_boxes;
+    }
+    glEnable(GL_SCISSOR_TEST);
+    glClearColor(0.2f, 0.2f, 0.4f, 1.0f);
+    for (int i = 0; i < n_clear; i++) {
+        pixman_box32_t *box = &clear_boxes[i];
+        glScissor(box->x1, screen_h - box->y2, box->x2 - box->x1, box->y2 - box->y1);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+    glDisable(GL_SCISSOR_TEST);
+    pixman_region32_fini(&clear);
+
+    // 4. Draw the damaged part of the scene, the quads are clipped to it
+    draw_batches(server, transform, result);
+    glDisable(GL_BLEND);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    pixman_region32_fini(&repaint);
+    hud_gpu_end(output);
+    trace_end("render", "draw");
+
+    if (headless) {
+        damage_frame_submitted(output, &frame->damage);
+        return 0;
+    }
+
+    // 5. Swap Buffers (EGL -> GBM), passing along what changed this frame
+    int n_damage;
+    pixman_box32_t *damage_boxes = pixman_region32_rectangles(&frame->damage, &n_damage);
+    EGLint *damage_rects = NULL;
+    if (server->egl_swap_buffers_with_damage && n_damage > 0) {
+        damage_rects = boxes_to_egl_rects(damage_boxes, n_damage, screen_h);
+    }
+    EGLBoolean swapped;
+    trace_begin("render", "eglSwapBuffers");
+    if (damage_rects) {
+        swapped = server->egl_swap_buffers_with_damage(server->egl_display, output->egl_surface, damage_rects, n_damage);
+        free(damage_rects);
+    } else {
+        swapped = eglSwapBuffers(server->egl_display, output->egl_surface);
+    }
+    trace_end("render", "eglSwapBuffers");
+    if (!swapped) {
+        fprintf(stderr, "eglSwapBuffers failed\n");
+        return -1;
+    }
+    damage_frame_submitted(output, &frame->damage);
+    return 0;
+}
+
+// Draw a snapshot (snapshot_take), the outcome goes into frame->result
+void renderer_draw_snapshot(struct ember_output *output, struct ember_frame_snapshot *frame, EGLContext context) {
+    trace_begin("render", "render_frame");
+    // Input handled since the last frame shows up in this one
+    trace_frame_flows();
+    uint64_t start = monotonic_ns();
+    frame->result.ret = draw_snapshot(output, frame, context);
+    frame->result.cpu_ns = monotonic_ns() - start;
+    trace_end("render", "render_frame");
+}
+
+int render_frame(struct ember_output *output) {
+    struct ember_frame_snapshot *frame = snapshot_take(output);
+    renderer_draw_snapshot(output, frame, output->server->egl_context);
+    snapshot_finish(output, frame);
+    return frame->result.ret;
 }
@@ -0,0 +1,361 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <xf86drm.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "renderer.h"
+#include "input.h"
+
+// Repaint scheduling.
+// Every output runs this loop on its own, timed by its own vblanks, so a
+// fast panel is never held back by a slower one.
+// Frames are only produced when something changed (output damage) or a
+// client asked for a frame callback. While idle we do not page flip at all.
+// When there is work, the frame is started as late as possible before the
+// next vblank: the deadline is the predicted vblank minus the measured render
+// time minus a safety margin, so clients get the most time to commit and the
+// result reaches the screen with the least latency.
+
+// Slack kept between the end of rendering and the vblank
+#define EMBER_REPAINT_MARGIN_NS 1500000ull
+// Added to the render time estimate each time we miss the targeted vblank
+#define EMBER_REPAINT_MISS_PENALTY_NS 1000000ull
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Refresh period from the mode timings (vrefresh is rounded to whole Hz)
+static uint64_t mode_refresh_ns(const drmModeModeInfo *mode) {
+    if (mode->clock > 0 && mode->htotal > 0 && mode->vtotal > 0) {
+        uint64_t pixels = (uint64_t)mode->htotal * mode->vtotal;
+        if (mode->flags & DRM_MODE_FLAG_INTERLACE) {
+            pixels /= 2;
+        }
+        if (mode->flags & DRM_MODE_FLAG_DBLSCAN) {
+            pixels *= 2;
+        }
+        if (mode->vscan > 1) {
+            pixels *= mode->vscan;
+        }
+        // clock is in kHz
+        return pixels * 1000000ull / mode->clock;
+    }
+    if (mode->vrefresh > 0) {
+        return 1000000000ull / mode->vrefresh;
+    }
+    return 1000000000ull / 60;
+}
+
+// Move the frame callbacks of every surface on this output to an output
+// list, they are answered at the vblank that shows this frame. A surface
+// spanning several outputs is paced by whichever repaints first. Latency
+// samples of the surfaces' last commits go along the same way.
+static void collect_frame_callbacks(struct ember_output *output, struct wl_list *callbacks,
+                                    struct wl_array *latency) {
+    struct ember_render_list *list = scene_render_list(output->server);
+    for (int i = 0; i < list->count; i++) {
+        struct ember_surface *surface = list->surfaces[i];
+        if (wl_list_empty(&surface->current.frame_callbacks) && surface->latency.size == 0) {
+            continue;
+        }
+        const pixman_box32_t *box = &list->boxes[i];
+        if (!output_intersects_box(output, box->x1, box->y1, box->x2 - box->x1, box->y2 - box->y1)) {
+            continue;
+        }
+        wl_list_insert_list(callbacks->prev, &surface->current.frame_callbacks);
+        wl_list_init(&surface->current.frame_callbacks);
+        latency_collect(surface, latency);
+    }
+}
+
+// Tell clients their last frame is on screen, using the vblank timestamp
+static void send_frame_callbacks(struct ember_output *output, uint64_t vblank_ns) {
+    uint32_t time = vblank_ns / 1000000;
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, &output->frame_callbacks) {
+        wl_callback_send_done(cb, time);
+        wl_resource_destroy(cb);
+    }
+}
+
+static void update_render_time(struct ember_output *output, uint64_t elapsed) {
+    // Follow increases immediately, decay slowly so one fast frame does not
+    // make us start the next one too late
+    if (elapsed > output->repaint_render_ns) {
+        output->repaint_render_ns = elapsed;
+    } else {
+        output->repaint_render_ns = (output->repaint_render_ns * 15 + elapsed) / 16;
+    }
+}
+
+// Put the frame on screen once it is drawn (ret is render_frame's result)
+static void output_present(struct ember_output *output, int composite, int planes_changed, int ret) {
+    if (ret == 0) {
+        if (composite || planes_changed) {
+            ret = kms_present(output, composite);
+        } else {
+            // Only frame callbacks are pending: nothing to draw, just wait for
+            // the vblank instead of flipping an identical buffer
+            ret = drm_queue_vblank(output);
+        }
+    }
+
+    if (ret < 0) {
+        // The frame never made it to the screen; redraw everything with the
+        // next change instead of retrying in a loop
+        damage_output_whole(output);
+        output->repaint_state = EMBER_REPAINT_IDLE;
+        output->latency.size = 0;
+        return;
+    }
+    if (ret > 0) {
+        // Presented synchronously (initial modeset), no event will follow
+        repaint_frame_done(output, monotonic_ns());
+    }
+}
+
+static void output_repaint(struct ember_output *output) {
+    collect_frame_callbacks(output, &output->frame_callbacks, &output->latency);
+    // May add damage for surfaces moving between planes and composition
+    int planes_changed = kms_assign_planes(output);
+    output->repaint_needed = 0;
+
+    // Damage collected during direct scanout waits until we composite again
+    int composite = pixman_region32_not_empty(&output->damage) && !output->direct_scanout;
+    if (!composite && !planes_changed && wl_list_empty(&output->frame_callbacks)) {
+        // No flip will show these commits, an unrelated later one must not
+        // close their samples
+        output->repaint_state = EMBER_REPAINT_IDLE;
+        output->latency.size = 0;
+        return;
+    }
+
+    if (composite && output->server->render_thread) {
+        // Presented by repaint_frame_rendered once the thread is done
+        output->repaint_state = EMBER_REPAINT_RENDERING;
+        render_thread_submit(output);
+        return;
+    }
+
+    // Damage added while drawing belongs to the next frame
+    output->repaint_state = EMBER_REPAINT_FLIP_PENDING;
+
+    int ret = 0;
+    if (composite) {
+        uint64_t start = monotonic_ns();
+        ret = render_frame(output);
+        update_render_time(output, monotonic_ns() - start);
+    }
+    output_present(output, composite, planes_changed, ret);
+}
+
+// The render thread drew the frame output_repaint handed it
+void repaint_frame_rendered(struct ember_output *output, int ret) {
+    update_render_time(output, monotonic_ns() - output->render_start_ns);
+    output->repaint_state = EMBER_REPAINT_FLIP_PENDING;
+    // Plane changes were made when the frame started, the commit takes them along
+    output_present(output, 1, 0, ret);
+}
+
+// Triple buffering lets GL draw the next frame while the previous one still
+// waits for its flip. Plane assignment is only redone by a full repaint, so
+// this is limited to frames where everything is composited. The render
+// thread takes one frame at a time.
+static int repaint_can_render_ahead(struct ember_output *output) {
+    if (output->direct_scanout || output->server->render_thread) {
+        return 0;
+    }
+    for (int i = 0; i < output->n_planes; i++) {
+        if (output->planes[i].surface) {
+            return 0;
+        }
+    }
+    return swapchain_can_render_ahead(&output->swapchain);
+}
+
+// Draw the next frame now, repaint_frame_done commits it when the pending
+// flip completes
+static void output_render_ahead(struct ember_output *output) {
+    if (!repaint_can_render_ahead(output) || !pixman_region32_not_empty(&output->damage)) {
+        return;
+    }
+    output->repaint_needed = 0;
+    collect_frame_callbacks(output, &output->frame_callbacks_queued, &output->latency_queued);
+
+    uint64_t start = monotonic_ns();
+    int ret = render_frame(output);
+    update_render_time(output, monotonic_ns() - start);
+    if (ret < 0 || !swapchain_lock(&output->swapchain)) {
+        // Try again with a regular repaint after the flip
+        pixman_region32_union_rect(&output->damage, &output->damage,
+                                   0, 0, output->mode.hdisplay, output->mode.vdisplay);
+        output->repaint_needed = 1;
+    }
+}
+
+static void repaint_dispatch(struct ember_output *output) {
+    if (output->repaint_state == EMBER_REPAINT_SCHEDULED) {
+        output_repaint(output);
+    } else if (output->repaint_state == EMBER_REPAINT_FLIP_PENDING && output->repaint_ahead_scheduled) {
+        output->repaint_ahead_scheduled = 0;
+        output_render_ahead(output);
+    }
+}
+
+static int repaint_timer_handler(void *data) {
+    struct ember_output *output = data;
+    repaint_dispatch(output);
+    return 0;
+}
+
+static void repaint_idle_handler(void *data) {
+    struct ember_output *output = data;
+    repaint_dispatch(output);
+}
+
+// Vblanks keep coming while we are idle, extrapolate to the next one.
+// Returns 0 while the timing is unknown (nothing shown yet).
+uint64_t repaint_next_vblank_ns(struct ember_output *output, uint64_t now) {
+    uint64_t refresh = output->repaint_refresh_ns;
+    if (output->repaint_last_vblank_ns == 0) {
+        return 0;
+    }
+    uint64_t next_vblank = output->repaint_last_vblank_ns + refresh;
+    if (next_vblank <= now) {
+        next_vblank += ((now - next_vblank) / refresh + 1) * refresh;
+    }
+    return next_vblank;
+}
+
+// Arm the timer so the frame is started just in time for the next vblank,
+// or the one after it when drawing ahead of a pending flip
+static void start_repaint_timer(struct ember_output *output, int ahead) {
+    if (ahead) {
+        output->repaint_ahead_scheduled = 1;
+    } else {
+        output->repaint_state = EMBER_REPAINT_SCHEDULED;
+    }
+
+    uint64_t now = monotonic_ns();
+    uint64_t refresh = output->repaint_refresh_ns;
+    uint64_t next_vblank = repaint_next_vblank_ns(output, now);
+    if (next_vblank == 0) {
+        // Timing unknown (nothing shown yet), draw right away
+        wl_event_loop_add_idle(output->server->wl_event_loop, repaint_idle_handler, output);
+        return;
+    }
+    if (ahead) {
+        // The pending flip takes the next vblank
+        next_vblank += refresh;
+    }
+
+    uint64_t budget = output->repaint_render_ns + EMBER_REPAINT_MARGIN_NS;
+    uint64_t deadline = next_vblank > budget ? next_vblank - budget : 0;
+    if (deadline <= now + 1000000ull) {
+        // Too late to wait (the timer has ms granularity), render now
+        if (!ahead) {
+            output->repaint_target_ns = now + budget <= next_vblank ? next_vblank : next_vblank + refresh;
+        }
+        wl_event_loop_add_idle(output->server->wl_event_loop, repaint_idle_handler, output);
+        return;
+    }
+
+    if (!ahead) {
+        output->repaint_target_ns = next_vblank;
+    }
+    // Round down, firing a little early is harmless
+    wl_event_source_timer_update(output->repaint_timer, (int)((deadline - now) / 1000000ull));
+}
+
+void schedule_repaint(struct ember_output *output) {
+    output->repaint_needed = 1;
+    if (output->repaint_state == EMBER_REPAINT_IDLE) {
+        start_repaint_timer(output, 0);
+    } else if (output->repaint_state == EMBER_REPAINT_FLIP_PENDING &&
+               !output->repaint_ahead_scheduled && repaint_can_render_ahead(output)) {
+        start_repaint_timer(output, 1);
+    }
+    // Otherwise already scheduled, or the pending flip will pick this up
+}
+
+// Something on the surface changed without damaging the composited image
+// (new buffer on a plane, frame callback): repaint the outputs showing it
+void schedule_surface_repaint(struct ember_surface *surface) {
+    struct ember_output *output;
+    wl_list_for_each(output, &surface->server->outputs, link) {
+        if (output_intersects_box(output, surface->pos_x, surface->pos_y, surface->width, surface->height)) {
+            schedule_repaint(output);
+        }
+    }
+}
+
+void repaint_frame_done(struct ember_output *output, uint64_t vblank_ns) {
+    // Missed the vblank we were aiming for: leave more room next time
+    uint64_t missed = 0;
+    if (output->repaint_target_ns && vblank_ns > output->repaint_target_ns + output->repaint_refresh_ns / 2) {
+        missed = (vblank_ns - output->repaint_target_ns + output->repaint_refresh_ns / 2) / output->repaint_refresh_ns;
+        output->repaint_render_ns += EMBER_REPAINT_MISS_PENALTY_NS;
+        if (output->repaint_render_ns > output->repaint_refresh_ns) {
+            output->repaint_render_ns = output->repaint_refresh_ns;
+        }
+    }
+    hud_frame_presented(output, vblank_ns, missed);
+    output->repaint_target_ns = 0;
+    output->repaint_last_vblank_ns = vblank_ns;
+    output->repaint_state = EMBER_REPAINT_IDLE;
+    output->repaint_ahead_scheduled = 0;
+
+    kms_frame_done(output);
+    send_frame_callbacks(output, vblank_ns);
+    latency_frame_presented(&output->latency, vblank_ns);
+
+    // Callbacks collected for a frame drawn ahead belong to the next flip
+    wl_list_insert_list(output->frame_callbacks.prev, &output->frame_callbacks_queued);
+    wl_list_init(&output->frame_callbacks_queued);
+    struct wl_array latency = output->latency;
+    output->latency = output->latency_queued;
+    output->latency_queued = latency;
+
+    // A frame drawn ahead goes out right away
+    if (output->swapchain.rendering) {
+        output->repaint_state = EMBER_REPAINT_FLIP_PENDING;
+        output->repaint_target_ns = vblank_ns + output->repaint_refresh_ns;
+        if (kms_present(output, 1) < 0) {
+            output->repaint_state = EMBER_REPAINT_IDLE;
+            damage_output_whole(output);
+            return;
+        }
+        if (output->repaint_needed && repaint_can_render_ahead(output)) {
+            start_repaint_timer(output, 1);
+        }
+        return;
+    }
+
+    if (output->repaint_needed) {
+        start_repaint_timer(output, 0);
+    }
+}
+
+int init_repaint(struct ember_output *output) {
+    output->repaint_state = EMBER_REPAINT_IDLE;
+    output->repaint_refresh_ns = mode_refresh_ns(&output->mode);
+    output->repaint_render_ns = 0;
+    output->repaint_timer = wl_event_loop_add_timer(output->server->wl_event_loop, repaint_timer_handler, output);
+    if (!output->repaint_timer) {
+        fprintf(stderr, "Failed to create repaint timer\n");
+        return -1;
+    }
+    wl_list_init(&output->frame_callbacks);
+    wl_list_init(&output->frame_callbacks_queued);
+    wl_array_init(&output->latency);
+    wl_array_init(&output->latency_queued);
+    init_snapshots(output);
+    printf("Repaint scheduler: refresh %.3f ms\n", output->repaint_refresh_ns / 1000000.0);
+    return 0;
+}
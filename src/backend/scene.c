@@ -0,0 +1,177 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "renderer.h"
+
+// Retained scene.
+// Everything the compositor shows hangs off a tree: the root holds one tree
+// node per layer (background, windows, overlay) and surfaces sit in those.
+// Nodes cache their layout position and what the renderer needs to draw
+// them. Whenever the tree or a cached value changes, the scene is marked
+// dirty and compiled again into a flat render list, topmost first, with
+// one array per field. Frame preparation (plane assignment, frame
+// callbacks, frame snapshots) then only scans those arrays.
+//
+// The cursor is not part of the tree: it moves at input rate, which would
+// recompile the list on every motion. Outputs are views onto the layout,
+// each reads the whole list and skips what it does not show.
+
+static void node_update_world(struct ember_scene_node *node) {
+    node->world_x = node->x + (node->parent ? node->parent->world_x : 0);
+    node->world_y = node->y + (node->parent ? node->parent->world_y : 0);
+    if (node->surface) {
+        node->surface->pos_x = node->world_x;
+        node->surface->pos_y = node->world_y;
+    }
+    struct ember_scene_node *child;
+    wl_list_for_each(child, &node->children, link) {
+        node_update_world(child);
+    }
+}
+
+// Add a node at the top of parent (NULL for the root)
+void scene_node_init(struct ember_scene_node *node, struct ember_scene *scene,
+                     struct ember_scene_node *parent, struct ember_surface *surface) {
+    memset(node, 0, sizeof(*node));
+    node->scene = scene;
+    node->parent = parent;
+    node->surface = surface;
+    node->enabled = 1;
+    wl_list_init(&node->children);
+    if (parent) {
+        wl_list_insert(parent->children.prev, &node->link);
+    } else {
+        wl_list_init(&node->link);
+    }
+    node_update_world(node);
+    scene->dirty = 1;
+}
+
+void scene_node_destroy(struct ember_scene_node *node) {
+    wl_list_remove(&node->link);
+    wl_list_init(&node->link);
+    node->scene->dirty = 1;
+}
+
+void scene_node_set_position(struct ember_scene_node *node, int32_t x, int32_t y) {
+    if (node->x == x && node->y == y) {
+        return;
+    }
+    node->x = x;
+    node->y = y;
+    node_update_world(node);
+    node->scene->dirty = 1;
+}
+
+void scene_node_set_enabled(struct ember_scene_node *node, int enabled) {
+    if (node->enabled == enabled) {
+        return;
+    }
+    node->enabled = enabled;
+    node->scene->dirty = 1;
+}
+
+// Refresh what the node caches about its surface after a commit. Only a
+// change (new size, texture, atlas slot, transform, format or opacity) recompiles
+// the render list; new contents in the same texture do not.
+void scene_surface_update(struct ember_surface *surface) {
+    struct ember_scene_node *node = &surface->node;
+    GLuint texture = 0;
+    float texcoords[8] = {0};
+    int has_content = renderer_surface_texcoords(surface->server, surface, &texture, texcoords);
+    uint32_t flags = 0;
+    if (has_content && surface->width > 0 && surface->height > 0) {
+        flags |= EMBER_RENDER_VISIBLE;
+    }
+    if (surface->buffer_opaque) {
+        flags |= EMBER_RENDER_OPAQUE;
+    }
+
+    if (node->width == surface->width && node->height == surface->height && node->texture == texture &&
+        node->shader == surface->shader && node->flags == flags &&
+        memcmp(node->texcoords, texcoords, sizeof(texcoords)) == 0) {
+        return;
+    }
+    node->width = surface->width;
+    node->height = surface->height;
+    node->texture = texture;
+    node->shader = surface->shader;
+    node->flags = flags;
+    memcpy(node->texcoords, texcoords, sizeof(texcoords));
+    node->scene->dirty = 1;
+}
+
+static int render_list_reserve(struct ember_render_list *list, int count) {
+    if (count <= list->capacity) {
+        return 0;
+    }
+    int capacity = list->capacity ? list->capacity * 2 : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    struct ember_surface **surfaces = realloc(list->surfaces, capacity * sizeof(*surfaces));
+    if (surfaces) list->surfaces = surfaces;
+    pixman_box32_t *boxes = realloc(list->boxes, capacity * sizeof(*boxes));
+    if (boxes) list->boxes = boxes;
+    GLuint *textures = realloc(list->textures, capacity * sizeof(*textures));
+    if (textures) list->textures = textures;
+    float *texcoords = realloc(list->texcoords, capacity * 8 * sizeof(*texcoords));
+    if (texcoords) list->texcoords = texcoords;
+    int *shaders = realloc(list->shaders, capacity * sizeof(*shaders));
+    if (shaders) list->shaders = shaders;
+    uint32_t *flags = realloc(list->flags, capacity * sizeof(*flags));
+    if (flags) list->flags = flags;
+    if (!surfaces || !boxes || !textures || !texcoords || !shaders || !flags) {
+        return -1;
+    }
+    list->capacity = capacity;
+    return 0;
+}
+
+// Emit the visible surfaces under node, topmost first
+static void compile_node(struct ember_render_list *list, struct ember_scene_node *node) {
+    if (!node->enabled) {
+        return;
+    }
+    struct ember_scene_node *child;
+    wl_list_for_each_reverse(child, &node->children, link) {
+        compile_node(list, child);
+    }
+    if (!node->surface || !(node->flags & EMBER_RENDER_VISIBLE)) {
+        return;
+    }
+    if (render_list_reserve(list, list->count + 1) < 0) {
+        return;
+    }
+    int i = list->count++;
+    list->surfaces[i] = node->surface;
+    list->boxes[i] = (pixman_box32_t){
+        node->world_x, node->world_y, node->world_x + node->width, node->world_y + node->height,
+    };
+    list->textures[i] = node->texture;
+    memcpy(&list->texcoords[i * 8], node->texcoords, sizeof(node->texcoords));
+    list->shaders[i] = node->shader;
+    list->flags[i] = node->flags;
+}
+
+// The render list of the current tree, compiled again if anything changed
+struct ember_render_list *scene_render_list(struct ember_server *server) {
+    struct ember_scene *scene = &server->scene;
+    if (scene->dirty) {
+        scene->list.count = 0;
+        compile_node(&scene->list, &scene->root);
+        scene->dirty = 0;
+    }
+    return &scene->list;
+}
+
+void init_scene(struct ember_server *server) {
+    struct ember_scene *scene = &server->scene;
+    scene_node_init(&scene->root, scene, NULL, NULL);
+    for (int i = 0; i < EMBER_SCENE_LAYER_COUNT; i++) {
+        scene_node_init(&scene->layers[i], scene, &scene->root, NULL);
+    }
+}
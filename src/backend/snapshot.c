@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "renderer.h"
+#include "input.h"
+#include "trace.h"
+
+// Frame snapshots.
+// When an output starts a frame, the protocol thread copies what it will
+// show out of the scene's render list: the entries on this output that are
+// not on one of its planes, in output coordinates with their opaque
+// regions worked out, the HUD and the GL cursor as overlay quads, and the
+// output damage. The renderer draws from that copy alone, so with a render
+// thread the protocol thread keeps changing surfaces and the scene while
+// the frame is drawn. Each output has two snapshots used in turn, the one
+// being drawn is never the one being filled.
+
+static int snapshot_reserve(struct ember_frame_snapshot *frame, int count) {
+    if (count <= frame->capacity) {
+        return 0;
+    }
+    int capacity = frame->capacity ? frame->capacity * 2 : 64;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    pixman_box32_t *boxes = realloc(frame->boxes, capacity * sizeof(*boxes));
+    if (boxes) frame->boxes = boxes;
+    GLuint *textures = realloc(frame->textures, capacity * sizeof(*textures));
+    if (textures) frame->textures = textures;
+    float *texcoords = realloc(frame->texcoords, capacity * 8 * sizeof(*texcoords));
+    if (texcoords) frame->texcoords = texcoords;
+    int *shaders = realloc(frame->shaders, capacity * sizeof(*shaders));
+    if (shaders) frame->shaders = shaders;
+    pixman_region32_t *opaque = realloc(frame->opaque, capacity * sizeof(*opaque));
+    if (opaque) frame->opaque = opaque;
+    if (!boxes || !textures || !texcoords || !shaders || !opaque) {
+        return -1;
+    }
+    for (int i = frame->capacity; i < capacity; i++) {
+        pixman_region32_init(&frame->opaque[i]);
+    }
+    frame->capacity = capacity;
+    return 0;
+}
+
+// Quad drawn over the scene, clipped to the repaint region when drawn
+void snapshot_add_quad(struct ember_frame_snapshot *frame, GLuint texture,
+                       float x0, float y0, float x1, float y1, const float st[8]) {
+    struct ember_overlay_quad *quad = wl_array_add(&frame->overlays, sizeof(*quad));
+    if (!quad) {
+        return;
+    }
+    quad->texture = texture;
+    quad->x0 = x0;
+    quad->y0 = y0;
+    quad->x1 = x1;
+    quad->y1 = y1;
+    memcpy(quad->st, st, sizeof(quad->st));
+}
+
+static void add_entry(struct ember_output *output, struct ember_frame_snapshot *frame,
+                      struct ember_render_list *list, int i) {
+    if (snapshot_reserve(frame, frame->count + 1) < 0) {
+        return;
+    }
+    int n = frame->count++;
+    pixman_box32_t box = list->boxes[i];
+    box.x1 -= output->x; box.x2 -= output->x;
+    box.y1 -= output->y; box.y2 -= output->y;
+    frame->boxes[n] = box;
+    frame->textures[n] = list->textures[i];
+    memcpy(&frame->texcoords[n * 8], &list->texcoords[i * 8], 8 * sizeof(float));
+    frame->shaders[n] = list->shaders[i];
+    list->surfaces[i]->texture_frame = frame->seq;
+
+    // All of it for formats without alpha, else the surface's opaque region
+    if (list->flags[i] & EMBER_RENDER_OPAQUE) {
+        pixman_region32_reset(&frame->opaque[n], &box);
+        return;
+    }
+    pixman_region32_intersect_rect(&frame->opaque[n], &list->surfaces[i]->current.opaque, 0, 0,
+                                   box.x2 - box.x1, box.y2 - box.y1);
+    pixman_region32_translate(&frame->opaque[n], box.x1, box.y1);
+}
+
+// Take the snapshot for the output's next frame. Its damage moves into the
+// snapshot: anything damaged from now on belongs to the frame after.
+struct ember_frame_snapshot *snapshot_take(struct ember_output *output) {
+    struct ember_server *server = output->server;
+    struct ember_frame_snapshot *frame = &output->snapshots[output->snapshot_next];
+    output->snapshot_next = !output->snapshot_next;
+    trace_begin("render", "snapshot");
+    frame->seq = ++server->frame_seq;
+    frame->count = 0;
+    frame->overlays.size = 0;
+    frame->fence = EGL_NO_SYNC_KHR;
+    memset(&frame->result, 0, sizeof(frame->result));
+
+    // Damages the HUD box, so before the damage is taken
+    hud_frame_begin(output, frame);
+
+    struct ember_render_list *list = scene_render_list(server);
+    for (int i = 0; i < list->count; i++) {
+        // Scanned out on one of our planes
+        struct ember_plane *plane = list->surfaces[i]->plane;
+        if (plane && plane->output == output) {
+            continue;
+        }
+        const pixman_box32_t *box = &list->boxes[i];
+        if (output_intersects_box(output, box->x1, box->y1, box->x2 - box->x1, box->y2 - box->y1)) {
+            add_entry(output, frame, list, i);
+        }
+    }
+
+    hud_add_quads(output, frame);
+    GLuint cursor_texture;
+    float cx, cy, size;
+    if (get_cursor_quad(output, &cursor_texture, &cx, &cy, &size)) {
+        static const float st[8] = { 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f };
+        snapshot_add_quad(frame, cursor_texture, cx, cy, cx + size, cy + size, st);
+    }
+
+    pixman_region32_copy(&frame->damage, &output->damage);
+    pixman_region32_clear(&output->damage);
+    trace_end("render", "snapshot");
+    return frame;
+}
+
+// The frame is drawn: fold what the renderer measured into the stats and
+// the HUD (protocol thread)
+void snapshot_finish(struct ember_output *output, struct ember_frame_snapshot *frame) {
+    struct ember_stats *stats = &output->server->stats;
+    struct ember_frame_result *result = &frame->result;
+    stats->frames_rendered++;
+    stats->draw_calls += result->draw_calls;
+    stats->surfaces_drawn += result->surfaces_drawn;
+    stats->surfaces_occluded += result->surfaces_occluded;
+    hud_frame_rendered(output, frame);
+}
+
+void init_snapshots(struct ember_output *output) {
+    for (int i = 0; i < 2; i++) {
+        struct ember_frame_snapshot *frame = &output->snapshots[i];
+        memset(frame, 0, sizeof(*frame));
+        wl_array_init(&frame->overlays);
+        pixman_region32_init(&frame->damage);
+        frame->hud_slot = -1;
+        frame->fence = EGL_NO_SYNC_KHR;
+    }
+    output->snapshot_next = 0;
+    atomic_init(&output->render_published, NULL);
+    atomic_init(&output->render_done, NULL);
+}
@@ -0,0 +1,119 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <gbm.h>
+#include "ember.h"
+#include "backend.h"
+#include "trace.h"
+
+// Swapchain for the composited frames.
+// The gbm surface owns a small, fixed set of buffer objects and hands them
+// out again and again. The DRM framebuffer for each one is created the first
+// time we see it and stored as gbm_bo user data, so it lives exactly as long
+// as the bo instead of being added and removed every frame.
+//
+// A buffer moves through FREE (owned by gbm) -> RENDERING (locked, drawn,
+// not yet handed to KMS) -> QUEUED (committed, waiting for the flip) ->
+// SCANOUT (on screen) -> FREE. With triple buffering a second buffer may be
+// RENDERING while another one is QUEUED.
+
+static void buffer_destroy_notify(struct gbm_bo *bo, void *data) {
+    (void)bo;
+    struct ember_swapchain_buffer *buffer = data;
+    if (buffer->fb_id) {
+        drmModeRmFB(buffer->drm_fd, buffer->fb_id);
+    }
+    free(buffer);
+}
+
+void swapchain_init(struct ember_swapchain *swapchain, int drm_fd, struct gbm_surface *surface) {
+    swapchain->drm_fd = drm_fd;
+    swapchain->surface = surface;
+    swapchain->rendering = NULL;
+    swapchain->queued = NULL;
+    swapchain->scanout = NULL;
+
+    const char *env = getenv("EMBER_TRIPLE_BUFFER");
+    swapchain->triple_buffering = env && env[0] == '1';
+    printf("Swapchain: %s buffering\n", swapchain->triple_buffering ? "triple" : "double");
+}
+
+// Take the frame GL just finished (after eglSwapBuffers)
+struct ember_swapchain_buffer *swapchain_lock(struct ember_swapchain *swapchain) {
+    trace_begin("kms", "lock_front_buffer");
+    struct gbm_bo *bo = gbm_surface_lock_front_buffer(swapchain->surface);
+    trace_end("kms", "lock_front_buffer");
+    if (!bo) {
+        fprintf(stderr, "Failed to lock front buffer\n");
+        return NULL;
+    }
+
+    struct ember_swapchain_buffer *buffer = gbm_bo_get_user_data(bo);
+    if (!buffer) {
+        buffer = calloc(1, sizeof(struct ember_swapchain_buffer));
+        if (!buffer) {
+            gbm_surface_release_buffer(swapchain->surface, bo);
+            return NULL;
+        }
+        buffer->bo = bo;
+        buffer->drm_fd = swapchain->drm_fd;
+        buffer->fb_id = get_fb_for_bo(swapchain->drm_fd, bo);
+        if (!buffer->fb_id) {
+            free(buffer);
+            gbm_surface_release_buffer(swapchain->surface, bo);
+            return NULL;
+        }
+        gbm_bo_set_user_data(bo, buffer, buffer_destroy_notify);
+    }
+
+    buffer->state = EMBER_BUFFER_RENDERING;
+    swapchain->rendering = buffer;
+    return buffer;
+}
+
+static void swapchain_release(struct ember_swapchain *swapchain, struct ember_swapchain_buffer *buffer) {
+    buffer->state = EMBER_BUFFER_FREE;
+    gbm_surface_release_buffer(swapchain->surface, buffer->bo);
+}
+
+// The rendering buffer was handed to KMS
+void swapchain_queue(struct ember_swapchain *swapchain) {
+    swapchain->queued = swapchain->rendering;
+    swapchain->queued->state = EMBER_BUFFER_QUEUED;
+    swapchain->rendering = NULL;
+}
+
+// The rendering buffer never made it to KMS
+void swapchain_discard(struct ember_swapchain *swapchain) {
+    if (swapchain->rendering) {
+        swapchain_release(swapchain, swapchain->rendering);
+        swapchain->rendering = NULL;
+    }
+}
+
+// The queued buffer is on screen, the one it replaced goes back to gbm
+void swapchain_flip_done(struct ember_swapchain *swapchain) {
+    if (!swapchain->queued) {
+        return;
+    }
+    if (swapchain->scanout) {
+        swapchain_release(swapchain, swapchain->scanout);
+    }
+    swapchain->scanout = swapchain->queued;
+    swapchain->scanout->state = EMBER_BUFFER_SCANOUT;
+    swapchain->queued = NULL;
+}
+
+// Framebuffer of the newest frame given to KMS
+uint32_t swapchain_last_fb(struct ember_swapchain *swapchain) {
+    if (swapchain->queued) return swapchain->queued->fb_id;
+    if (swapchain->scanout) return swapchain->scanout->fb_id;
+    return 0;
+}
+
+// Whether GL may draw the next frame while a flip is still pending
+int swapchain_can_render_ahead(struct ember_swapchain *swapchain) {
+    return swapchain->triple_buffering && !swapchain->rendering &&
+           gbm_surface_has_free_buffers(swapchain->surface);
+}
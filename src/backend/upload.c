@@ -0,0 +1,139 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <GLES2/gl2.h>
+#include <GLES2/gl2ext.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "renderer.h"
+#include "trace.h"
+
+// SHM upload pipeline.
+// glTexSubImage2D from client memory makes the driver copy the pixels
+// before it returns, and waits first if the GPU still samples the texture,
+// so a big commit holds up everything behind it. Instead, the damaged boxes
+// are copied into a staging pixel buffer (one memcpy per row into mapped
+// memory) and the texture update is queued from there: the GPU does the
+// transfer in the background, overlapping with composition. The client's
+// buffer is done with as soon as the copy is, so it is released right away.
+//
+// Staging buffers are used in turn, a fence after each transfer says when
+// one can be written again without the driver stalling or setting aside a
+// fresh copy. When the next one is still busy, or the commit is small, the
+// upload goes straight from client memory as before.
+
+// Below this, mapping a buffer costs more than it saves
+#define EMBER_UPLOAD_MIN_BYTES (64 * 1024)
+
+void init_upload(struct ember_server *server, const char *gl_extensions) {
+    struct ember_upload *upload = &server->upload;
+    const char *version = (const char *)glGetString(GL_VERSION);
+    if (version && strncmp(version, "OpenGL ES 3", 11) == 0) {
+        // Pixel buffers are core in GLES3
+        upload->map_buffer_range = (PFNGLMAPBUFFERRANGEEXTPROC)eglGetProcAddress("glMapBufferRange");
+        upload->unmap_buffer = (PFNGLUNMAPBUFFEROESPROC)eglGetProcAddress("glUnmapBuffer");
+    } else if (has_extension(gl_extensions, "GL_NV_pixel_buffer_object") &&
+               has_extension(gl_extensions, "GL_EXT_map_buffer_range") &&
+               has_extension(gl_extensions, "GL_OES_mapbuffer")) {
+        upload->map_buffer_range = (PFNGLMAPBUFFERRANGEEXTPROC)eglGetProcAddress("glMapBufferRangeEXT");
+        upload->unmap_buffer = (PFNGLUNMAPBUFFEROESPROC)eglGetProcAddress("glUnmapBufferOES");
+    }
+    if (!upload->map_buffer_range || !upload->unmap_buffer || !server->egl_create_sync) {
+        upload->map_buffer_range = NULL;
+    }
+    for (int i = 0; i < EMBER_UPLOAD_STAGING; i++) {
+        upload->staging[i].fence = EGL_NO_SYNC_KHR;
+    }
+    printf("SHM uploads: %s\n", upload->map_buffer_range ? "staged through pixel buffers" : "from client memory");
+}
+
+// Whether the GPU is done with the last transfer out of this buffer
+static int staging_idle(struct ember_server *server, struct ember_upload_staging *staging) {
+    if (staging->fence == EGL_NO_SYNC_KHR) {
+        return 1;
+    }
+    EGLint status = server->egl_client_wait_sync(server->egl_display, staging->fence,
+                                                 EGL_SYNC_FLUSH_COMMANDS_BIT_KHR, 0);
+    if (status == EGL_TIMEOUT_EXPIRED_KHR) {
+        return 0;
+    }
+    server->egl_destroy_sync(server->egl_display, staging->fence);
+    staging->fence = EGL_NO_SYNC_KHR;
+    return 1;
+}
+
+// Copy the damaged boxes of the buffer into the next staging buffer and
+// queue their upload into the bound texture at dst_x/dst_y. Returns 0 when
+// that is not possible right now, the caller then uploads from client
+// memory.
+int upload_staged(struct ember_server *server, const uint8_t *data, int32_t stride, GLenum gl_format,
+                  GLenum gl_type, int bpp, int32_t dst_x, int32_t dst_y, pixman_region32_t *damage) {
+    struct ember_upload *upload = &server->upload;
+    if (!upload->map_buffer_range) {
+        return 0;
+    }
+    int n_boxes;
+    pixman_box32_t *boxes = pixman_region32_rectangles(damage, &n_boxes);
+    GLsizeiptr total = 0;
+    for (int i = 0; i < n_boxes; i++) {
+        total += (GLsizeiptr)(boxes[i].x2 - boxes[i].x1) * (boxes[i].y2 - boxes[i].y1) * bpp;
+    }
+    if (total < EMBER_UPLOAD_MIN_BYTES) {
+        return 0;
+    }
+    struct ember_upload_staging *staging = &upload->staging[upload->next];
+    if (!staging_idle(server, staging)) {
+        // The GPU is that far behind, do not wait for it
+        return 0;
+    }
+
+    trace_begin("render", "upload_staged");
+    if (!staging->buffer) {
+        glGenBuffers(1, &staging->buffer);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, staging->buffer);
+    if (staging->size < total) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER_NV, total, NULL, GL_STREAM_DRAW);
+        staging->size = total;
+    }
+    uint8_t *mapped = upload->map_buffer_range(GL_PIXEL_UNPACK_BUFFER_NV, 0, total,
+                                               GL_MAP_WRITE_BIT_EXT | GL_MAP_INVALIDATE_BUFFER_BIT_EXT);
+    if (!mapped) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+        trace_end("render", "upload_staged");
+        return 0;
+    }
+
+    // Boxes are packed one after the other, rows without padding
+    size_t offset = 0;
+    for (int i = 0; i < n_boxes; i++) {
+        size_t row = (size_t)(boxes[i].x2 - boxes[i].x1) * bpp;
+        for (int32_t y = boxes[i].y1; y < boxes[i].y2; y++) {
+            memcpy(mapped + offset, data + (size_t)y * stride + (size_t)boxes[i].x1 * bpp, row);
+            offset += row;
+        }
+    }
+    if (!upload->unmap_buffer(GL_PIXEL_UNPACK_BUFFER_NV)) {
+        // Contents got lost (rare, e.g. a mode switch), go the slow way
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+        trace_end("render", "upload_staged");
+        return 0;
+    }
+
+    // With a pixel buffer bound the data argument is an offset into it
+    offset = 0;
+    for (int i = 0; i < n_boxes; i++) {
+        int32_t width = boxes[i].x2 - boxes[i].x1, height = boxes[i].y2 - boxes[i].y1;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, dst_x + boxes[i].x1, dst_y + boxes[i].y1, width, height,
+                        gl_format, gl_type, (const void *)(uintptr_t)offset);
+        offset += (size_t)width * height * bpp;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER_NV, 0);
+    staging->fence = server->egl_create_sync(server->egl_display, EGL_SYNC_FENCE_KHR, NULL);
+    upload->next = (upload->next + 1) % EMBER_UPLOAD_STAGING;
+    server->stats.bytes_uploaded += total;
+    trace_end("render", "upload_staged");
+    return 1;
+}
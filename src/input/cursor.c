@@ -1,5 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+#include <gbm.h>
 #include <GLES2/gl2.h>
 #include <GLES2/gl2ext.h>
 #include "ember.h"
@@ -46,15 +49,141 @@ static const unsigned char cursor_data[16 * 16 * 4] = {
 };
 
 void init_cursor(struct ember_server *server) {
-    server->cursor.x = server->mode.hdisplay / 2.0;
-    server->cursor.y = server->mode.vdisplay / 2.0;
+    // Start in the middle of the first output
+    struct ember_output *output = wl_container_of(server->outputs.next, output, link);
+    server->cursor.x = output->x + output->mode.hdisplay / 2.0;
+    server->cursor.y = output->y + output->mode.vdisplay / 2.0;
     server->cursor.size = 16.0f;
     server->cursor.visible = 1;
     server->cursor.texture_id = 0;
 }
 
-void render_cursor(struct ember_server *server) {
+// The cursor image, created once and shown on the cursor plane of every
+// output that has one
+static struct gbm_bo *get_cursor_bo(struct ember_server *server) {
+    if (server->cursor.bo) {
+        return server->cursor.bo;
+    }
+
+    int scale = 2; // Matches the scale in get_cursor_quad
+    uint32_t scaled = 16 * scale;
+
+    uint64_t width = 64, height = 64;
+    drmGetCap(server->drm_fd, DRM_CAP_CURSOR_WIDTH, &width);
+    drmGetCap(server->drm_fd, DRM_CAP_CURSOR_HEIGHT, &height);
+    if (width < scaled || height < scaled) {
+        fprintf(stderr, "Cursor plane too small (%llux%llu), using GL cursor\n",
+                (unsigned long long)width, (unsigned long long)height);
+        return NULL;
+    }
+
+    struct gbm_bo *bo = gbm_bo_create(server->gbm_device, width, height, GBM_FORMAT_ARGB8888,
+                                      GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE);
+    if (!bo) {
+        fprintf(stderr, "Failed to create cursor BO, using GL cursor\n");
+        return NULL;
+    }
+
+    // RGBA bytes -> premultiplied ARGB8888, scaled up, rest transparent.
+    // gbm_bo_write copies the rows as they are, so they use the BO's pitch.
+    uint32_t pitch = gbm_bo_get_stride(bo) / sizeof(uint32_t);
+    uint32_t *pixels = calloc((size_t)pitch * height, sizeof(uint32_t));
+    if (!pixels) {
+        gbm_bo_destroy(bo);
+        return NULL;
+    }
+    for (uint32_t y = 0; y < scaled; y++) {
+        for (uint32_t x = 0; x < scaled; x++) {
+            const unsigned char *p = &cursor_data[((y / scale) * 16 + x / scale) * 4];
+            uint32_t a = p[3];
+            uint32_t r = p[0] * a / 255, g = p[1] * a / 255, b = p[2] * a / 255;
+            pixels[y * pitch + x] = a << 24 | r << 16 | g << 8 | b;
+        }
+    }
+    int ret = gbm_bo_write(bo, pixels, (size_t)pitch * height * sizeof(uint32_t));
+    free(pixels);
+    if (ret < 0) {
+        fprintf(stderr, "Failed to write cursor BO, using GL cursor\n");
+        gbm_bo_destroy(bo);
+        return NULL;
+    }
+
+    server->cursor.bo = bo;
+    return bo;
+}
+
+static void move_hw_cursor(struct ember_output *output, double x, double y) {
+    drmModeMoveCursor(output->server->drm_fd, output->crtc->crtc_id, (int)x - output->x, (int)y - output->y);
+}
+
+// Put the cursor on the output's DRM cursor plane. Needs an active CRTC, so
+// this runs after the first modeset. On failure the cursor keeps being drawn
+// with GL on this output.
+int init_hw_cursor(struct ember_output *output) {
+    struct ember_server *server = output->server;
+    struct gbm_bo *bo = get_cursor_bo(server);
+    if (!bo) {
+        return -1;
+    }
+
+    uint32_t width = gbm_bo_get_width(bo), height = gbm_bo_get_height(bo);
+    uint32_t handle = gbm_bo_get_handle(bo).u32;
+    uint32_t crtc_id = output->crtc->crtc_id;
+    if (drmModeSetCursor2(server->drm_fd, crtc_id, handle, width, height, 0, 0) &&
+        drmModeSetCursor(server->drm_fd, crtc_id, handle, width, height)) {
+        fprintf(stderr, "drmModeSetCursor failed: %m, using GL cursor\n");
+        return -1;
+    }
+    move_hw_cursor(output, server->cursor.x, server->cursor.y);
+
+    // Remove the GL-drawn cursor from the next composited frame
+    damage_cursor(server);
+
+    output->hw_cursor = 1;
+    printf("Using hardware cursor on CRTC %u (%ux%u)\n", crtc_id, width, height);
+    return 0;
+}
+
+// Move the cursor planes, one ioctl each and no composition. The plane
+// clips the cursor, so every output just gets the position in its own
+// coordinates. Safe on the input thread: outputs are fixed after
+// init_output.
+void move_hw_cursors(struct ember_server *server, double x, double y) {
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (output->hw_cursor) {
+            move_hw_cursor(output, x, y);
+        }
+    }
+}
+
+// Called after the cursor position changed
+void move_cursor(struct ember_server *server) {
+    // The input thread moves the planes as soon as it reads the motion
+    if (!server->input_thread) {
+        move_hw_cursors(server, server->cursor.x, server->cursor.y);
+    }
+    damage_cursor(server);
+}
+
+// Mark the area covered by the GL cursor at its current position as damaged
+// on the outputs that draw it
+void damage_cursor(struct ember_server *server) {
     if (!server->cursor.visible) return;
+    int32_t size = (int32_t)(server->cursor.size * 2.0f) + 1; // Matches the scale in get_cursor_quad
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (!output->hw_cursor) {
+            damage_output_box(output, (int32_t)server->cursor.x, (int32_t)server->cursor.y, size, size);
+        }
+    }
+}
+
+// Texture and output-space square of the GL cursor for the renderer's
+// batch. Returns 0 when this output does not draw the cursor.
+int get_cursor_quad(struct ember_output *output, GLuint *texture, float *x, float *y, float *size) {
+    struct ember_server *server = output->server;
+    if (!server->cursor.visible || output->hw_cursor) return 0;
 
     // Create cursor texture if not exists
     if (!server->cursor.texture_id) {
@@ -67,46 +196,9 @@ void render_cursor(struct ember_server *server) {
         printf("Cursor texture ID: %u\n", server->cursor.texture_id);
     }
 
-    glBindTexture(GL_TEXTURE_2D, server->cursor.texture_id);
-    
-    glUseProgram(server->shader_program);
-    glUniform1i(server->loc_tex, 0);
-
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_CULL_FACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    float cx = server->cursor.x;
-    float cy = server->cursor.y;
-    float cursor_size = server->cursor.size * 2.0f; // Scale up for visibility
-    
-    float screen_w = (float)server->mode.hdisplay;
-    float screen_h = (float)server->mode.vdisplay;
-    
-    float x0 = (cx / screen_w) * 2.0f - 1.0f;
-    float y0 = 1.0f - (cy / screen_h) * 2.0f;
-    float x1 = ((cx + cursor_size) / screen_w) * 2.0f - 1.0f;
-    float y1 = 1.0f - ((cy + cursor_size) / screen_h) * 2.0f;
-    
-    GLfloat cursor_verts[] = {
-        x0, y0, 0.0f,
-        x0, y1, 0.0f,
-        x1, y1, 0.0f,
-        x1, y0, 0.0f,
-    };
-    
-    GLfloat cursor_tex[] = {
-        0.0f, 0.0f,
-        0.0f, 1.0f,
-        1.0f, 1.0f,
-        1.0f, 0.0f
-    };
-    
-    glEnableVertexAttribArray(0);
-    glEnableVertexAttribArray(1);
-    
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, cursor_verts);
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, cursor_tex);
-    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+    *texture = server->cursor.texture_id;
+    *x = server->cursor.x - output->x;
+    *y = server->cursor.y - output->y;
+    *size = server->cursor.size * 2.0f; // Scale up for visibility
+    return 1;
 }
@@ -1,9 +1,12 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 #include <wayland-server.h>
 #include "ember.h"
+#include "backend.h"
 #include "input.h"
+#include "wayland/protocols.h"
 
 // Get current time in milliseconds (for Wayland timestamps)
 static uint32_t get_time_ms(void) {
@@ -12,94 +15,273 @@ static uint32_t get_time_ms(void) {
     return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-// Find the wl_keyboard resource for a given client
-static struct wl_resource *find_keyboard_for_client(struct ember_server *server, struct wl_client *client) {
-    struct wl_resource *res;
-    wl_resource_for_each(res, &server->keyboard_resources) {
-        if (wl_resource_get_client(res) == client) {
-            return res;
-        }
-    }
-    return NULL;
+// Timestamp of the input being dispatched: the libinput event time when
+// handling one, else now
+static uint32_t event_time_ms(struct ember_server *server) {
+    return server->input_device ? (uint32_t)(server->input_time_us / 1000) : get_time_ms();
 }
 
-// Find the wl_pointer resource for a given client
-static struct wl_resource *find_pointer_for_client(struct ember_server *server, struct wl_client *client) {
-    struct wl_resource *res;
-    wl_resource_for_each(res, &server->pointer_resources) {
-        if (wl_resource_get_client(res) == client) {
-            return res;
-        }
-    }
-    return NULL;
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// Seat objects of the client owning a surface: one lookup, then every
+// pointer or keyboard the client created gets the event
+static struct ember_seat_client *surface_seat_client(struct ember_surface *surface) {
+    if (!surface) return NULL;
+    return seat_client_from_client(wl_resource_get_client(surface->resource));
 }
 
 void dispatch_keyboard_key(struct ember_server *server, uint32_t key, uint32_t state) {
-    if (!server->focused_surface) return;
-    
-    struct wl_client *client = wl_resource_get_client(server->focused_surface->resource);
-    struct wl_resource *keyboard = find_keyboard_for_client(server, client);
-    if (!keyboard) return;
+    struct ember_seat_client *seat_client = surface_seat_client(server->focused_surface);
+    if (!seat_client || wl_list_empty(&seat_client->keyboards)) return;
     
     uint32_t serial = wl_display_next_serial(server->wl_display);
-    uint32_t time = get_time_ms();
+    uint32_t time = event_time_ms(server);
     
-    wl_keyboard_send_key(keyboard, serial, time, key, state);
+    struct wl_resource *keyboard;
+    wl_resource_for_each(keyboard, &seat_client->keyboards) {
+        wl_keyboard_send_key(keyboard, serial, time, key, state);
+    }
+    latency_input_sent(seat_client);
 }
 
-void dispatch_keyboard_modifiers(struct ember_server *server, uint32_t mods_depressed, 
-                                  uint32_t mods_latched, uint32_t mods_locked, uint32_t group) {
-    if (!server->focused_surface) return;
-    
-    struct wl_client *client = wl_resource_get_client(server->focused_surface->resource);
-    struct wl_resource *keyboard = find_keyboard_for_client(server, client);
-    if (!keyboard) return;
-    
+// Send the modifier state tracked in server->xkb_state to a client
+static void send_keyboard_modifiers(struct ember_server *server, struct ember_seat_client *seat_client) {
+    if (!server->xkb_state || wl_list_empty(&seat_client->keyboards)) return;
+
+    uint32_t depressed = xkb_state_serialize_mods(server->xkb_state, XKB_STATE_MODS_DEPRESSED);
+    uint32_t latched = xkb_state_serialize_mods(server->xkb_state, XKB_STATE_MODS_LATCHED);
+    uint32_t locked = xkb_state_serialize_mods(server->xkb_state, XKB_STATE_MODS_LOCKED);
+    uint32_t group = xkb_state_serialize_layout(server->xkb_state, XKB_STATE_LAYOUT_EFFECTIVE);
     uint32_t serial = wl_display_next_serial(server->wl_display);
-    wl_keyboard_send_modifiers(keyboard, serial, mods_depressed, mods_latched, mods_locked, group);
+    struct wl_resource *keyboard;
+    wl_resource_for_each(keyboard, &seat_client->keyboards) {
+        wl_keyboard_send_modifiers(keyboard, serial, depressed, latched, locked, group);
+    }
 }
 
-void dispatch_pointer_motion(struct ember_server *server, double x, double y) {
-    if (!server->focused_surface) return;
-    
-    struct wl_client *client = wl_resource_get_client(server->focused_surface->resource);
-    struct wl_resource *pointer = find_pointer_for_client(server, client);
-    if (!pointer) return;
-    
-    uint32_t time = get_time_ms();
+void dispatch_keyboard_modifiers(struct ember_server *server) {
+    struct ember_seat_client *seat_client = surface_seat_client(server->focused_surface);
+    if (!seat_client) return;
+    send_keyboard_modifiers(server, seat_client);
+}
+
+// wl_pointer objects of the client with pointer focus
+static struct wl_list *focused_pointers(struct ember_server *server) {
+    struct ember_seat_client *seat_client = surface_seat_client(server->pointer_surface);
+    if (!seat_client || wl_list_empty(&seat_client->pointers)) return NULL;
+    return &seat_client->pointers;
+}
+
+static void send_pointer_motion(struct ember_server *server, struct wl_resource *pointer, double x, double y) {
+    uint32_t time = event_time_ms(server);
     
     // Convert global coords to surface-local coords
-    // For now, surface is at (100, 100) - TODO: Use actual surface position
-    double sx = x - 100.0;
-    double sy = y - 100.0;
+    double sx = x - server->pointer_surface->pos_x;
+    double sy = y - server->pointer_surface->pos_y;
     
     wl_pointer_send_motion(pointer, time, wl_fixed_from_double(sx), wl_fixed_from_double(sy));
+    server->pointer_frame_pending = 1;
+    latency_input_sent(surface_seat_client(server->pointer_surface));
+}
+
+// Send the motion held back by coalescing, so it reaches the client before
+// whatever comes next
+static void flush_pointer_motion(struct ember_server *server) {
+    if (!server->pointer_motion_pending) return;
+    server->pointer_motion_pending = 0;
+    wl_event_source_timer_update(server->pointer_motion_timer, 0);
+
+    struct wl_list *pointers = focused_pointers(server);
+    if (!pointers) return;
+    struct wl_resource *pointer;
+    wl_resource_for_each(pointer, pointers) {
+        if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION) {
+            send_pointer_motion(server, pointer, server->cursor.x, server->cursor.y);
+        }
+    }
+}
+
+static int pointer_motion_timer_handler(void *data) {
+    struct ember_server *server = data;
+    flush_pointer_motion(server);
+    dispatch_pointer_frame(server);
+    return 0;
+}
+
+// Hold motion back until the next vblank of the output under the cursor.
+// Only the latest position is sent, one message per refresh however fast
+// the mouse reports.
+static void defer_pointer_motion(struct ember_server *server) {
+    if (server->pointer_motion_pending) return;
+    server->pointer_motion_pending = 1;
+
+    struct ember_output *output = output_at(server, server->cursor.x, server->cursor.y);
+    uint64_t now = monotonic_ns();
+    uint64_t next_vblank = output ? repaint_next_vblank_ns(output, now) : 0;
+    // Timing unknown: fall back to 60 Hz
+    uint64_t delay = next_vblank ? next_vblank - now : 16666667ull;
+    // The timer counts whole milliseconds and 0 disarms it
+    int ms = (int)(delay / 1000000ull);
+    wl_event_source_timer_update(server->pointer_motion_timer, ms > 0 ? ms : 1);
+}
+
+void dispatch_pointer_motion(struct ember_server *server, double x, double y) {
+    // Entering a surface already tells it where the pointer is
+    if (update_pointer_focus(server)) return;
+
+    struct wl_list *pointers = focused_pointers(server);
+    if (!pointers) return;
+
+    // Objects without wl_pointer.frame keep getting every motion
+    struct wl_resource *pointer;
+    wl_resource_for_each(pointer, pointers) {
+        if (server->pointer_coalesce && wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION) {
+            defer_pointer_motion(server);
+        } else {
+            send_pointer_motion(server, pointer, x, y);
+        }
+    }
 }
 
 void dispatch_pointer_button(struct ember_server *server, uint32_t button, uint32_t state) {
-    if (!server->focused_surface) return;
-    
-    struct wl_client *client = wl_resource_get_client(server->focused_surface->resource);
-    struct wl_resource *pointer = find_pointer_for_client(server, client);
-    if (!pointer) return;
+    flush_pointer_motion(server);
+    struct wl_list *pointers = focused_pointers(server);
+    if (!pointers) return;
     
     uint32_t serial = wl_display_next_serial(server->wl_display);
-    uint32_t time = get_time_ms();
+    uint32_t time = event_time_ms(server);
     
-    wl_pointer_send_button(pointer, serial, time, button, state);
+    struct wl_resource *pointer;
+    wl_resource_for_each(pointer, pointers) {
+        wl_pointer_send_button(pointer, serial, time, button, state);
+    }
+    server->pointer_frame_pending = 1;
+    latency_input_sent(surface_seat_client(server->pointer_surface));
+}
+
+// One axis of a scroll event; source is a WL_POINTER_AXIS_SOURCE_* value,
+// a value of 0 from a finger source tells the client scrolling stopped
+void dispatch_pointer_axis(struct ember_server *server, uint32_t source, uint32_t axis, double value) {
+    flush_pointer_motion(server);
+    struct wl_list *pointers = focused_pointers(server);
+    if (!pointers) return;
+
+    uint32_t time = event_time_ms(server);
+    struct wl_resource *pointer;
+    wl_resource_for_each(pointer, pointers) {
+        int version = wl_resource_get_version(pointer);
+        if (version >= WL_POINTER_AXIS_SOURCE_SINCE_VERSION) {
+            wl_pointer_send_axis_source(pointer, source);
+        }
+        if (value == 0.0 && source == WL_POINTER_AXIS_SOURCE_FINGER) {
+            if (version >= WL_POINTER_AXIS_STOP_SINCE_VERSION) {
+                wl_pointer_send_axis_stop(pointer, time, axis);
+            }
+        } else {
+            wl_pointer_send_axis(pointer, time, axis, wl_fixed_from_double(value));
+        }
+    }
+    server->pointer_frame_pending = 1;
+    latency_input_sent(surface_seat_client(server->pointer_surface));
+}
+
+// End the group of pointer events that belong together (one libinput
+// event), clients apply them at once
+void dispatch_pointer_frame(struct ember_server *server) {
+    if (!server->pointer_frame_pending) return;
+    server->pointer_frame_pending = 0;
+
+    struct wl_list *pointers = focused_pointers(server);
+    if (!pointers) return;
+    struct wl_resource *pointer;
+    wl_resource_for_each(pointer, pointers) {
+        if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION) {
+            wl_pointer_send_frame(pointer);
+        }
+    }
+}
+
+int init_pointer_dispatch(struct ember_server *server) {
+    server->pointer_coalesce = getenv("EMBER_COALESCE_MOTION") != NULL;
+    if (!server->pointer_coalesce) {
+        return 0;
+    }
+    server->pointer_motion_timer = wl_event_loop_add_timer(server->wl_event_loop, pointer_motion_timer_handler, server);
+    if (!server->pointer_motion_timer) {
+        fprintf(stderr, "Failed to create pointer motion timer, not coalescing motion\n");
+        server->pointer_coalesce = 0;
+        return 0;
+    }
+    printf("Coalescing pointer motion to one event per refresh\n");
+    return 0;
+}
+
+static void send_pointer_frame(struct ember_seat_client *seat_client) {
+    struct wl_resource *pointer;
+    wl_resource_for_each(pointer, &seat_client->pointers) {
+        if (wl_resource_get_version(pointer) >= WL_POINTER_FRAME_SINCE_VERSION) {
+            wl_pointer_send_frame(pointer);
+        }
+    }
+}
+
+// Give pointer focus to the surface under the cursor, sending leave and
+// enter when it changes. Returns 1 if it did.
+int update_pointer_focus(struct ember_server *server) {
+    double sx = 0, sy = 0;
+    struct ember_surface *surface = surface_at(server, server->cursor.x, server->cursor.y, &sx, &sy);
+    if (surface == server->pointer_surface) {
+        return 0;
+    }
+
+    // Everything meant for the old surface goes out before it leaves
+    flush_pointer_motion(server);
+    dispatch_pointer_frame(server);
+
+    struct ember_seat_client *old_client = surface_seat_client(server->pointer_surface);
+    if (old_client && !wl_list_empty(&old_client->pointers)) {
+        uint32_t serial = wl_display_next_serial(server->wl_display);
+        struct wl_resource *pointer;
+        wl_resource_for_each(pointer, &old_client->pointers) {
+            wl_pointer_send_leave(pointer, serial, server->pointer_surface->resource);
+        }
+        send_pointer_frame(old_client);
+    }
+
+    server->pointer_surface = surface;
+
+    struct ember_seat_client *seat_client = surface_seat_client(surface);
+    if (seat_client && !wl_list_empty(&seat_client->pointers)) {
+        uint32_t serial = wl_display_next_serial(server->wl_display);
+        struct wl_resource *pointer;
+        wl_resource_for_each(pointer, &seat_client->pointers) {
+            wl_pointer_send_enter(pointer, serial, surface->resource,
+                                  wl_fixed_from_double(sx), wl_fixed_from_double(sy));
+        }
+        send_pointer_frame(seat_client);
+    }
+    return 1;
 }
 
 void set_keyboard_focus(struct ember_server *server, struct ember_surface *surface) {
+    if (surface == server->focused_surface) {
+        return;
+    }
+
     struct wl_array keys;
     wl_array_init(&keys);
     
     // Send leave to old focused surface
-    if (server->focused_surface && server->focused_surface != surface) {
-        struct wl_client *old_client = wl_resource_get_client(server->focused_surface->resource);
-        struct wl_resource *old_keyboard = find_keyboard_for_client(server, old_client);
-        if (old_keyboard) {
-            uint32_t serial = wl_display_next_serial(server->wl_display);
-            wl_keyboard_send_leave(old_keyboard, serial, server->focused_surface->resource);
+    struct ember_seat_client *old_client = surface_seat_client(server->focused_surface);
+    if (old_client && !wl_list_empty(&old_client->keyboards)) {
+        uint32_t serial = wl_display_next_serial(server->wl_display);
+        struct wl_resource *keyboard;
+        wl_resource_for_each(keyboard, &old_client->keyboards) {
+            wl_keyboard_send_leave(keyboard, serial, server->focused_surface->resource);
         }
     }
     
@@ -107,36 +289,59 @@ void set_keyboard_focus(struct ember_server *server, struct ember_surface *surfa
     
     // Send enter to new focused surface
     if (surface) {
-        struct wl_client *client = wl_resource_get_client(surface->resource);
-        struct wl_resource *keyboard = find_keyboard_for_client(server, client);
-        if (keyboard) {
+        struct ember_seat_client *seat_client = surface_seat_client(surface);
+        if (seat_client && !wl_list_empty(&seat_client->keyboards)) {
             uint32_t serial = wl_display_next_serial(server->wl_display);
-            wl_keyboard_send_enter(keyboard, serial, surface->resource, &keys);
-        }
-        
-        // Also send pointer enter
-        struct wl_resource *pointer = find_pointer_for_client(server, client);
-        if (pointer) {
-            uint32_t serial = wl_display_next_serial(server->wl_display);
-            wl_pointer_send_enter(pointer, serial, surface->resource, 
-                                  wl_fixed_from_double(server->cursor.x - 100.0),
-                                  wl_fixed_from_double(server->cursor.y - 100.0));
+            struct wl_resource *keyboard;
+            wl_resource_for_each(keyboard, &seat_client->keyboards) {
+                wl_keyboard_send_enter(keyboard, serial, surface->resource, &keys);
+            }
+            // Enter must be followed by the current modifiers
+            send_keyboard_modifiers(server, seat_client);
         }
     }
     
     wl_array_release(&keys);
 }
 
-// Auto-focus the first surface (simple strategy)
+// Without keyboard focus, keys go to the surface under the pointer, else
+// to the topmost mapped surface
 void update_focus(struct ember_server *server) {
-    if (wl_list_empty(&server->surfaces)) {
-        server->focused_surface = NULL;
+    if (server->focused_surface) {
         return;
     }
-    
-    // Focus the first surface if nothing is focused
-    if (!server->focused_surface) {
-        struct ember_surface *first = wl_container_of(server->surfaces.next, first, link);
-        set_keyboard_focus(server, first);
+    if (server->pointer_surface) {
+        set_keyboard_focus(server, server->pointer_surface);
+        return;
+    }
+    struct ember_surface *surface;
+    wl_list_for_each(surface, &server->surfaces, link) {
+        if (surface->width > 0 && surface->height > 0) {
+            set_keyboard_focus(server, surface);
+            return;
+        }
+    }
+}
+
+// A surface moved, resized or changed its input region
+void input_surface_changed(struct ember_surface *surface) {
+    hit_grid_update_surface(surface);
+    update_pointer_focus(surface->server);
+}
+
+// Called before a surface is freed: drop it from the grid and from focus,
+// the pointer then enters whatever is below it
+void input_surface_destroyed(struct ember_surface *surface) {
+    struct ember_server *server = surface->server;
+    hit_grid_remove_surface(surface);
+    if (server->focused_surface == surface) {
+        server->focused_surface = NULL;
+    }
+    if (server->pointer_surface == surface) {
+        // The resource is going away, no leave
+        server->pointer_surface = NULL;
+        server->pointer_motion_pending = 0;
+        server->pointer_frame_pending = 0;
+        update_pointer_focus(server);
     }
 }
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "input.h"
+
+// Spatial index for pointer hit-testing.
+// The layout is cut into square cells of 1 << EMBER_HIT_CELL_SHIFT pixels
+// and every cell lists the surfaces overlapping it. A lookup only looks at
+// the few surfaces in the cell under the pointer, however many windows are
+// open. Surfaces are re-filed on commit when they move or resize.
+
+static struct wl_array *grid_cell(struct ember_hit_grid *grid, int32_t col, int32_t row) {
+    return &grid->cells[row * grid->cols + col];
+}
+
+static void cell_remove(struct wl_array *cell, struct ember_surface *surface) {
+    struct ember_surface **entries = cell->data;
+    size_t n = cell->size / sizeof(*entries);
+    for (size_t i = 0; i < n; i++) {
+        if (entries[i] == surface) {
+            // Order within a cell does not matter, stack_order decides
+            entries[i] = entries[n - 1];
+            cell->size -= sizeof(*entries);
+            return;
+        }
+    }
+}
+
+void hit_grid_remove_surface(struct ember_surface *surface) {
+    struct ember_hit_grid *grid = &surface->server->hit_grid;
+    for (int32_t row = surface->grid_y0; row < surface->grid_y1; row++) {
+        for (int32_t col = surface->grid_x0; col < surface->grid_x1; col++) {
+            cell_remove(grid_cell(grid, col, row), surface);
+        }
+    }
+    surface->grid_x0 = surface->grid_x1 = 0;
+    surface->grid_y0 = surface->grid_y1 = 0;
+}
+
+static int32_t clamp_cell(int32_t value, int32_t max) {
+    return value < 0 ? 0 : value > max ? max : value;
+}
+
+// File the surface under the cells its box covers now
+void hit_grid_update_surface(struct ember_surface *surface) {
+    struct ember_hit_grid *grid = &surface->server->hit_grid;
+    int32_t x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    if (grid->cells && surface->width > 0 && surface->height > 0) {
+        x0 = clamp_cell(surface->pos_x >> EMBER_HIT_CELL_SHIFT, grid->cols);
+        y0 = clamp_cell(surface->pos_y >> EMBER_HIT_CELL_SHIFT, grid->rows);
+        x1 = clamp_cell(((surface->pos_x + surface->width - 1) >> EMBER_HIT_CELL_SHIFT) + 1, grid->cols);
+        y1 = clamp_cell(((surface->pos_y + surface->height - 1) >> EMBER_HIT_CELL_SHIFT) + 1, grid->rows);
+    }
+    if (x0 == surface->grid_x0 && y0 == surface->grid_y0 && x1 == surface->grid_x1 && y1 == surface->grid_y1) {
+        return;
+    }
+
+    hit_grid_remove_surface(surface);
+    for (int32_t row = y0; row < y1; row++) {
+        for (int32_t col = x0; col < x1; col++) {
+            struct ember_surface **entry = wl_array_add(grid_cell(grid, col, row), sizeof(*entry));
+            if (entry) {
+                *entry = surface;
+            }
+        }
+    }
+    surface->grid_x0 = x0;
+    surface->grid_y0 = y0;
+    surface->grid_x1 = x1;
+    surface->grid_y1 = y1;
+}
+
+// Topmost surface whose input region contains the layout point x, y.
+// sx, sy are set to the point in surface coordinates.
+struct ember_surface *surface_at(struct ember_server *server, double x, double y, double *sx, double *sy) {
+    struct ember_hit_grid *grid = &server->hit_grid;
+    if (!grid->cells || x < 0 || y < 0) {
+        return NULL;
+    }
+    int32_t col = (int32_t)x >> EMBER_HIT_CELL_SHIFT;
+    int32_t row = (int32_t)y >> EMBER_HIT_CELL_SHIFT;
+    if (col >= grid->cols || row >= grid->rows) {
+        return NULL;
+    }
+
+    struct ember_surface *found = NULL;
+    struct ember_surface **entry;
+    wl_array_for_each(entry, grid_cell(grid, col, row)) {
+        struct ember_surface *surface = *entry;
+        if (found && surface->stack_order < found->stack_order) {
+            continue;
+        }
+        double lx = x - surface->pos_x;
+        double ly = y - surface->pos_y;
+        if (lx < 0 || ly < 0 || lx >= surface->width || ly >= surface->height) {
+            continue;
+        }
+        if (!pixman_region32_contains_point(&surface->current.input, (int)floor(lx), (int)floor(ly), NULL)) {
+            continue;
+        }
+        found = surface;
+        *sx = lx;
+        *sy = ly;
+    }
+    return found;
+}
+
+int init_hit_grid(struct ember_server *server) {
+    struct ember_hit_grid *grid = &server->hit_grid;
+    int32_t cell = 1 << EMBER_HIT_CELL_SHIFT;
+    grid->cols = (server->layout_width + cell - 1) / cell;
+    grid->rows = (server->layout_height + cell - 1) / cell;
+    grid->cells = calloc((size_t)grid->cols * grid->rows, sizeof(struct wl_array));
+    if (!grid->cells) {
+        fprintf(stderr, "Failed to allocate %dx%d hit-test grid\n", grid->cols, grid->rows);
+        return -1;
+    }
+    for (int32_t i = 0; i < grid->cols * grid->rows; i++) {
+        wl_array_init(&grid->cells[i]);
+    }
+
+    // Surfaces created before the grid existed
+    struct ember_surface *surface;
+    wl_list_for_each(surface, &server->surfaces, link) {
+        hit_grid_update_surface(surface);
+    }
+    return 0;
+}
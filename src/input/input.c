@@ -10,6 +10,8 @@
 #include <libudev.h>
 #include "ember.h"
 #include "input.h"
+#include "renderer.h"
+#include "trace.h"
 
 // Open/Close restricted devices (required by libinput)
 static int open_restricted(const char *path, int flags, void *user_data) {
@@ -28,80 +30,202 @@ static const struct libinput_interface interface_ops = {
     .close_restricted = close_restricted,
 };
 
-static void handle_keyboard_key(struct ember_server *server, struct libinput_event_keyboard *k) {
-    uint32_t key = libinput_event_keyboard_get_key(k);
-    uint32_t state = libinput_event_keyboard_get_key_state(k) == LIBINPUT_KEY_STATE_PRESSED ? 
-                     WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED;
-    
+static void handle_keyboard_key(struct ember_server *server, uint32_t key, uint32_t state) {
     // ESC to quit compositor
     if (state == WL_KEYBOARD_KEY_STATE_PRESSED && key == KEY_ESC) {
         wl_display_terminate(server->wl_display);
         return;
     }
+
+    // Logo+F12 shows or hides the performance HUD. The client never saw
+    // the press, so it does not get the release either.
+    if (state == WL_KEYBOARD_KEY_STATE_PRESSED && key == KEY_F12 && server->xkb_state &&
+        xkb_state_mod_name_is_active(server->xkb_state, XKB_MOD_NAME_LOGO, XKB_STATE_MODS_EFFECTIVE) > 0) {
+        server->hud.key_held = 1;
+        hud_toggle(server);
+        return;
+    }
+    if (state == WL_KEYBOARD_KEY_STATE_RELEASED && key == KEY_F12 && server->hud.key_held) {
+        server->hud.key_held = 0;
+        return;
+    }
     
     // Auto-focus first surface if needed
     update_focus(server);
     
     // Dispatch to focused client
     dispatch_keyboard_key(server, key, state);
+
+    // Modifiers are worked out once here (evdev codes are xkb codes - 8),
+    // clients only hear about them when they change
+    if (server->xkb_state) {
+        enum xkb_key_direction direction = state == WL_KEYBOARD_KEY_STATE_PRESSED ? XKB_KEY_DOWN : XKB_KEY_UP;
+        enum xkb_state_component changed = xkb_state_update_key(server->xkb_state, key + 8, direction);
+        if (changed & (XKB_STATE_MODS_DEPRESSED | XKB_STATE_MODS_LATCHED | XKB_STATE_MODS_LOCKED |
+                       XKB_STATE_LAYOUT_EFFECTIVE)) {
+            dispatch_keyboard_modifiers(server);
+        }
+    }
 }
 
-static void handle_pointer_motion(struct ember_server *server, struct libinput_event_pointer *p) {
-    double dx = libinput_event_pointer_get_dx(p);
-    double dy = libinput_event_pointer_get_dy(p);
-    
-    // Update cursor position (clamped to screen bounds)
-    server->cursor.x += dx;
-    server->cursor.y += dy;
-    
-    // Clamp to screen bounds
-    if (server->cursor.x < 0) server->cursor.x = 0;
-    if (server->cursor.y < 0) server->cursor.y = 0;
-    if (server->cursor.x > server->mode.hdisplay) server->cursor.x = server->mode.hdisplay;
-    if (server->cursor.y > server->mode.vdisplay) server->cursor.y = server->mode.vdisplay;
+// Keep a cursor position on an output. Outputs sit side by side, so the
+// column the cursor is in decides how far down it may go. Only reads the
+// layout, which is fixed after init_output, so the input thread uses it too.
+static void clamp_cursor(struct ember_server *server, double *x, double *y) {
+    if (*x < 0) *x = 0;
+    if (*y < 0) *y = 0;
+    if (*x > server->layout_width - 1) *x = server->layout_width - 1;
+
+    struct ember_output *output;
+    wl_list_for_each(output, &server->outputs, link) {
+        if (*x >= output->x && *x < output->x + output->mode.hdisplay) {
+            if (*y > output->y + output->mode.vdisplay - 1) {
+                *y = output->y + output->mode.vdisplay - 1;
+            }
+            break;
+        }
+    }
+}
+
+static void handle_pointer_motion(struct ember_server *server, double x, double y) {
+    // Old cursor area needs repainting
+    damage_cursor(server);
+
+    server->cursor.x = x;
+    server->cursor.y = y;
+    move_cursor(server);
     
     // Dispatch to focused client
     dispatch_pointer_motion(server, server->cursor.x, server->cursor.y);
 }
 
-static void handle_pointer_button(struct ember_server *server, struct libinput_event_pointer *p) {
-    uint32_t button = libinput_event_pointer_get_button(p);
-    uint32_t state = libinput_event_pointer_get_button_state(p) == LIBINPUT_BUTTON_STATE_PRESSED ?
-                     WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED;
-    
-    // Auto-focus on click
-    update_focus(server);
+static void handle_pointer_button(struct ember_server *server, uint32_t button, uint32_t state) {
+    // Click to focus
+    if (state == WL_POINTER_BUTTON_STATE_PRESSED && server->pointer_surface) {
+        set_keyboard_focus(server, server->pointer_surface);
+    }
     
     dispatch_pointer_button(server, button, state);
 }
 
+static uint32_t axis_source_to_wl(enum libinput_pointer_axis_source source) {
+    switch (source) {
+    case LIBINPUT_POINTER_AXIS_SOURCE_FINGER:     return WL_POINTER_AXIS_SOURCE_FINGER;
+    case LIBINPUT_POINTER_AXIS_SOURCE_CONTINUOUS: return WL_POINTER_AXIS_SOURCE_CONTINUOUS;
+    default:                                      return WL_POINTER_AXIS_SOURCE_WHEEL;
+    }
+}
+
+static void handle_pointer_axis(struct ember_server *server, const struct ember_input_record *record) {
+    if (record->axis.has_vertical) {
+        dispatch_pointer_axis(server, record->axis.source, WL_POINTER_AXIS_VERTICAL_SCROLL, record->axis.vertical);
+    }
+    if (record->axis.has_horizontal) {
+        dispatch_pointer_axis(server, record->axis.source, WL_POINTER_AXIS_HORIZONTAL_SCROLL, record->axis.horizontal);
+    }
+}
+
+// Boil a libinput event down to a record, on whichever thread reads
+// libinput. Pointer motion (acceleration is libinput's) moves and clamps
+// *cursor_x, *cursor_y, the cursor position as that thread sees it.
+// Returns 0 for events nothing acts on.
+int input_record_from_event(struct ember_server *server, struct libinput_event *event,
+                            double *cursor_x, double *cursor_y, struct ember_input_record *record) {
+    struct libinput_event_pointer *p = libinput_event_get_pointer_event(event);
+    record->type = libinput_event_get_type(event);
+    record->device = libinput_device_get_user_data(libinput_event_get_device(event));
+    record->time_us = 0;
+
+    switch (record->type) {
+    case LIBINPUT_EVENT_DEVICE_ADDED:
+        record->device = latency_device_create(libinput_event_get_device(event));
+        return 1;
+    case LIBINPUT_EVENT_KEYBOARD_KEY: {
+        struct libinput_event_keyboard *k = libinput_event_get_keyboard_event(event);
+        record->time_us = libinput_event_keyboard_get_time_usec(k);
+        record->key.key = libinput_event_keyboard_get_key(k);
+        record->key.state = libinput_event_keyboard_get_key_state(k) == LIBINPUT_KEY_STATE_PRESSED ?
+                            WL_KEYBOARD_KEY_STATE_PRESSED : WL_KEYBOARD_KEY_STATE_RELEASED;
+        return 1;
+    }
+    case LIBINPUT_EVENT_POINTER_MOTION:
+        *cursor_x += libinput_event_pointer_get_dx(p);
+        *cursor_y += libinput_event_pointer_get_dy(p);
+        break;
+    case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+        // Absolute devices (tablets, VMs) span the whole layout
+        *cursor_x = libinput_event_pointer_get_absolute_x_transformed(p, server->layout_width);
+        *cursor_y = libinput_event_pointer_get_absolute_y_transformed(p, server->layout_height);
+        break;
+    case LIBINPUT_EVENT_POINTER_BUTTON:
+        record->button.button = libinput_event_pointer_get_button(p);
+        record->button.state = libinput_event_pointer_get_button_state(p) == LIBINPUT_BUTTON_STATE_PRESSED ?
+                               WL_POINTER_BUTTON_STATE_PRESSED : WL_POINTER_BUTTON_STATE_RELEASED;
+        break;
+    case LIBINPUT_EVENT_POINTER_AXIS:
+        record->axis.source = axis_source_to_wl(libinput_event_pointer_get_axis_source(p));
+        record->axis.has_vertical = libinput_event_pointer_has_axis(p, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL);
+        record->axis.has_horizontal = libinput_event_pointer_has_axis(p, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL);
+        record->axis.vertical = record->axis.has_vertical ?
+            libinput_event_pointer_get_axis_value(p, LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL) : 0.0;
+        record->axis.horizontal = record->axis.has_horizontal ?
+            libinput_event_pointer_get_axis_value(p, LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL) : 0.0;
+        break;
+    default:
+        return 0;
+    }
+
+    record->time_us = libinput_event_pointer_get_time_usec(p);
+    if (record->type == LIBINPUT_EVENT_POINTER_MOTION || record->type == LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE) {
+        clamp_cursor(server, cursor_x, cursor_y);
+        record->motion.x = *cursor_x;
+        record->motion.y = *cursor_y;
+    }
+    return 1;
+}
+
+// Act on one record, on the main thread.
+// Each libinput pointer event is one logical frame for clients: everything
+// it produced (both scroll axes, say) is closed with one wl_pointer.frame
+void input_handle_record(struct ember_server *server, const struct ember_input_record *record) {
+    // Followed to the screen by the latency tracking
+    server->input_device = record->time_us ? record->device : NULL;
+    server->input_time_us = record->time_us;
+
+    switch (record->type) {
+    case LIBINPUT_EVENT_DEVICE_ADDED:
+        latency_device_added(server, record->device);
+        break;
+    case LIBINPUT_EVENT_KEYBOARD_KEY:
+        handle_keyboard_key(server, record->key.key, record->key.state);
+        break;
+    case LIBINPUT_EVENT_POINTER_MOTION:
+    case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+        handle_pointer_motion(server, record->motion.x, record->motion.y);
+        break;
+    case LIBINPUT_EVENT_POINTER_BUTTON:
+        handle_pointer_button(server, record->button.button, record->button.state);
+        break;
+    case LIBINPUT_EVENT_POINTER_AXIS:
+        handle_pointer_axis(server, record);
+        break;
+    default:
+        break;
+    }
+    dispatch_pointer_frame(server);
+    server->input_device = NULL;
+}
+
 // Internal processing
 static void process_events(struct ember_server *server) {
     struct libinput_event *ev;
     while ((ev = libinput_get_event(server->libinput))) {
-        enum libinput_event_type type = libinput_event_get_type(ev);
-        
-        switch (type) {
-        case LIBINPUT_EVENT_KEYBOARD_KEY:
-            handle_keyboard_key(server, libinput_event_get_keyboard_event(ev));
-            break;
-        case LIBINPUT_EVENT_POINTER_MOTION:
-            handle_pointer_motion(server, libinput_event_get_pointer_event(ev));
-            break;
-        case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE: {
-            struct libinput_event_pointer *p = libinput_event_get_pointer_event(ev);
-            server->cursor.x = libinput_event_pointer_get_absolute_x_transformed(p, server->mode.hdisplay);
-            server->cursor.y = libinput_event_pointer_get_absolute_y_transformed(p, server->mode.vdisplay);
-            dispatch_pointer_motion(server, server->cursor.x, server->cursor.y);
-            break;
+        trace_input_flow();
+        double x = server->cursor.x, y = server->cursor.y;
+        struct ember_input_record record;
+        if (input_record_from_event(server, ev, &x, &y, &record)) {
+            input_handle_record(server, &record);
         }
-        case LIBINPUT_EVENT_POINTER_BUTTON:
-            handle_pointer_button(server, libinput_event_get_pointer_event(ev));
-            break;
-        default:
-            break;
-        }
-        
         libinput_event_destroy(ev);
     }
 }
@@ -110,15 +234,21 @@ static void process_events(struct ember_server *server) {
 int on_input_readable(int fd, uint32_t mask, void *data) {
     (void)fd; (void)mask;
     struct ember_server *server = data;
+    trace_begin("input", "on_input_readable");
     if (libinput_dispatch(server->libinput) != 0) {
         fprintf(stderr, "libinput dispatch failed\n");
+        trace_end("input", "on_input_readable");
         return 0;
     }
     process_events(server);
+    trace_end("input", "on_input_readable");
     return 1;
 }
 
 int init_input(struct ember_server *server) {
+    // Devices are announced by the first dispatch, after assigning the seat
+    init_latency(server);
+
     server->udev = udev_new();
     if (!server->udev) {
         fprintf(stderr, "Failed to initialize udev\n");
@@ -136,11 +266,24 @@ int init_input(struct ember_server *server) {
         return -1;
     }
     
-    // Add libinput fd to Wayland event loop
-    wl_event_loop_add_fd(server->wl_event_loop, libinput_get_fd(server->libinput), WL_EVENT_READABLE, on_input_readable, server);
-    
     // Initialize Cursor state
     init_cursor(server);
+    if (init_hit_grid(server) < 0) {
+        return -1;
+    }
+    if (init_pointer_dispatch(server) < 0) {
+        return -1;
+    }
+
+    // Read libinput on its own thread, or else on the Wayland event loop
+    if (getenv("EMBER_INPUT_THREAD")) {
+        if (init_input_thread(server) < 0) {
+            return -1;
+        }
+    } else {
+        wl_event_loop_add_fd(server->wl_event_loop, libinput_get_fd(server->libinput), WL_EVENT_READABLE,
+                             on_input_readable, server);
+    }
 
     printf("Initialized Input (libinput)\n");
     return 0;
@@ -0,0 +1,230 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <libinput.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "input.h"
+#include "trace.h"
+
+// Input thread (EMBER_INPUT_THREAD).
+// libinput is read on a thread of its own instead of the Wayland event
+// loop, so a slow client request or a long render_frame does not hold up
+// input. The thread turns events into records (input_record_from_event:
+// acceleration is libinput's, clamping is done there) and moves the cursor
+// planes right away, so with a hardware cursor the pointer keeps moving
+// while the main thread is busy. Records go through a single-producer,
+// single-consumer ring; an eventfd wakes the main loop, which acts on them
+// in order (input_handle_record).
+//
+// After init_input_thread the libinput context belongs to the thread. The
+// main thread follows the cursor position through the motion records.
+
+// Power of two. When full the thread waits for the main thread rather
+// than dropping keys.
+#define EMBER_INPUT_RING_SIZE 1024
+
+struct ember_input_thread {
+    struct ember_server *server;
+    pthread_t thread;
+    int wake_fd; // eventfd: records are waiting, read by the main loop
+    int quit_fd; // eventfd: stop the thread
+    struct wl_event_source *wake_source;
+    double cursor_x, cursor_y; // The thread's cursor, ahead of server->cursor
+
+    // Indices only grow, the slot is the index modulo the ring size
+    atomic_size_t head; // Next record written, stored by the thread only
+    atomic_size_t tail; // Next record read, stored by the main thread only
+    struct ember_input_record records[EMBER_INPUT_RING_SIZE];
+};
+
+static int ring_push(struct ember_input_thread *t, const struct ember_input_record *record) {
+    size_t head = atomic_load_explicit(&t->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&t->tail, memory_order_acquire);
+    if (head - tail == EMBER_INPUT_RING_SIZE) {
+        return 0;
+    }
+    t->records[head % EMBER_INPUT_RING_SIZE] = *record;
+    atomic_store_explicit(&t->head, head + 1, memory_order_release);
+    return 1;
+}
+
+static int ring_pop(struct ember_input_thread *t, struct ember_input_record *record) {
+    size_t tail = atomic_load_explicit(&t->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&t->head, memory_order_acquire);
+    if (tail == head) {
+        return 0;
+    }
+    *record = t->records[tail % EMBER_INPUT_RING_SIZE];
+    atomic_store_explicit(&t->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+static void wake_main_loop(struct ember_input_thread *t) {
+    uint64_t one = 1;
+    if (write(t->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to wake the main loop: %m\n");
+    }
+}
+
+// Waits up to timeout_ms for the main thread to ask the input thread to stop
+static int quit_requested(struct ember_input_thread *t, int timeout_ms) {
+    struct pollfd pfd = { .fd = t->quit_fd, .events = POLLIN };
+    return poll(&pfd, 1, timeout_ms) > 0;
+}
+
+// Returns 0 when asked to stop while the ring was full
+static int read_events(struct ember_input_thread *t) {
+    struct ember_server *server = t->server;
+    if (libinput_dispatch(server->libinput) != 0) {
+        fprintf(stderr, "libinput dispatch failed\n");
+        return 1;
+    }
+
+    int pushed = 0;
+    struct libinput_event *ev;
+    while ((ev = libinput_get_event(server->libinput))) {
+        trace_input_flow();
+        struct ember_input_record record;
+        int keep = input_record_from_event(server, ev, &t->cursor_x, &t->cursor_y, &record);
+        libinput_event_destroy(ev);
+        if (!keep) {
+            continue;
+        }
+        if (record.type == LIBINPUT_EVENT_POINTER_MOTION || record.type == LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE) {
+            move_hw_cursors(server, t->cursor_x, t->cursor_y);
+        }
+        while (!ring_push(t, &record)) {
+            wake_main_loop(t);
+            if (quit_requested(t, 1)) {
+                return 0;
+            }
+        }
+        pushed = 1;
+    }
+    if (pushed) {
+        wake_main_loop(t);
+    }
+    return 1;
+}
+
+static void *input_thread_main(void *data) {
+    struct ember_input_thread *t = data;
+    trace_thread_name("input");
+
+    struct pollfd fds[2] = {
+        { .fd = libinput_get_fd(t->server->libinput), .events = POLLIN },
+        { .fd = t->quit_fd, .events = POLLIN },
+    };
+    for (;;) {
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Input thread poll failed: %m\n");
+            break;
+        }
+        if (fds[1].revents) {
+            break;
+        }
+        trace_begin("input", "read_events");
+        int running = read_events(t);
+        trace_end("input", "read_events");
+        if (!running) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+// Called by the Wayland event loop when the input thread pushed records
+static int on_input_records(int fd, uint32_t mask, void *data) {
+    (void)mask;
+    struct ember_server *server = data;
+    struct ember_input_thread *t = server->input_thread;
+
+    // Clear the wakeup before draining, a push after this wakes us again
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+        fprintf(stderr, "Failed to read input wakeup: %m\n");
+    }
+
+    trace_begin("input", "on_input_records");
+    struct ember_input_record record;
+    while (ring_pop(t, &record)) {
+        input_handle_record(server, &record);
+    }
+    trace_end("input", "on_input_records");
+    return 1;
+}
+
+static void destroy_input_thread(struct ember_input_thread *t) {
+    if (t->wake_source) wl_event_source_remove(t->wake_source);
+    if (t->wake_fd >= 0) close(t->wake_fd);
+    if (t->quit_fd >= 0) close(t->quit_fd);
+    free(t);
+}
+
+// Start reading libinput on the input thread. Needs the cursor set up, the
+// thread starts from its position.
+int init_input_thread(struct ember_server *server) {
+    struct ember_input_thread *t = calloc(1, sizeof(struct ember_input_thread));
+    if (!t) {
+        return -1;
+    }
+    t->server = server;
+    t->cursor_x = server->cursor.x;
+    t->cursor_y = server->cursor.y;
+    atomic_init(&t->head, 0);
+    atomic_init(&t->tail, 0);
+
+    t->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    t->quit_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (t->wake_fd < 0 || t->quit_fd < 0) {
+        fprintf(stderr, "Failed to create input thread eventfds: %m\n");
+        destroy_input_thread(t);
+        return -1;
+    }
+    t->wake_source = wl_event_loop_add_fd(server->wl_event_loop, t->wake_fd, WL_EVENT_READABLE,
+                                          on_input_records, server);
+    if (!t->wake_source) {
+        destroy_input_thread(t);
+        return -1;
+    }
+
+    // Set before the thread runs: move_cursor leaves the planes to it
+    server->input_thread = t;
+    int ret = pthread_create(&t->thread, NULL, input_thread_main, t);
+    if (ret != 0) {
+        fprintf(stderr, "Failed to start the input thread: %d\n", ret);
+        server->input_thread = NULL;
+        destroy_input_thread(t);
+        return -1;
+    }
+
+    printf("Reading input on its own thread\n");
+    return 0;
+}
+
+// Stop the input thread, if any. Records it had not handed over are dropped.
+void input_thread_finish(struct ember_server *server) {
+    struct ember_input_thread *t = server->input_thread;
+    if (!t) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(t->quit_fd, &one, sizeof(one)) < 0) {
+        fprintf(stderr, "Failed to stop the input thread: %m\n");
+        return;
+    }
+    pthread_join(t->thread, NULL);
+    server->input_thread = NULL;
+    destroy_input_thread(t);
+}
@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <libinput.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "input.h"
+#include "wayland/protocols.h"
+
+// Input-to-photon latency.
+// Every input event delivered to a client is followed to the screen:
+// 1. Every input record carries the device and libinput timestamp of its
+//    event, the dispatch functions file it with the client they send it to
+//    (latency_input_sent).
+// 2. The client's next commit answers it (latency_surface_committed).
+// 3. The frame showing that commit takes it along like a frame callback
+//    (latency_collect), and its page flip timestamp closes it
+//    (latency_frame_presented).
+// Steps 2 and 3 go into two histograms per device, event -> commit (the
+// client) and event -> flip (everything). SIGUSR1 prints p50/p99/max of
+// each, so every scheduling change can be checked against real numbers.
+
+// Input a client got but has not answered yet, more are not tracked
+#define EMBER_LATENCY_MAX_PENDING 32
+
+static uint64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static void histogram_add(struct ember_latency_histogram *histogram, uint64_t us) {
+    uint64_t bucket = us / EMBER_LATENCY_BUCKET_US;
+    if (bucket >= EMBER_LATENCY_BUCKETS) {
+        bucket = EMBER_LATENCY_BUCKETS - 1;
+    }
+    histogram->buckets[bucket]++;
+    histogram->count++;
+    if (us > histogram->max_us) {
+        histogram->max_us = us;
+    }
+}
+
+// Upper edge of the bucket holding the given fraction of samples
+static double histogram_percentile_ms(const struct ember_latency_histogram *histogram, double fraction) {
+    uint64_t rank = (uint64_t)(histogram->count * fraction);
+    uint64_t seen = 0;
+    for (int i = 0; i < EMBER_LATENCY_BUCKETS; i++) {
+        seen += histogram->buckets[i];
+        if (seen > rank) {
+            return (i + 1) * EMBER_LATENCY_BUCKET_US / 1000.0;
+        }
+    }
+    return histogram->max_us / 1000.0;
+}
+
+static void print_histogram(const char *label, const struct ember_latency_histogram *histogram) {
+    if (!histogram->count) {
+        printf("  %-14s no samples\n", label);
+        return;
+    }
+    printf("  %-14s %8llu samples  p50 %6.1f ms  p99 %6.1f ms  max %6.1f ms\n", label,
+           (unsigned long long)histogram->count, histogram_percentile_ms(histogram, 0.5),
+           histogram_percentile_ms(histogram, 0.99), histogram->max_us / 1000.0);
+}
+
+void latency_dump(struct ember_server *server) {
+    printf("Input latency:\n");
+    struct ember_input_device *device;
+    wl_list_for_each(device, &server->input_devices, link) {
+        if (!device->to_commit.count && !device->to_photon.count) {
+            continue;
+        }
+        printf(" %s\n", device->name);
+        print_histogram("to commit", &device->to_commit);
+        print_histogram("to photon", &device->to_photon);
+    }
+}
+
+static int handle_sigusr1(int signal_number, void *data) {
+    (void)signal_number;
+    latency_dump(data);
+    return 0;
+}
+
+// A device showed up (LIBINPUT_EVENT_DEVICE_ADDED). Runs on the thread
+// reading libinput, the device is listed by latency_device_added.
+struct ember_input_device *latency_device_create(struct libinput_device *libinput_device) {
+    struct ember_input_device *device = calloc(1, sizeof(struct ember_input_device));
+    if (!device) {
+        return NULL;
+    }
+    device->name = strdup(libinput_device_get_name(libinput_device));
+    if (!device->name) {
+        free(device);
+        return NULL;
+    }
+    libinput_device_set_user_data(libinput_device, device);
+    return device;
+}
+
+void latency_device_added(struct ember_server *server, struct ember_input_device *device) {
+    if (device) {
+        wl_list_insert(server->input_devices.prev, &device->link);
+    }
+}
+
+// The event being handled was sent to this client
+void latency_input_sent(struct ember_seat_client *seat_client) {
+    struct ember_server *server = seat_client->server;
+    if (!server->input_device) {
+        return;
+    }
+    struct ember_latency_sample *samples = seat_client->latency.data;
+    size_t n = seat_client->latency.size / sizeof(*samples);
+    if (n >= EMBER_LATENCY_MAX_PENDING) {
+        return;
+    }
+    // Once per event, however many objects of the client got it
+    if (n > 0 && samples[n - 1].device == server->input_device && samples[n - 1].input_us == server->input_time_us) {
+        return;
+    }
+    struct ember_latency_sample *sample = wl_array_add(&seat_client->latency, sizeof(*sample));
+    if (sample) {
+        sample->device = server->input_device;
+        sample->input_us = server->input_time_us;
+        sample->commit_us = 0;
+    }
+}
+
+// The first commit of a client after it got input answers that input
+void latency_surface_committed(struct ember_surface *surface) {
+    struct ember_seat_client *seat_client = seat_client_from_client(wl_resource_get_client(surface->resource));
+    if (!seat_client || seat_client->latency.size == 0) {
+        return;
+    }
+    uint64_t now = monotonic_us();
+    struct ember_latency_sample *sample;
+    wl_array_for_each(sample, &seat_client->latency) {
+        sample->commit_us = now;
+        histogram_add(&sample->device->to_commit, now > sample->input_us ? now - sample->input_us : 0);
+        // A surface no output draws (a cursor, a hidden window) never hands its samples on
+        if (surface->latency.size / sizeof(*sample) >= EMBER_LATENCY_MAX_PENDING) {
+            continue;
+        }
+        struct ember_latency_sample *shown = wl_array_add(&surface->latency, sizeof(*shown));
+        if (shown) {
+            *shown = *sample;
+        }
+    }
+    seat_client->latency.size = 0;
+}
+
+// The surface is in the frame being drawn: its samples wait for that frame's flip
+void latency_collect(struct ember_surface *surface, struct wl_array *frame) {
+    if (surface->latency.size == 0) {
+        return;
+    }
+    void *dest = wl_array_add(frame, surface->latency.size);
+    if (dest) {
+        memcpy(dest, surface->latency.data, surface->latency.size);
+    }
+    surface->latency.size = 0;
+}
+
+// The frame holding these samples reached the screen
+void latency_frame_presented(struct wl_array *frame, uint64_t vblank_ns) {
+    uint64_t vblank_us = vblank_ns / 1000;
+    struct ember_latency_sample *sample;
+    wl_array_for_each(sample, frame) {
+        histogram_add(&sample->device->to_photon, vblank_us > sample->input_us ? vblank_us - sample->input_us : 0);
+    }
+    frame->size = 0;
+}
+
+void init_latency(struct ember_server *server) {
+    wl_list_init(&server->input_devices);
+    if (!wl_event_loop_add_signal(server->wl_event_loop, SIGUSR1, handle_sigusr1, server)) {
+        fprintf(stderr, "Failed to watch SIGUSR1, input latency is only printed on exit\n");
+    }
+}
@@ -1,11 +1,23 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <signal.h>
 #include "backend.h"
 #include "renderer.h"
 #include "input.h"
+#include "trace.h"
 #include "wayland/protocols.h"
 
+// SIGINT/SIGTERM: leave wl_display_run like ESC does, so the trace and the
+// latency report are still written
+static int on_terminate_signal(int signal_number, void *data) {
+    (void)signal_number;
+    struct ember_server *server = data;
+    wl_display_terminate(server->wl_display);
+    return 0;
+}
+
 // Callback when DRM FD is ready (Page Flip Complete)
 static int on_drm_event(int fd, uint32_t mask, void *data) {
     (void)fd; (void)mask;
@@ -15,8 +27,17 @@ static int on_drm_event(int fd, uint32_t mask, void *data) {
 }
 
 int main(int argc, char *argv[]) {
-    (void)argc; (void)argv;
     printf("Starting Ember Compositor...\n");
+    // --trace <file>: record a trace, same as EMBER_TRACE=<file>
+    const char *trace_path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else {
+            fprintf(stderr, "Usage: %s [--trace <file>]\n", argv[0]);
+            return 1;
+        }
+    }
     struct ember_server server = {0};
     
     // Ensure we see output immediately
@@ -31,13 +52,19 @@ int main(int argc, char *argv[]) {
 
     server.wl_display = wl_display_create();
     server.wl_event_loop = wl_display_get_event_loop(server.wl_display);
+    // Before any thread starts: they inherit the blocked signals
+    wl_event_loop_add_signal(server.wl_event_loop, SIGINT, on_terminate_signal, &server);
+    wl_event_loop_add_signal(server.wl_event_loop, SIGTERM, on_terminate_signal, &server);
     wl_list_init(&server.surfaces);
+    init_scene(&server);
+    if (init_trace(&server, trace_path) < 0) return 1;
 
     // 1. Initialize Backend (DRM -> GBM -> EGL)
     if (init_drm(&server) < 0) return 1;
     
-    // 2. Initialize Output (Modesetting + Renderer + wl_output)
+    // 2. Initialize Outputs (Modesetting + Renderer + wl_output per monitor)
     if (init_output(&server) < 0) return 1;
+    if (init_render_thread(&server) < 0) return 1;
     
     // 3. Initialize Input (libinput + cursor)
     if (init_input(&server) < 0) return 1;
@@ -52,10 +79,9 @@ int main(int argc, char *argv[]) {
     // I will call it manually here to be safe and explicit.
     if (init_seat(&server) < 0) return 1;
 
-    // Render one frame immediately to turn the screen on (Modeset)
-    render_frame(&server);
-    // Render a second frame to start the PageFlip loop (Async Event)
-    render_frame(&server);
+    // The first frame (modeset) of each output is drawn by its repaint
+    // scheduler as soon as the event loop runs; after that an output only
+    // flips when something on it changes
 
     // Hook DRM events into the Wayland Event Loop
     wl_event_loop_add_fd(server.wl_event_loop, server.drm_fd, WL_EVENT_READABLE, on_drm_event, &server);
@@ -69,6 +95,10 @@ int main(int argc, char *argv[]) {
     fflush(stdout);
 
     wl_display_run(server.wl_display);
+    input_thread_finish(&server);
+    render_thread_finish(&server);
+    trace_finish();
+    latency_dump(&server);
     
     wl_display_destroy(server.wl_display);
     return 0;
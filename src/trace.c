@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "trace.h"
+
+// Event tracing.
+// With EMBER_TRACE=<file> in the environment (or --trace <file>) spans of
+// the event loop and the frame stages are recorded and written out as
+// Chrome trace-event JSON on exit, for chrome://tracing or ui.perfetto.dev.
+//
+// Every thread records into a ring of its own, allocated on its first
+// event and never grown, so recording is a clock read and a store. Once a
+// ring is full the oldest events are overwritten: the file holds the last
+// EMBER_TRACE_RING_SIZE events of each thread. With tracing off every
+// trace_* call is a test of ember_trace_enabled; built without
+// -Dtracing they compile to nothing.
+//
+// Input events start flows that end in the next frame rendered after them,
+// so the viewer draws an arrow from each input event to the frame showing
+// its result.
+
+#define EMBER_TRACE_RING_SIZE 65536
+// Flows ending in one frame, older pending ones are dropped
+#define EMBER_TRACE_MAX_FLOWS 64
+
+struct trace_event {
+    uint64_t ts_ns;
+    const char *category;
+    const char *name;
+    uint64_t id; // Flow events
+    char phase;  // Chrome trace phase: B, E, i, s, f
+};
+
+struct trace_ring {
+    struct trace_ring *next; // All rings, newest first
+    int tid;
+    const char *thread_name;
+    uint64_t written; // Total events, the ring holds the last EMBER_TRACE_RING_SIZE
+    struct trace_event events[EMBER_TRACE_RING_SIZE];
+};
+
+int ember_trace_enabled;
+
+static char *trace_path;
+static _Atomic(struct trace_ring *) rings;
+static atomic_int next_tid = 1;
+static _Thread_local struct trace_ring *thread_ring;
+
+// Flow ids handed to input events, and the first one no frame has ended yet
+static atomic_uint_fast64_t flow_next = 1;
+static atomic_uint_fast64_t flow_shown = 1;
+
+static uint64_t monotonic_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static struct trace_ring *get_thread_ring(void) {
+    if (thread_ring) {
+        return thread_ring;
+    }
+    struct trace_ring *ring = calloc(1, sizeof(*ring));
+    if (!ring) {
+        return NULL;
+    }
+    ring->tid = atomic_fetch_add(&next_tid, 1);
+    ring->next = atomic_load(&rings);
+    while (!atomic_compare_exchange_weak(&rings, &ring->next, ring));
+    thread_ring = ring;
+    return ring;
+}
+
+void trace_record(char phase, const char *category, const char *name, uint64_t id) {
+    struct trace_ring *ring = get_thread_ring();
+    if (!ring) {
+        return;
+    }
+    struct trace_event *event = &ring->events[ring->written % EMBER_TRACE_RING_SIZE];
+    event->ts_ns = monotonic_ns();
+    event->category = category;
+    event->name = name;
+    event->id = id;
+    event->phase = phase;
+    ring->written++;
+}
+
+// Name shown for the calling thread
+void trace_thread_name(const char *name) {
+    if (!ember_trace_enabled) {
+        return;
+    }
+    struct trace_ring *ring = get_thread_ring();
+    if (ring) {
+        ring->thread_name = name;
+    }
+}
+
+// Start a flow at the input event being handled, ended by trace_frame_flows
+void trace_input_flow(void) {
+    if (!ember_trace_enabled) {
+        return;
+    }
+    trace_record('s', "input", "input", atomic_fetch_add(&flow_next, 1));
+}
+
+// End the flows of all input handled since the last frame, inside the span
+// of the frame being rendered
+void trace_frame_flows(void) {
+    if (!ember_trace_enabled) {
+        return;
+    }
+    uint64_t end = atomic_load(&flow_next);
+    uint64_t start = atomic_exchange(&flow_shown, end);
+    if (end - start > EMBER_TRACE_MAX_FLOWS) {
+        start = end - EMBER_TRACE_MAX_FLOWS;
+    }
+    for (uint64_t id = start; id < end; id++) {
+        trace_record('f', "input", "input", id);
+    }
+}
+
+// Client requests as instant events, category is the interface
+static void protocol_logger(void *user_data, enum wl_protocol_logger_type direction,
+                            const struct wl_protocol_logger_message *message) {
+    (void)user_data;
+    if (direction != WL_PROTOCOL_LOGGER_REQUEST || !ember_trace_enabled) {
+        return;
+    }
+    trace_record('i', wl_resource_get_class(message->resource), message->message->name, 0);
+}
+
+// Start tracing into path, or $EMBER_TRACE when path is NULL. Not tracing
+// is not an error.
+int init_trace(struct ember_server *server, const char *path) {
+    if (!path) {
+        path = getenv("EMBER_TRACE");
+    }
+    if (!path || !*path) {
+        return 0;
+    }
+    trace_path = strdup(path);
+    if (!trace_path) {
+        return -1;
+    }
+    ember_trace_enabled = 1;
+    // The main thread's ring up front, recording never allocates on it
+    trace_thread_name("main");
+    wl_display_add_protocol_logger(server->wl_display, protocol_logger, NULL);
+    printf("Tracing to %s (written on exit)\n", trace_path);
+    return 0;
+}
+
+static void write_event(FILE *f, const struct trace_ring *ring, const struct trace_event *event, int *first) {
+    fprintf(f, "%s\n{\"ph\":\"%c\",\"cat\":\"%s\",\"name\":\"%s\",\"ts\":%.3f,\"pid\":1,\"tid\":%d",
+            *first ? "" : ",", event->phase, event->category, event->name, event->ts_ns / 1000.0, ring->tid);
+    switch (event->phase) {
+    case 'i':
+        fputs(",\"s\":\"t\"", f);
+        break;
+    case 's':
+        fprintf(f, ",\"id\":%llu", (unsigned long long)event->id);
+        break;
+    case 'f':
+        // Bind to the enclosing span (the frame), not the next one
+        fprintf(f, ",\"id\":%llu,\"bp\":\"e\"", (unsigned long long)event->id);
+        break;
+    }
+    fputc('}', f);
+    *first = 0;
+}
+
+// Write everything recorded to the trace file. Other threads must have
+// stopped recording.
+void trace_finish(void) {
+    if (!ember_trace_enabled) {
+        return;
+    }
+    ember_trace_enabled = 0;
+
+    FILE *f = fopen(trace_path, "w");
+    if (!f) {
+        fprintf(stderr, "Failed to write trace %s: %m\n", trace_path);
+        return;
+    }
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", f);
+    int first = 1;
+    uint64_t dropped = 0;
+    for (struct trace_ring *ring = atomic_load(&rings); ring; ring = ring->next) {
+        if (ring->thread_name) {
+            fprintf(f, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                    first ? "" : ",", ring->tid, ring->thread_name);
+            first = 0;
+        }
+        uint64_t start = 0;
+        if (ring->written > EMBER_TRACE_RING_SIZE) {
+            start = ring->written - EMBER_TRACE_RING_SIZE;
+            dropped += start;
+        }
+        for (uint64_t i = start; i < ring->written; i++) {
+            write_event(f, ring, &ring->events[i % EMBER_TRACE_RING_SIZE], &first);
+        }
+    }
+    fputs("\n]}\n", f);
+    fclose(f);
+    printf("Trace written to %s", trace_path);
+    if (dropped) {
+        printf(" (%llu oldest events overwritten)", (unsigned long long)dropped);
+    }
+    printf("\n");
+}
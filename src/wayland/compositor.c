@@ -1,9 +1,180 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <wayland-server.h>
 #include "ember.h"
+#include "backend.h"
+#include "renderer.h"
+#include "input.h"
+#include "trace.h"
 #include "wayland/protocols.h"
 
+// --- wl_region implementation ---
+
+struct ember_region {
+    pixman_region32_t region;
+};
+
+static void region_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static void region_add(struct wl_client *client, struct wl_resource *resource,
+                       int32_t x, int32_t y, int32_t width, int32_t height) {
+    (void)client;
+    struct ember_region *region = wl_resource_get_user_data(resource);
+    if (width <= 0 || height <= 0) return;
+    pixman_region32_union_rect(&region->region, &region->region, x, y, width, height);
+}
+
+static void region_subtract(struct wl_client *client, struct wl_resource *resource,
+                            int32_t x, int32_t y, int32_t width, int32_t height) {
+    (void)client;
+    struct ember_region *region = wl_resource_get_user_data(resource);
+    if (width <= 0 || height <= 0) return;
+
+    pixman_region32_t rect;
+    pixman_region32_init_rect(&rect, x, y, width, height);
+    pixman_region32_subtract(&region->region, &region->region, &rect);
+    pixman_region32_fini(&rect);
+}
+
+static const struct wl_region_interface region_interface = {
+    .destroy = region_destroy,
+    .add = region_add,
+    .subtract = region_subtract,
+};
+
+static void region_resource_destroy(struct wl_resource *resource) {
+    struct ember_region *region = wl_resource_get_user_data(resource);
+    if (region) {
+        pixman_region32_fini(&region->region);
+        free(region);
+    }
+}
+
+// --- Surface state helpers ---
+
+// The default input region covers the whole (unbounded) surface
+static void region_init_infinite(pixman_region32_t *region) {
+    pixman_region32_init_rect(region, INT32_MIN / 2, INT32_MIN / 2, UINT32_MAX / 2, UINT32_MAX / 2);
+}
+
+static void surface_state_buffer_destroyed(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct ember_surface_state *state = wl_container_of(listener, state, buffer_destroy);
+    state->buffer = NULL;
+    wl_list_remove(&state->buffer_destroy.link);
+    wl_list_init(&state->buffer_destroy.link);
+}
+
+static void surface_state_set_buffer(struct ember_surface_state *state, struct wl_resource *buffer) {
+    if (state->buffer == buffer) return;
+    wl_list_remove(&state->buffer_destroy.link);
+    wl_list_init(&state->buffer_destroy.link);
+    state->buffer = buffer;
+    if (buffer) {
+        wl_resource_add_destroy_listener(buffer, &state->buffer_destroy);
+    }
+}
+
+static void surface_state_init(struct ember_surface_state *state) {
+    state->committed = 0;
+    state->buffer = NULL;
+    state->buffer_destroy.notify = surface_state_buffer_destroyed;
+    wl_list_init(&state->buffer_destroy.link);
+    state->dx = 0;
+    state->dy = 0;
+    pixman_region32_init(&state->damage);
+    pixman_region32_init(&state->buffer_damage);
+    pixman_region32_init(&state->opaque);
+    region_init_infinite(&state->input);
+    state->scale = 1;
+    state->transform = WL_OUTPUT_TRANSFORM_NORMAL;
+    wl_list_init(&state->frame_callbacks);
+}
+
+static void surface_state_fini(struct ember_surface_state *state) {
+    struct wl_resource *cb, *tmp;
+    wl_resource_for_each_safe(cb, tmp, &state->frame_callbacks) {
+        wl_resource_destroy(cb);
+    }
+    surface_state_set_buffer(state, NULL);
+    pixman_region32_fini(&state->damage);
+    pixman_region32_fini(&state->buffer_damage);
+    pixman_region32_fini(&state->opaque);
+    pixman_region32_fini(&state->input);
+}
+
+// Let the client reuse the current buffer and forget about it
+static void surface_release_current_buffer(struct ember_surface *surface) {
+    if (surface->current.buffer) {
+        // A buffer still on a KMS plane is released once it leaves the screen
+        struct ember_dmabuf_buffer *dmabuf = dmabuf_buffer_from_resource(surface->current.buffer);
+        if (dmabuf && kms_buffer_busy(dmabuf)) {
+            dmabuf->release_deferred = 1;
+        } else {
+            wl_buffer_send_release(surface->current.buffer);
+        }
+        surface_state_set_buffer(&surface->current, NULL);
+    }
+}
+
+// Odd transforms rotate by 90 or 270 degrees and swap width and height
+static int transform_swaps_axes(int32_t transform) {
+    return transform & 1;
+}
+
+// Map buffer damage to surface coordinates. Only scaling is mapped exactly,
+// rotated or flipped buffers damage the whole surface.
+static void buffer_to_surface_damage(struct ember_surface *surface, pixman_region32_t *buffer_damage,
+                                     pixman_region32_t *surface_damage) {
+    int32_t scale = surface->current.scale;
+
+    if (surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+        if (pixman_region32_not_empty(buffer_damage)) {
+            pixman_region32_union_rect(surface_damage, surface_damage, 0, 0, surface->width, surface->height);
+        }
+        return;
+    }
+
+    int n_boxes;
+    pixman_box32_t *boxes = pixman_region32_rectangles(buffer_damage, &n_boxes);
+    for (int i = 0; i < n_boxes; i++) {
+        int32_t x1 = boxes[i].x1 / scale;
+        int32_t y1 = boxes[i].y1 / scale;
+        int32_t x2 = (boxes[i].x2 + scale - 1) / scale;
+        int32_t y2 = (boxes[i].y2 + scale - 1) / scale;
+        pixman_region32_union_rect(surface_damage, surface_damage, x1, y1, x2 - x1, y2 - y1);
+    }
+}
+
+// Map surface damage to buffer coordinates (for uploads), same rules as above
+static void surface_to_buffer_damage(struct ember_surface *surface, pixman_region32_t *surface_damage,
+                                     pixman_region32_t *buffer_damage) {
+    int32_t scale = surface->current.scale;
+
+    if (surface->current.transform != WL_OUTPUT_TRANSFORM_NORMAL) {
+        if (pixman_region32_not_empty(surface_damage)) {
+            pixman_region32_union_rect(buffer_damage, buffer_damage, 0, 0,
+                                       surface->buffer_width, surface->buffer_height);
+        }
+        return;
+    }
+
+    int n_boxes;
+    pixman_box32_t *boxes = pixman_region32_rectangles(surface_damage, &n_boxes);
+    for (int i = 0; i < n_boxes; i++) {
+        pixman_region32_union_rect(buffer_damage, buffer_damage,
+                                   boxes[i].x1 * scale, boxes[i].y1 * scale,
+                                   (boxes[i].x2 - boxes[i].x1) * scale,
+                                   (boxes[i].y2 - boxes[i].y1) * scale);
+    }
+}
+
+// --- wl_surface implementation ---
+
 static void surface_destroy(struct wl_client *client, struct wl_resource *resource) {
     (void)client;
     wl_resource_destroy(resource);
@@ -11,55 +182,230 @@ static void surface_destroy(struct wl_client *client, struct wl_resource *resour
 
 static void surface_attach(struct wl_client *client, struct wl_resource *resource,
                            struct wl_resource *buffer, int32_t x, int32_t y) {
-    (void)client; (void)x; (void)y;
+    (void)client;
     struct ember_surface *surface = wl_resource_get_user_data(resource);
-    surface->buffer = buffer;
+    surface_state_set_buffer(&surface->pending, buffer);
+    surface->pending.dx = x;
+    surface->pending.dy = y;
+    surface->pending.committed |= EMBER_SURFACE_STATE_BUFFER;
 }
 
 static void surface_damage(struct wl_client *client, struct wl_resource *resource,
                            int32_t x, int32_t y, int32_t width, int32_t height) {
-    (void)client; (void)resource; (void)x; (void)y; (void)width; (void)height;
-    // TODO: Track damage
+    (void)client;
+    struct ember_surface *surface = wl_resource_get_user_data(resource);
+    if (width <= 0 || height <= 0) return;
+    pixman_region32_union_rect(&surface->pending.damage, &surface->pending.damage, x, y, width, height);
+}
+
+static void callback_resource_destroy(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
 }
 
 static void surface_frame(struct wl_client *client, struct wl_resource *resource, uint32_t callback) {
-    (void)resource;
-    // Create the callback resource (required by protocol)
+    struct ember_surface *surface = wl_resource_get_user_data(resource);
     struct wl_resource *cb = wl_resource_create(client, &wl_callback_interface, 1, callback);
     if (!cb) {
         wl_resource_post_no_memory(resource);
         return;
     }
-    // For now, immediately signal done (proper compositor would do this after render)
-    wl_callback_send_done(cb, 0);
-    wl_resource_destroy(cb);
+    wl_resource_set_implementation(cb, NULL, NULL, callback_resource_destroy);
+
+    // Queued until commit, then fired after the page flip that shows the surface
+    wl_list_insert(surface->pending.frame_callbacks.prev, wl_resource_get_link(cb));
 }
 
 static void surface_set_opaque_region(struct wl_client *client, struct wl_resource *resource,
-                                      struct wl_resource *region) {
-    (void)client; (void)resource; (void)region;
+                                      struct wl_resource *region_resource) {
+    (void)client;
+    struct ember_surface *surface = wl_resource_get_user_data(resource);
+    if (region_resource) {
+        struct ember_region *region = wl_resource_get_user_data(region_resource);
+        pixman_region32_copy(&surface->pending.opaque, &region->region);
+    } else {
+        pixman_region32_clear(&surface->pending.opaque);
+    }
+    surface->pending.committed |= EMBER_SURFACE_STATE_OPAQUE_REGION;
 }
 
 static void surface_set_input_region(struct wl_client *client, struct wl_resource *resource,
-                                     struct wl_resource *region) {
-    (void)client; (void)resource; (void)region;
+                                     struct wl_resource *region_resource) {
+    (void)client;
+    struct ember_surface *surface = wl_resource_get_user_data(resource);
+    if (region_resource) {
+        struct ember_region *region = wl_resource_get_user_data(region_resource);
+        pixman_region32_copy(&surface->pending.input, &region->region);
+    } else {
+        pixman_region32_fini(&surface->pending.input);
+        region_init_infinite(&surface->pending.input);
+    }
+    surface->pending.committed |= EMBER_SURFACE_STATE_INPUT_REGION;
 }
 
 static void surface_commit(struct wl_client *client, struct wl_resource *resource) {
-    (void)client; (void)resource;
+    (void)client;
+    struct ember_surface *surface = wl_resource_get_user_data(resource);
+    struct ember_surface_state *pending = &surface->pending;
+    struct ember_surface_state *current = &surface->current;
+    trace_begin("wayland", "surface_commit");
+
+    int32_t old_x = surface->pos_x;
+    int32_t old_y = surface->pos_y;
+    int32_t old_width = surface->width;
+    int32_t old_height = surface->height;
+
+    // 1. Apply the pending state
+    struct wl_shm_buffer *shm_buffer = NULL;
+    struct ember_dmabuf_buffer *dmabuf = NULL;
+    if (pending->committed & EMBER_SURFACE_STATE_BUFFER) {
+        // The previous buffer is no longer needed once another one is committed
+        if (current->buffer != pending->buffer) {
+            surface_release_current_buffer(surface);
+        }
+        surface_state_set_buffer(current, pending->buffer);
+        surface_state_set_buffer(pending, NULL);
+
+        scene_node_set_position(&surface->node, surface->node.x + pending->dx, surface->node.y + pending->dy);
+
+        shm_buffer = current->buffer ? wl_shm_buffer_get(current->buffer) : NULL;
+        dmabuf = dmabuf_buffer_from_resource(current->buffer);
+        if (shm_buffer) {
+            surface->buffer_width = wl_shm_buffer_get_width(shm_buffer);
+            surface->buffer_height = wl_shm_buffer_get_height(shm_buffer);
+        } else if (dmabuf) {
+            surface->buffer_width = dmabuf->attributes.width;
+            surface->buffer_height = dmabuf->attributes.height;
+        } else {
+            surface->buffer_width = 0;
+            surface->buffer_height = 0;
+        }
+    }
+    if (pending->committed & EMBER_SURFACE_STATE_SCALE) {
+        current->scale = pending->scale;
+    }
+    if (pending->committed & EMBER_SURFACE_STATE_TRANSFORM) {
+        current->transform = pending->transform;
+    }
+    if (pending->committed & EMBER_SURFACE_STATE_OPAQUE_REGION) {
+        pixman_region32_copy(&current->opaque, &pending->opaque);
+    }
+    if (pending->committed & EMBER_SURFACE_STATE_INPUT_REGION) {
+        pixman_region32_copy(&current->input, &pending->input);
+    }
+    wl_list_insert_list(current->frame_callbacks.prev, &pending->frame_callbacks);
+    wl_list_init(&pending->frame_callbacks);
+
+    // 2. Derive the surface size from buffer size, scale and transform
+    int32_t width = surface->buffer_width / current->scale;
+    int32_t height = surface->buffer_height / current->scale;
+    if (transform_swaps_axes(current->transform)) {
+        surface->width = height;
+        surface->height = width;
+    } else {
+        surface->width = width;
+        surface->height = height;
+    }
+
+    // 3. Update the GPU copy of the contents
+    if (shm_buffer || dmabuf) {
+        pixman_region32_t upload;
+        pixman_region32_init(&upload);
+        pixman_region32_copy(&upload, &pending->buffer_damage);
+        surface_to_buffer_damage(surface, &pending->damage, &upload);
+
+        if (shm_buffer) {
+            // Copy the new contents to the GPU once, then hand the buffer back
+            renderer_upload_surface(surface->server, surface, shm_buffer, &upload);
+            surface_release_current_buffer(surface);
+        } else {
+            // Sampled in place, released when the next buffer is committed
+            dmabuf->release_deferred = 0;
+            renderer_attach_dmabuf(surface->server, surface, dmabuf);
+        }
+        pixman_region32_fini(&upload);
+
+        // New contents answer the input the client got since its last commit
+        latency_surface_committed(surface);
+    }
+
+    // The render list picks up size, texture and opacity changes
+    scene_surface_update(surface);
+
+    // 4. Turn the surface damage into output damage
+    pixman_region32_t damage;
+    pixman_region32_init(&damage);
+    pixman_region32_copy(&damage, &pending->damage);
+    buffer_to_surface_damage(surface, &pending->buffer_damage, &damage);
+    pixman_region32_intersect_rect(&damage, &damage, 0, 0, surface->width, surface->height);
+    pixman_region32_translate(&damage, surface->pos_x, surface->pos_y);
+
+    // A move, resize or unmap exposes whatever was below the old area
+    int moved = surface->pos_x != old_x || surface->pos_y != old_y ||
+                surface->width != old_width || surface->height != old_height;
+    if (moved || (pending->committed & EMBER_SURFACE_STATE_INPUT_REGION)) {
+        // May now be under the pointer, or no longer
+        input_surface_changed(surface);
+    }
+    if (moved) {
+        pixman_region32_union_rect(&damage, &damage, old_x, old_y, old_width, old_height);
+        pixman_region32_union_rect(&damage, &damage, surface->pos_x, surface->pos_y,
+                                   surface->width, surface->height);
+    }
+
+    if (surface->plane && !moved) {
+        // On its own KMS plane: the next commit picks up the new buffer,
+        // nothing has to be composited
+        schedule_surface_repaint(surface);
+    } else {
+        damage_region(surface->server, &damage);
+    }
+    pixman_region32_fini(&damage);
+
+    // A frame callback needs a frame even if nothing visibly changed
+    if (!wl_list_empty(&current->frame_callbacks)) {
+        schedule_surface_repaint(surface);
+    }
+
+    // 5. Reset the pending state for the next round
+    pending->committed = 0;
+    pending->dx = 0;
+    pending->dy = 0;
+    pixman_region32_clear(&pending->damage);
+    pixman_region32_clear(&pending->buffer_damage);
+    trace_end("wayland", "surface_commit");
 }
 
 static void surface_set_buffer_transform(struct wl_client *client, struct wl_resource *resource, int32_t transform) {
-    (void)client; (void)resource; (void)transform;
+    (void)client;
+    struct ember_surface *surface = wl_resource_get_user_data(resource);
+    if (transform < WL_OUTPUT_TRANSFORM_NORMAL || transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
+        wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_TRANSFORM,
+                               "buffer transform must be a valid transform (%d specified)", transform);
+        return;
+    }
+    surface->pending.transform = transform;
+    surface->pending.committed |= EMBER_SURFACE_STATE_TRANSFORM;
 }
 
 static void surface_set_buffer_scale(struct wl_client *client, struct wl_resource *resource, int32_t scale) {
-    (void)client; (void)resource; (void)scale;
+    (void)client;
+    struct ember_surface *surface = wl_resource_get_user_data(resource);
+    if (scale < 1) {
+        wl_resource_post_error(resource, WL_SURFACE_ERROR_INVALID_SCALE,
+                               "buffer scale must be at least one (%d specified)", scale);
+        return;
+    }
+    surface->pending.scale = scale;
+    surface->pending.committed |= EMBER_SURFACE_STATE_SCALE;
 }
 
 static void surface_damage_buffer(struct wl_client *client, struct wl_resource *resource,
                                   int32_t x, int32_t y, int32_t width, int32_t height) {
-    (void)client; (void)resource; (void)x; (void)y; (void)width; (void)height;
+    (void)client;
+    struct ember_surface *surface = wl_resource_get_user_data(resource);
+    if (width <= 0 || height <= 0) return;
+    pixman_region32_union_rect(&surface->pending.buffer_damage, &surface->pending.buffer_damage,
+                               x, y, width, height);
 }
 
 static const struct wl_surface_interface surface_interface = {
@@ -80,7 +426,17 @@ static const struct wl_surface_interface surface_interface = {
 static void surface_resource_destroy(struct wl_resource *resource) {
     struct ember_surface *surface = wl_resource_get_user_data(resource);
     if (surface) {
+        // Whatever was below the surface becomes visible
+        damage_box(surface->server, surface->pos_x, surface->pos_y, surface->width, surface->height);
+        kms_surface_destroyed(surface);
+        renderer_destroy_surface(surface);
         wl_list_remove(&surface->link);
+        scene_node_destroy(&surface->node);
+        input_surface_destroyed(surface);
+        surface_release_current_buffer(surface);
+        surface_state_fini(&surface->pending);
+        surface_state_fini(&surface->current);
+        wl_array_release(&surface->latency);
         free(surface);
     }
 }
@@ -88,44 +444,29 @@ static void surface_resource_destroy(struct wl_resource *resource) {
 static void compositor_create_surface(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
     struct ember_server *server = wl_resource_get_user_data(resource);
     struct wl_resource *surface_resource = wl_resource_create(client, &wl_surface_interface, wl_resource_get_version(resource), id);
-    
+
     struct ember_surface *surface = calloc(1, sizeof(struct ember_surface));
     if (!surface) {
         wl_resource_post_no_memory(surface_resource);
         return;
     }
-    
+
+    surface->server = server;
     surface->resource = surface_resource;
+    // New surfaces go on top, cascaded so they do not all cover each other
+    surface->stack_order = ++server->next_stack_order;
+    scene_node_init(&surface->node, &server->scene, &server->scene.layers[EMBER_SCENE_LAYER_WINDOWS], surface);
+    scene_node_set_position(&surface->node, 100 + (int32_t)(surface->stack_order % 16) * 40,
+                            100 + (int32_t)(surface->stack_order % 16) * 30);
+    surface_state_init(&surface->pending);
+    surface_state_init(&surface->current);
+    wl_array_init(&surface->latency);
     wl_list_insert(&server->surfaces, &surface->link);
 
     wl_resource_set_implementation(surface_resource, &surface_interface, surface, surface_resource_destroy);
 
 }
 
-// --- wl_region implementation ---
-
-static void region_destroy(struct wl_client *client, struct wl_resource *resource) {
-    (void)client;
-    wl_resource_destroy(resource);
-}
-
-static void region_add(struct wl_client *client, struct wl_resource *resource,
-                       int32_t x, int32_t y, int32_t width, int32_t height) {
-    (void)client; (void)resource; (void)x; (void)y; (void)width; (void)height;
-    // For now, we don't track region geometry (just need the object to exist)
-}
-
-static void region_subtract(struct wl_client *client, struct wl_resource *resource,
-                            int32_t x, int32_t y, int32_t width, int32_t height) {
-    (void)client; (void)resource; (void)x; (void)y; (void)width; (void)height;
-}
-
-static const struct wl_region_interface region_interface = {
-    .destroy = region_destroy,
-    .add = region_add,
-    .subtract = region_subtract,
-};
-
 static void compositor_create_region(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
     (void)resource;
     struct wl_resource *region_resource = wl_resource_create(client, &wl_region_interface, 1, id);
@@ -133,7 +474,15 @@ static void compositor_create_region(struct wl_client *client, struct wl_resourc
         wl_client_post_no_memory(client);
         return;
     }
-    wl_resource_set_implementation(region_resource, &region_interface, NULL, NULL);
+
+    struct ember_region *region = calloc(1, sizeof(struct ember_region));
+    if (!region) {
+        wl_resource_destroy(region_resource);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    pixman_region32_init(&region->region);
+    wl_resource_set_implementation(region_resource, &region_interface, region, region_resource_destroy);
 }
 
 static const struct wl_compositor_interface compositor_interface = {
@@ -159,7 +508,8 @@ int init_wayland_globals(struct ember_server *server) {
     if (init_shm(server) < 0) return -1;
     if (init_shell(server) < 0) return -1;
     if (init_data_device_manager(server) < 0) return -1;
+    if (init_linux_dmabuf(server) < 0) return -1;
     
-    printf("Initialized Wayland Globals (Compositor + SHM + Shell + DDM)\n");
+    printf("Initialized Wayland Globals (Compositor + SHM + Shell + DDM + DMA-BUF)\n");
     return 0;
 }
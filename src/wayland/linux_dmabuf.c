@@ -0,0 +1,323 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <drm_fourcc.h>
+#include <wayland-server.h>
+#include "ember.h"
+#include "backend.h"
+#include "wayland/protocols.h"
+#include "linux-dmabuf-unstable-v1-protocol.h"
+
+// Pending buffer description built up by zwp_linux_buffer_params_v1.add
+struct ember_dmabuf_params {
+    struct wl_resource *resource;
+    struct ember_server *server;
+    struct ember_dmabuf_attributes attributes;
+    int plane_set[EMBER_DMABUF_MAX_PLANES];
+    int used;
+};
+
+static void close_attributes(struct ember_dmabuf_attributes *attributes) {
+    for (int i = 0; i < EMBER_DMABUF_MAX_PLANES; i++) {
+        if (attributes->fd[i] >= 0) {
+            close(attributes->fd[i]);
+            attributes->fd[i] = -1;
+        }
+    }
+    attributes->n_planes = 0;
+}
+
+// --- wl_buffer implementation ---
+
+static void buffer_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_buffer_interface buffer_implementation = {
+    .destroy = buffer_destroy,
+};
+
+static void buffer_resource_destroy(struct wl_resource *resource) {
+    struct ember_dmabuf_buffer *buffer = wl_resource_get_user_data(resource);
+    if (!buffer) return;
+
+    // Textures sampling this image keep their own reference to the storage
+    if (buffer->image != EGL_NO_IMAGE_KHR) {
+        buffer->server->egl_destroy_image(buffer->server->egl_display, buffer->image);
+    }
+    kms_buffer_destroyed(buffer);
+    close_attributes(&buffer->attributes);
+    free(buffer);
+}
+
+struct ember_dmabuf_buffer *dmabuf_buffer_from_resource(struct wl_resource *resource) {
+    if (!resource || !wl_resource_instance_of(resource, &wl_buffer_interface, &buffer_implementation)) {
+        return NULL;
+    }
+    return wl_resource_get_user_data(resource);
+}
+
+// --- zwp_linux_buffer_params_v1 implementation ---
+
+static void params_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static void params_add(struct wl_client *client, struct wl_resource *resource, int32_t fd,
+                       uint32_t plane_idx, uint32_t offset, uint32_t stride,
+                       uint32_t modifier_hi, uint32_t modifier_lo) {
+    (void)client;
+    struct ember_dmabuf_params *params = wl_resource_get_user_data(resource);
+
+    if (params->used) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                               "params was already used to create a wl_buffer");
+        close(fd);
+        return;
+    }
+    if (plane_idx >= EMBER_DMABUF_MAX_PLANES) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX,
+                               "plane index %u is too high", plane_idx);
+        close(fd);
+        return;
+    }
+    if (params->plane_set[plane_idx]) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET,
+                               "a dmabuf has already been added for plane %u", plane_idx);
+        close(fd);
+        return;
+    }
+
+    uint64_t modifier = ((uint64_t)modifier_hi << 32) | modifier_lo;
+    if (params->attributes.n_planes > 0 && params->attributes.modifier != modifier) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT,
+                               "all planes must use the same modifier");
+        close(fd);
+        return;
+    }
+
+    params->attributes.modifier = modifier;
+    params->attributes.fd[plane_idx] = fd;
+    params->attributes.offset[plane_idx] = offset;
+    params->attributes.stride[plane_idx] = stride;
+    params->plane_set[plane_idx] = 1;
+    params->attributes.n_planes++;
+}
+
+// Validate the collected planes. Posts a protocol error and returns -1 on failure.
+static int params_validate(struct ember_dmabuf_params *params) {
+    struct ember_dmabuf_attributes *attributes = &params->attributes;
+
+    if (attributes->n_planes == 0) {
+        wl_resource_post_error(params->resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+                               "no dmabuf has been added");
+        return -1;
+    }
+    for (int i = 0; i < attributes->n_planes; i++) {
+        if (!params->plane_set[i]) {
+            wl_resource_post_error(params->resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE,
+                                   "missing dmabuf for plane %d", i);
+            return -1;
+        }
+    }
+    if (attributes->width <= 0 || attributes->height <= 0) {
+        wl_resource_post_error(params->resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS,
+                               "invalid size %dx%d", attributes->width, attributes->height);
+        return -1;
+    }
+
+    for (int i = 0; i < attributes->n_planes; i++) {
+        uint64_t plane_end = (uint64_t)attributes->offset[i] + attributes->stride[i];
+        uint64_t image_end = (uint64_t)attributes->offset[i] + (uint64_t)attributes->stride[i] * attributes->height;
+        if (plane_end > UINT32_MAX || (i == 0 && image_end > UINT32_MAX)) {
+            wl_resource_post_error(params->resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+                                   "size calculation for plane %d overflowed", i);
+            return -1;
+        }
+
+        // Not every dmabuf supports seeking, only check when we get a size
+        off_t size = lseek(attributes->fd[i], 0, SEEK_END);
+        if (size == -1) continue;
+        if (attributes->offset[i] >= (uint64_t)size || plane_end > (uint64_t)size ||
+            (i == 0 && image_end > (uint64_t)size)) {
+            wl_resource_post_error(params->resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS,
+                                   "plane %d is out of bounds of its dmabuf", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void params_create_common(struct wl_client *client, struct wl_resource *resource,
+                                 uint32_t buffer_id, int32_t width, int32_t height,
+                                 uint32_t format, uint32_t flags) {
+    struct ember_dmabuf_params *params = wl_resource_get_user_data(resource);
+
+    if (params->used) {
+        wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED,
+                               "params was already used to create a wl_buffer");
+        return;
+    }
+    params->used = 1;
+
+    params->attributes.width = width;
+    params->attributes.height = height;
+    params->attributes.format = format;
+    params->attributes.flags = flags;
+
+    if (params_validate(params) < 0) {
+        return;
+    }
+
+    struct ember_dmabuf_buffer *buffer = calloc(1, sizeof(struct ember_dmabuf_buffer));
+    if (!buffer) {
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+    buffer->server = params->server;
+    buffer->image = EGL_NO_IMAGE_KHR;
+
+    // Y-inverted and interlaced buffers are not handled by the renderer
+    if (flags == 0) {
+        buffer->image = egl_import_dmabuf(params->server, &params->attributes);
+    }
+    if (buffer->image == EGL_NO_IMAGE_KHR) {
+        free(buffer);
+        if (buffer_id == 0) {
+            zwp_linux_buffer_params_v1_send_failed(resource);
+        } else {
+            wl_resource_post_error(resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER,
+                                   "importing the supplied dmabufs failed");
+        }
+        return;
+    }
+
+    buffer->resource = wl_resource_create(client, &wl_buffer_interface, 1, buffer_id);
+    if (!buffer->resource) {
+        buffer->server->egl_destroy_image(buffer->server->egl_display, buffer->image);
+        free(buffer);
+        wl_resource_post_no_memory(resource);
+        return;
+    }
+
+    // The buffer takes over the file descriptors
+    buffer->attributes = params->attributes;
+    for (int i = 0; i < EMBER_DMABUF_MAX_PLANES; i++) {
+        params->attributes.fd[i] = -1;
+    }
+    params->attributes.n_planes = 0;
+
+    wl_resource_set_implementation(buffer->resource, &buffer_implementation, buffer, buffer_resource_destroy);
+
+    if (buffer_id == 0) {
+        zwp_linux_buffer_params_v1_send_created(resource, buffer->resource);
+    }
+}
+
+static void params_create(struct wl_client *client, struct wl_resource *resource,
+                          int32_t width, int32_t height, uint32_t format, uint32_t flags) {
+    params_create_common(client, resource, 0, width, height, format, flags);
+}
+
+static void params_create_immed(struct wl_client *client, struct wl_resource *resource, uint32_t buffer_id,
+                                int32_t width, int32_t height, uint32_t format, uint32_t flags) {
+    params_create_common(client, resource, buffer_id, width, height, format, flags);
+}
+
+static const struct zwp_linux_buffer_params_v1_interface params_implementation = {
+    .destroy = params_destroy,
+    .add = params_add,
+    .create = params_create,
+    .create_immed = params_create_immed,
+};
+
+static void params_resource_destroy(struct wl_resource *resource) {
+    struct ember_dmabuf_params *params = wl_resource_get_user_data(resource);
+    if (params) {
+        close_attributes(&params->attributes);
+        free(params);
+    }
+}
+
+// --- zwp_linux_dmabuf_v1 implementation ---
+
+static void dmabuf_destroy(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static void dmabuf_create_params(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+    struct ember_server *server = wl_resource_get_user_data(resource);
+    struct wl_resource *params_resource = wl_resource_create(client, &zwp_linux_buffer_params_v1_interface,
+                                                             wl_resource_get_version(resource), id);
+    if (!params_resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+
+    struct ember_dmabuf_params *params = calloc(1, sizeof(struct ember_dmabuf_params));
+    if (!params) {
+        wl_resource_destroy(params_resource);
+        wl_client_post_no_memory(client);
+        return;
+    }
+    params->resource = params_resource;
+    params->server = server;
+    params->attributes.modifier = DRM_FORMAT_MOD_INVALID;
+    for (int i = 0; i < EMBER_DMABUF_MAX_PLANES; i++) {
+        params->attributes.fd[i] = -1;
+    }
+
+    wl_resource_set_implementation(params_resource, &params_implementation, params, params_resource_destroy);
+}
+
+static const struct zwp_linux_dmabuf_v1_interface dmabuf_implementation = {
+    .destroy = dmabuf_destroy,
+    .create_params = dmabuf_create_params,
+};
+
+static void dmabuf_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+    struct ember_server *server = data;
+    struct wl_resource *resource = wl_resource_create(client, &zwp_linux_dmabuf_v1_interface, version, id);
+    if (!resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &dmabuf_implementation, server, NULL);
+
+    // Advertise what we can import
+    struct ember_dmabuf_format *entry;
+    uint32_t last_format = DRM_FORMAT_INVALID;
+    wl_array_for_each(entry, &server->dmabuf_formats) {
+        if (version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION) {
+            zwp_linux_dmabuf_v1_send_modifier(resource, entry->format,
+                                              entry->modifier >> 32, entry->modifier & 0xFFFFFFFF);
+        } else if (entry->format != last_format) {
+            // Entries are grouped by format, send each one once
+            zwp_linux_dmabuf_v1_send_format(resource, entry->format);
+        }
+        last_format = entry->format;
+    }
+}
+
+int init_linux_dmabuf(struct ember_server *server) {
+    wl_array_init(&server->dmabuf_formats);
+    if (egl_get_dmabuf_formats(server, &server->dmabuf_formats) <= 0) {
+        printf("EGL cannot import dmabufs, zwp_linux_dmabuf_v1 disabled\n");
+        return 0;
+    }
+
+    server->linux_dmabuf_global = wl_global_create(server->wl_display, &zwp_linux_dmabuf_v1_interface, 3, server, dmabuf_bind);
+    if (!server->linux_dmabuf_global) {
+        fprintf(stderr, "Failed to create zwp_linux_dmabuf_v1 global\n");
+        return -1;
+    }
+    printf("Initialized Wayland Globals (Linux DMA-BUF, %zu format/modifier pairs)\n",
+           server->dmabuf_formats.size / sizeof(struct ember_dmabuf_format));
+    return 0;
+}
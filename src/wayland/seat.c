@@ -5,26 +5,153 @@
 #include <errno.h>
 #include <sys/mman.h>
 #include <string.h>
+#include <fcntl.h>
 #include <xkbcommon/xkbcommon.h>
 #include <wayland-server.h>
 #include "ember.h"
 #include "backend.h"
+#include "input.h"
+#include "wayland/protocols.h"
 
-// Helper to create an anonymous file for Keymap transmission
-static int os_create_anonymous_file(off_t size) {
-    int fd = memfd_create("ember-keymap", MFD_CLOEXEC);
+// --- Keymap ---
+// The keymap is compiled once and its text kept in one sealed memfd that
+// every wl_keyboard is sent. The seals make the file immutable, so all
+// clients can safely map the same pages.
+
+static int create_keymap_fd(const char *text, size_t size) {
+    int fd = memfd_create("ember-keymap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
     if (fd < 0) {
         fprintf(stderr, "memfd_create failed: %s\n", strerror(errno));
         return -1;
     }
-    if (ftruncate(fd, size) < 0) {
-        fprintf(stderr, "ftruncate failed: %s\n", strerror(errno));
+    size_t written = 0;
+    while (written < size) {
+        ssize_t ret = write(fd, text + written, size - written);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "Failed to write keymap: %s\n", strerror(errno));
+            close(fd);
+            return -1;
+        }
+        written += ret;
+    }
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        fprintf(stderr, "Failed to seal keymap: %s\n", strerror(errno));
         close(fd);
         return -1;
     }
     return fd;
 }
 
+static void keyboard_send_keymap(struct ember_server *server, struct wl_resource *keyboard) {
+    if (server->keymap_fd >= 0) {
+        wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, server->keymap_fd, server->keymap_size);
+    }
+}
+
+// Compile the keymap for names (NULL: the XKB_DEFAULT_* environment, then
+// the libxkbcommon defaults) and send it to every keyboard. Only needed at
+// startup and when the layout changes.
+int seat_set_keymap(struct ember_server *server, const struct xkb_rule_names *names) {
+    struct xkb_keymap *keymap = xkb_keymap_new_from_names(server->xkb_context, names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+    if (!keymap) {
+        fprintf(stderr, "Failed to compile keymap\n");
+        return -1;
+    }
+    char *text = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+    if (!text) {
+        xkb_keymap_unref(keymap);
+        return -1;
+    }
+    size_t size = strlen(text) + 1;
+    int fd = create_keymap_fd(text, size);
+    free(text);
+    struct xkb_state *state = fd >= 0 ? xkb_state_new(keymap) : NULL;
+    if (!state) {
+        if (fd >= 0) close(fd);
+        xkb_keymap_unref(keymap);
+        return -1;
+    }
+
+    if (server->keymap_fd >= 0) {
+        close(server->keymap_fd);
+    }
+    xkb_state_unref(server->xkb_state);
+    xkb_keymap_unref(server->xkb_keymap);
+    server->xkb_keymap = keymap;
+    server->xkb_state = state;
+    server->keymap_fd = fd;
+    server->keymap_size = size;
+
+    // Clients already running switch over; modifiers start from scratch
+    struct ember_seat_client *seat_client;
+    wl_list_for_each(seat_client, &server->seat_clients, link) {
+        struct wl_resource *keyboard;
+        wl_resource_for_each(keyboard, &seat_client->keyboards) {
+            keyboard_send_keymap(server, keyboard);
+        }
+    }
+    dispatch_keyboard_modifiers(server);
+
+    printf("Keymap compiled (%zu bytes)\n", size);
+    return 0;
+}
+
+// --- Per-client seat state ---
+
+static void seat_client_handle_destroy(struct wl_listener *listener, void *data) {
+    (void)data;
+    struct ember_seat_client *seat_client = wl_container_of(listener, seat_client, destroy);
+
+    // The client's resources are destroyed after this, their destructors
+    // must not touch the lists freed here
+    struct wl_list *lists[] = {
+        &seat_client->seats, &seat_client->pointers, &seat_client->keyboards, &seat_client->touches,
+    };
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        struct wl_resource *resource, *tmp;
+        wl_resource_for_each_safe(resource, tmp, lists[i]) {
+            wl_list_init(wl_resource_get_link(resource));
+        }
+    }
+    wl_list_remove(&seat_client->destroy.link);
+    wl_list_remove(&seat_client->link);
+    wl_array_release(&seat_client->latency);
+    free(seat_client);
+}
+
+// Seat state of a client, NULL if it never bound wl_seat
+struct ember_seat_client *seat_client_from_client(struct wl_client *client) {
+    struct wl_listener *listener = wl_client_get_destroy_listener(client, seat_client_handle_destroy);
+    if (!listener) {
+        return NULL;
+    }
+    struct ember_seat_client *seat_client = wl_container_of(listener, seat_client, destroy);
+    return seat_client;
+}
+
+static struct ember_seat_client *seat_client_create(struct ember_server *server, struct wl_client *client) {
+    struct ember_seat_client *seat_client = calloc(1, sizeof(struct ember_seat_client));
+    if (!seat_client) {
+        return NULL;
+    }
+    seat_client->server = server;
+    seat_client->client = client;
+    wl_list_init(&seat_client->seats);
+    wl_list_init(&seat_client->pointers);
+    wl_list_init(&seat_client->keyboards);
+    wl_list_init(&seat_client->touches);
+    wl_array_init(&seat_client->latency);
+    seat_client->destroy.notify = seat_client_handle_destroy;
+    wl_client_add_destroy_listener(client, &seat_client->destroy);
+    wl_list_insert(&server->seat_clients, &seat_client->link);
+    return seat_client;
+}
+
+// Destructor of every seat resource: drop it from its seat client list
+static void seat_resource_destroy(struct wl_resource *resource) {
+    wl_list_remove(wl_resource_get_link(resource));
+}
 
 // --- wl_pointer implementation ---
 
@@ -54,61 +181,59 @@ static const struct wl_keyboard_interface keyboard_interface = {
     .release = keyboard_release,
 };
 
+// --- wl_touch implementation ---
+
+static void touch_release(struct wl_client *client, struct wl_resource *resource) {
+    (void)client;
+    wl_resource_destroy(resource);
+}
+
+static const struct wl_touch_interface touch_interface = {
+    .release = touch_release,
+};
+
 // --- wl_seat implementation ---
 
 static void seat_get_pointer(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
-    struct ember_server *server = wl_resource_get_user_data(resource);
+    struct ember_seat_client *seat_client = wl_resource_get_user_data(resource);
     struct wl_resource *pointer_resource = wl_resource_create(client, &wl_pointer_interface, wl_resource_get_version(resource), id);
-    wl_resource_set_implementation(pointer_resource, &pointer_interface, server, NULL);
-
-    // Add to server's pointer list
-    wl_list_insert(&server->pointer_resources, wl_resource_get_link(pointer_resource));
+    if (!pointer_resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(pointer_resource, &pointer_interface, seat_client->server, seat_resource_destroy);
+    wl_list_insert(&seat_client->pointers, wl_resource_get_link(pointer_resource));
 }
 
 static void seat_get_keyboard(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
-    struct ember_server *server = wl_resource_get_user_data(resource);
+    struct ember_seat_client *seat_client = wl_resource_get_user_data(resource);
     struct wl_resource *keyboard_resource = wl_resource_create(client, &wl_keyboard_interface, wl_resource_get_version(resource), id);
-    wl_resource_set_implementation(keyboard_resource, &keyboard_interface, server, NULL);
-
-    // Add to server's keyboard list
-    wl_list_insert(&server->keyboard_resources, wl_resource_get_link(keyboard_resource));
+    if (!keyboard_resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(keyboard_resource, &keyboard_interface, seat_client->server, seat_resource_destroy);
+    wl_list_insert(&seat_client->keyboards, wl_resource_get_link(keyboard_resource));
 
     // Mandatory: Send repeat info (rate/delay)
     if (wl_resource_get_version(keyboard_resource) >= 4) {
         wl_keyboard_send_repeat_info(keyboard_resource, 25, 600);
     }
-    if (wl_resource_get_version(keyboard_resource) >= 4) {
-        wl_keyboard_send_repeat_info(keyboard_resource, 25, 600);
-    }
 
-    // Create and Send Keymap (REQUIRED for GTK clients)
-    
-    struct xkb_context *ctx = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-    struct xkb_keymap *keymap = xkb_keymap_new_from_names(ctx, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
-    char *keymap_string = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
-    size_t size = strlen(keymap_string) + 1;
-    
-    int fd = os_create_anonymous_file(size);
-    if (fd >= 0) {
-        void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-        if (ptr != MAP_FAILED) {
-            strcpy(ptr, keymap_string);
-            munmap(ptr, size);
-            wl_keyboard_send_keymap(keyboard_resource, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1, fd, size);
-        }
-        close(fd);
-    } else {
-        fprintf(stderr, "Failed to create keymap file\n");
-    }
-    
-    free(keymap_string);
-    xkb_keymap_unref(keymap);
-    xkb_context_unref(ctx);
-    
+    // Keymap (REQUIRED for GTK clients), compiled once at startup
+    keyboard_send_keymap(seat_client->server, keyboard_resource);
 }
 
 static void seat_get_touch(struct wl_client *client, struct wl_resource *resource, uint32_t id) {
-    (void)client; (void)resource; (void)id;
+    // No touch capability is advertised, the object just never gets events
+    struct ember_seat_client *seat_client = wl_resource_get_user_data(resource);
+    struct wl_resource *touch_resource = wl_resource_create(client, &wl_touch_interface, wl_resource_get_version(resource), id);
+    if (!touch_resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(touch_resource, &touch_interface, seat_client->server, seat_resource_destroy);
+    wl_list_insert(&seat_client->touches, wl_resource_get_link(touch_resource));
 }
 
 static void seat_release(struct wl_client *client, struct wl_resource *resource) {
@@ -126,9 +251,17 @@ static const struct wl_seat_interface seat_interface = {
 static void seat_bind(struct wl_client *client, void *data, uint32_t version, uint32_t id) {
     struct ember_server *server = data;
     (void)version;
+    struct ember_seat_client *seat_client = seat_client_from_client(client);
+    if (!seat_client) {
+        seat_client = seat_client_create(server, client);
+    }
     struct wl_resource *resource = wl_resource_create(client, &wl_seat_interface, version, id);
-    wl_list_insert(&server->seat_resources, wl_resource_get_link(resource));
-    wl_resource_set_implementation(resource, &seat_interface, server, NULL);
+    if (!seat_client || !resource) {
+        wl_client_post_no_memory(client);
+        return;
+    }
+    wl_resource_set_implementation(resource, &seat_interface, seat_client, seat_resource_destroy);
+    wl_list_insert(&seat_client->seats, wl_resource_get_link(resource));
 
     // Advertise capabilities (Pointer + Keyboard)
     uint32_t caps = WL_SEAT_CAPABILITY_POINTER | WL_SEAT_CAPABILITY_KEYBOARD;
@@ -140,9 +273,16 @@ static void seat_bind(struct wl_client *client, void *data, uint32_t version, ui
 }
 
 int init_seat(struct ember_server *server) {
-    wl_list_init(&server->seat_resources);
-    wl_list_init(&server->keyboard_resources);
-    wl_list_init(&server->pointer_resources);
+    wl_list_init(&server->seat_clients);
+    server->keymap_fd = -1;
+    server->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+    if (!server->xkb_context) {
+        fprintf(stderr, "Failed to create xkb context\n");
+        return -1;
+    }
+    if (seat_set_keymap(server, NULL) < 0) {
+        return -1;
+    }
     server->seat_global = wl_global_create(server->wl_display, &wl_seat_interface, 5, server, seat_bind);
     if (!server->seat_global) {
         fprintf(stderr, "Failed to create wl_seat global\n");
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <stdint.h>
+#include <wayland-server.h>
 #include "ember.h"
+#include "renderer.h"
 
 int init_shm(struct ember_server *server) {
     // Use the built-in Wayland SHM implementation
@@ -8,6 +11,20 @@ int init_shm(struct ember_server *server) {
         fprintf(stderr, "Failed to initialize wl_shm\n");
         return -1;
     }
+
+    // Advertise what the renderer samples directly, ARGB8888 and XRGB8888
+    // are always there
+    struct wl_array formats;
+    wl_array_init(&formats);
+    renderer_get_shm_formats(server, &formats);
+    uint32_t *format;
+    wl_array_for_each(format, &formats) {
+        if (*format != WL_SHM_FORMAT_ARGB8888 && *format != WL_SHM_FORMAT_XRGB8888) {
+            wl_display_add_shm_format(server->wl_display, *format);
+        }
+    }
+    wl_array_release(&formats);
+
     printf("Initialized Wayland Globals (SHM)\n");
     return 0;
 }